@@ -0,0 +1,138 @@
+/*****************************************************************//**
+ * \file   async_writer.cpp
+ * \brief  Background file output.
+ *********************************************************************/
+
+#include "async_writer.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: Construction, starts the writer threads
+//-----------------------------------------------------------------------------
+CAsyncFileWriter::CAsyncFileWriter(int nThreads, size_t nMaxPendingBytes, CompletionFn_t fnCompletion)
+	: m_fnCompletion(fnCompletion)
+{
+	m_nPendingBytes = 0;
+	m_nMaxPendingBytes = nMaxPendingBytes;
+	m_bClosing = false;
+	m_nFailed = 0;
+
+	if (nThreads < 1)
+	{
+		nThreads = 1;
+	}
+
+	for (int i = 0; i < nThreads; i++)
+	{
+		m_Threads.emplace_back(&CAsyncFileWriter::WorkerLoop, this);
+	}
+}
+
+CAsyncFileWriter::~CAsyncFileWriter(void)
+{
+	Finish();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Queue a file, a single buffer over the budget is still let through
+//			once everything before it is written
+//-----------------------------------------------------------------------------
+void CAsyncFileWriter::Write(const char* pszPath, const void* pData, int nSize, bool bFreeData, int nTag)
+{
+	size_t nCost = bFreeData ? (size_t)nSize : 0;
+
+	std::unique_lock<std::mutex> lock(m_Lock);
+	Assert(!m_bClosing);
+	m_HasRoom.wait(lock, [&] { return !m_nPendingBytes || m_nPendingBytes + nCost <= m_nMaxPendingBytes; });
+
+	Request_t& request = m_Requests.emplace_back();
+	request.m_Path = pszPath;
+	request.m_pData = pData;
+	request.m_nSize = nSize;
+	request.m_bFreeData = bFreeData;
+	request.m_nTag = nTag;
+
+	m_nPendingBytes += nCost;
+	m_HasWork.notify_one();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drain the queue and join the threads
+//-----------------------------------------------------------------------------
+int CAsyncFileWriter::Finish(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_bClosing = true;
+		m_HasWork.notify_all();
+	}
+
+	for (auto& thread : m_Threads)
+	{
+		thread.join();
+	}
+	m_Threads.clear();
+
+	return m_nFailed;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Writer thread, runs until closed and drained
+//-----------------------------------------------------------------------------
+void CAsyncFileWriter::WorkerLoop(void)
+{
+	for (;;)
+	{
+		Request_t request;
+		{
+			std::unique_lock<std::mutex> lock(m_Lock);
+			m_HasWork.wait(lock, [this] { return m_bClosing || !m_Requests.empty(); });
+			if (m_Requests.empty())
+			{
+				return;
+			}
+
+			request = m_Requests.front();
+			m_Requests.pop_front();
+		}
+
+		bool bSuccess = WriteOut(request);
+
+		if (request.m_bFreeData)
+		{
+			free((void*)request.m_pData);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_Lock);
+			if (request.m_bFreeData)
+			{
+				m_nPendingBytes -= request.m_nSize;
+			}
+			if (!bSuccess)
+			{
+				m_nFailed++;
+			}
+			m_HasRoom.notify_all();
+		}
+
+		if (m_fnCompletion)
+		{
+			m_fnCompletion(request.m_nTag, bSuccess);
+		}
+	}
+}
+
+bool CAsyncFileWriter::WriteOut(const Request_t& request)
+{
+	HANDLE hFile = CreateFile(request.m_Path.String(), GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	bool bSuccess = !request.m_nSize || CWin32File::FileWrite(hFile, (void*)request.m_pData, request.m_nSize);
+	bSuccess &= (CloseHandle(hFile) != FALSE);
+
+	return bSuccess;
+}
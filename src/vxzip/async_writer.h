@@ -0,0 +1,96 @@
+/*****************************************************************//**
+ * \file   async_writer.h
+ * \brief  Background file output, so decode threads do not wait on
+ *			file creation and writes.
+ *********************************************************************/
+#ifndef _ASYNC_WRITER_H_
+#define _ASYNC_WRITER_H_
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "source_sdk.h"
+
+/**
+ * Writes whole files on a few background threads.
+ *
+ * Producers queue a finished buffer and move on, the writer threads do the
+ * create, write and close. Extracting many small files is bound by the
+ * latency of those calls rather than by the decoder, several of them in
+ * flight hide it. Owned buffers count against a budget, Write blocks while
+ * it is used up so a slow disk throttles the decoders.
+ */
+class CAsyncFileWriter
+{
+public:
+	/**
+	 * Called on a writer thread once a file is done.
+	 */
+	typedef std::function<void(int nTag, bool bSuccess)> CompletionFn_t;
+
+	/**
+	 * Default constructor.
+	 *
+	 * \param nThreads			Number of writer threads, at least one
+	 * \param nMaxPendingBytes	Budget for owned buffers waiting to be written
+	 * \param fnCompletion		Completion callback, must be thread safe
+	 */
+	CAsyncFileWriter(int nThreads, size_t nMaxPendingBytes, CompletionFn_t fnCompletion);
+	~CAsyncFileWriter(void);
+
+	/**
+	 * Queues a file. Thread safe, blocks while the budget is used up.
+	 *
+	 * \param pszPath		Output file, created or truncated
+	 * \param pData			File contents
+	 * \param nSize			Size of the contents
+	 * \param bFreeData		True to hand pData over, it is free()d once written
+	 * \param nTag			Passed to the completion callback
+	 */
+	void	Write(const char* pszPath, const void* pData, int nSize, bool bFreeData, int nTag);
+
+	/**
+	 * Waits for every queued file and stops the threads. No writes after this.
+	 *
+	 * \return Number of files that failed
+	 */
+	int		Finish(void);
+
+private:
+	CAsyncFileWriter(const CAsyncFileWriter&) = delete;
+	CAsyncFileWriter& operator=(const CAsyncFileWriter&) = delete;
+
+	struct Request_t
+	{
+		CUtlString	m_Path;
+		const void*	m_pData;
+		int			m_nSize;
+		bool		m_bFreeData;
+		int			m_nTag;
+	};
+
+	void	WorkerLoop(void);
+	bool	WriteOut(const Request_t& request);
+
+	std::mutex					m_Lock;
+	std::condition_variable		m_HasWork;
+	std::condition_variable		m_HasRoom;
+	std::deque<Request_t>		m_Requests;
+	size_t						m_nPendingBytes;
+	size_t						m_nMaxPendingBytes;
+	bool						m_bClosing;
+	int							m_nFailed;
+
+	std::vector<std::thread>	m_Threads;
+	CompletionFn_t				m_fnCompletion;
+};
+
+#endif // _ASYNC_WRITER_H_
@@ -0,0 +1,108 @@
+/*****************************************************************//**
+ * \file   job_pool.cpp
+ * \brief  Small work-stealing job pool.
+ *********************************************************************/
+
+#include "job_pool.h"
+
+#include <thread>
+
+//-----------------------------------------------------------------------------
+// Purpose: Construction
+//-----------------------------------------------------------------------------
+CJobPool::CJobPool(int nThreads)
+{
+	m_nThreads = (nThreads > 0) ? nThreads : GetDefaultThreadCount();
+
+	for (int i = 0; i < m_nThreads; i++)
+	{
+		m_Queues.push_back(std::make_unique<JobQueue_t>());
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Number of hardware threads
+//-----------------------------------------------------------------------------
+int CJobPool::GetDefaultThreadCount()
+{
+	int nThreads = (int)std::thread::hardware_concurrency();
+	return (nThreads > 0) ? nThreads : 1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Run a batch of jobs, blocks until complete
+//-----------------------------------------------------------------------------
+void CJobPool::Run(int nJobs, const std::function<void(int)>& fn)
+{
+	if (nJobs <= 0)
+	{
+		return;
+	}
+
+	if (m_nThreads == 1 || nJobs == 1)
+	{
+		// nothing to spread
+		for (int i = 0; i < nJobs; i++)
+		{
+			fn(i);
+		}
+		return;
+	}
+
+	// deal the jobs, keeping submission order within each queue
+	for (int i = 0; i < nJobs; i++)
+	{
+		m_Queues[i % m_nThreads]->m_Jobs.push_back(i);
+	}
+
+	int nWorkers = (nJobs < m_nThreads) ? nJobs : m_nThreads;
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < nWorkers; i++)
+	{
+		threads.emplace_back(&CJobPool::WorkerLoop, this, i, std::cref(fn));
+	}
+
+	// caller is worker zero
+	WorkerLoop(0, fn);
+
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Take the next job, own queue first and then steal
+//-----------------------------------------------------------------------------
+bool CJobPool::PopJob(int nThread, int& job)
+{
+	for (int i = 0; i < m_nThreads; i++)
+	{
+		JobQueue_t* pQueue = m_Queues[(nThread + i) % m_nThreads].get();
+
+		std::lock_guard<std::mutex> lock(pQueue->m_Lock);
+		if (!pQueue->m_Jobs.empty())
+		{
+			// thieves also take the oldest job, it is the most expensive one left
+			job = pQueue->m_Jobs.front();
+			pQueue->m_Jobs.pop_front();
+			return true;
+		}
+	}
+
+	return false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Worker body, no jobs are added while a batch runs so an empty
+//			sweep over all queues means we are done
+//-----------------------------------------------------------------------------
+void CJobPool::WorkerLoop(int nThread, const std::function<void(int)>& fn)
+{
+	int job;
+	while (PopJob(nThread, job))
+	{
+		fn(job);
+	}
+}
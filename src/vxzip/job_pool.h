@@ -0,0 +1,141 @@
+/*****************************************************************//**
+ * \file   job_pool.h
+ * \brief  Small work-stealing job pool used to spread pak work
+ *			(extraction, compression, verification) over all cores,
+ *			plus a bounded queue for pipelined stages.
+ *********************************************************************/
+#ifndef _JOB_POOL_H_
+#define _JOB_POOL_H_
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Runs a batch of indexed jobs over a fixed number of threads.
+ *
+ * Jobs are dealt round-robin into one queue per thread, in the order given.
+ * A thread drains its own queue first and then steals from the others, so
+ * an uneven batch does not leave threads idle.
+ */
+class CJobPool
+{
+public:
+	/**
+	 * Default constructor.
+	 *
+	 * \param nThreads	Number of threads to use, <= 0 picks one per core
+	 */
+	CJobPool(int nThreads);
+
+	/**
+	 * Runs fn(job) for every job in [0, nJobs) and blocks until all are done.
+	 * The calling thread takes part in the work.
+	 *
+	 * Callers that want largest-first scheduling should sort their jobs by
+	 * cost (descending) before submitting, thieves also take the oldest job.
+	 *
+	 * \param nJobs		Number of jobs in the batch
+	 * \param fn		Job body, receives the job index
+	 */
+	void Run(int nJobs, const std::function<void(int)>& fn);
+
+	int GetThreadCount() const { return m_nThreads; }
+
+	/**
+	 * Number of hardware threads, at least one.
+	 */
+	static int GetDefaultThreadCount();
+
+private:
+	struct JobQueue_t
+	{
+		std::mutex		m_Lock;
+		std::deque<int>	m_Jobs;
+	};
+
+	bool PopJob(int nThread, int& job);
+	void WorkerLoop(int nThread, const std::function<void(int)>& fn);
+
+	int m_nThreads;
+	std::vector<std::unique_ptr<JobQueue_t>> m_Queues;
+};
+
+/**
+ * Blocking FIFO with a fixed capacity, used to connect pipeline stages.
+ * Producers block while it is full, so a slow stage throttles the ones
+ * feeding it instead of letting work pile up in memory.
+ */
+template <class T>
+class CBoundedQueue
+{
+public:
+	CBoundedQueue(size_t nCapacity) : m_nCapacity(nCapacity ? nCapacity : 1), m_bClosed(false) {}
+
+	/**
+	 * Adds an item, blocks while the queue is full.
+	 *
+	 * \return False if the queue was closed (the item is dropped)
+	 */
+	bool Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(m_Lock);
+		m_NotFull.wait(lock, [this] { return m_bClosed || m_Items.size() < m_nCapacity; });
+		if (m_bClosed)
+		{
+			return false;
+		}
+
+		m_Items.push_back(std::move(item));
+		m_NotEmpty.notify_one();
+		return true;
+	}
+
+	/**
+	 * Takes the oldest item, blocks while the queue is empty.
+	 *
+	 * \return False once the queue is closed and drained
+	 */
+	bool Pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(m_Lock);
+		m_NotEmpty.wait(lock, [this] { return m_bClosed || !m_Items.empty(); });
+		if (m_Items.empty())
+		{
+			return false;
+		}
+
+		item = std::move(m_Items.front());
+		m_Items.pop_front();
+		m_NotFull.notify_one();
+		return true;
+	}
+
+	/**
+	 * Ends the stream, queued items can still be popped.
+	 */
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(m_Lock);
+		m_bClosed = true;
+		m_NotFull.notify_all();
+		m_NotEmpty.notify_all();
+	}
+
+private:
+	std::mutex				m_Lock;
+	std::condition_variable	m_NotFull;
+	std::condition_variable	m_NotEmpty;
+	std::deque<T>			m_Items;
+	size_t					m_nCapacity;
+	bool					m_bClosed;
+};
+
+#endif // _JOB_POOL_H_
@@ -26,7 +26,7 @@ abstract_class IWriteStream
 {
 public:
 	virtual void Put(const void* pMem, int size) = 0;
-	virtual unsigned int Tell(void) = 0;
+	virtual uint64 Tell(void) = 0;
 };
 
 /**
@@ -72,7 +72,12 @@ public:
 		return hFile;
 	}
 
-	static unsigned int FileSeek(HANDLE hFile, unsigned int distance, DWORD MoveMethod)
+	/**
+	 * Moves the file pointer, offsets are 64 bit so paks may pass 4 GB.
+	 *
+	 * \return New file pointer, (uint64)-1 on failure
+	 */
+	static uint64 FileSeek(HANDLE hFile, uint64 distance, DWORD MoveMethod)
 	{
 		LARGE_INTEGER li;
 
@@ -83,10 +88,10 @@ public:
 			li.QuadPart = -1;
 		}
 
-		return (unsigned int)li.QuadPart;
+		return (uint64)li.QuadPart;
 	}
 
-	static unsigned int FileTell(HANDLE hFile)
+	static uint64 FileTell(HANDLE hFile)
 	{
 		return FileSeek(hFile, 0, FILE_CURRENT);
 	}
@@ -98,12 +103,79 @@ public:
 		return bSuccess && (numBytesRead == size);
 	}
 
+	/**
+	 * Positional read, it does not depend on the file pointer so it is safe
+	 * to call from several threads on the same handle. On a synchronous
+	 * handle it does move the pointer to the end of the read though, callers
+	 * that also FileRead/FileWrite the handle have to seek first.
+	 */
+	static bool FileReadAt(HANDLE hFile, uint64 offset, void* pBuffer, unsigned int size)
+	{
+		OVERLAPPED overlapped = { 0 };
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+		DWORD numBytesRead;
+		BOOL bSuccess = ::ReadFile(hFile, pBuffer, size, &numBytesRead, &overlapped);
+		return bSuccess && (numBytesRead == size);
+	}
+
 	static bool FileWrite(HANDLE hFile, void* pBuffer, unsigned int size)
 	{
 		DWORD numBytesWritten;
 		BOOL bSuccess = WriteFile(hFile, pBuffer, size, &numBytesWritten, NULL);
 		return bSuccess && (numBytesWritten == size);
 	}
+
+	/**
+	 * Maps an entire file read-only into the address space.
+	 *
+	 * \param hFile		Open file handle (needs read access)
+	 * \param hMapping	Receives the mapping object, INVALID_HANDLE_VALUE on failure
+	 * \param size		Receives the size of the view
+	 * \return Base of the view, NULL on failure (empty files can not be mapped)
+	 */
+	static const void* MapFile(HANDLE hFile, HANDLE& hMapping, unsigned int& size)
+	{
+		hMapping = INVALID_HANDLE_VALUE;
+		size = 0;
+
+		LARGE_INTEGER li;
+		if (!GetFileSizeEx(hFile, &li) || li.QuadPart == 0 || li.HighPart != 0)
+		{
+			return NULL;
+		}
+
+		HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!hMap)
+		{
+			return NULL;
+		}
+
+		const void* pView = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+		if (!pView)
+		{
+			// most likely out of address space
+			CloseHandle(hMap);
+			return NULL;
+		}
+
+		hMapping = hMap;
+		size = li.LowPart;
+		return pView;
+	}
+
+	static void UnmapFile(const void* pView, HANDLE hMapping)
+	{
+		if (pView)
+		{
+			UnmapViewOfFile(pView);
+		}
+		if (hMapping != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(hMapping);
+		}
+	}
 };
 
 /**
@@ -115,7 +187,7 @@ public:
 	CBufferStream(CUtlBuffer& buff) : IWriteStream(), m_buff(&buff) {}
 
 	virtual void Put(const void* pMem, int size) { m_buff->Put(pMem, size); }
-	virtual unsigned int Tell(void) { return m_buff->TellPut(); }
+	virtual uint64 Tell(void) { return m_buff->TellPut(); }
 
 private:
 	CUtlBuffer* m_buff;
@@ -143,11 +215,11 @@ public:
 		}
 	}
 
-	virtual unsigned int Tell(void)
+	virtual uint64 Tell(void)
 	{
 		if (m_file)
 		{
-			return ftell(m_file);
+			return _ftelli64(m_file);
 		}
 		else
 		{
@@ -160,4 +232,143 @@ private:
 	HANDLE	m_hFile;
 };
 
+/**
+ * Default block size of CBufferedFileStream.
+ */
+#define WRITE_STREAM_BUFFER_SIZE (1024 * 1024)
+
+/**
+ * Buffered file output. Small puts are gathered and go out in blocks that
+ * end on multiples of the buffer size in the file, payloads that cover a
+ * whole block are written in place without a copy. The position is tracked
+ * here, so Tell needs no syscall. Pending data goes out with Flush or when
+ * the stream is destroyed.
+ */
+class CBufferedFileStream : public IWriteStream
+{
+public:
+	CBufferedFileStream(FILE* fout, unsigned int nBufferSize = WRITE_STREAM_BUFFER_SIZE) : IWriteStream(), m_file(fout), m_hFile(INVALID_HANDLE_VALUE)
+	{
+		Init(_ftelli64(fout), nBufferSize);
+	}
+
+	CBufferedFileStream(HANDLE hOutFile, unsigned int nBufferSize = WRITE_STREAM_BUFFER_SIZE) : IWriteStream(), m_file(NULL), m_hFile(hOutFile)
+	{
+		Init(CWin32File::FileTell(hOutFile), nBufferSize);
+	}
+
+	~CBufferedFileStream(void)
+	{
+		Flush();
+		free(m_pBuffer);
+	}
+
+	virtual void Put(const void* pMem, int size)
+	{
+		const unsigned char* pData = (const unsigned char*)pMem;
+		unsigned int nSize = (size > 0) ? (unsigned int)size : 0;
+		if (!m_pBuffer)
+		{
+			// out of memory for the buffer, write through
+			WriteOut(pData, nSize);
+			m_nPosition += nSize;
+			return;
+		}
+
+		while (nSize)
+		{
+			// room up to the next block boundary
+			unsigned int nRoom = m_nBufferSize - (unsigned int)(m_nPosition % m_nBufferSize);
+			if (!m_nBuffered && nSize >= nRoom)
+			{
+				// nothing pending, write whole blocks straight from the caller
+				unsigned int nDirect = nRoom + (nSize - nRoom) / m_nBufferSize * m_nBufferSize;
+				WriteOut(pData, nDirect);
+				pData += nDirect;
+				nSize -= nDirect;
+				m_nPosition += nDirect;
+				continue;
+			}
+
+			unsigned int nCopy = Min(nSize, nRoom);
+			memcpy(m_pBuffer + m_nBuffered, pData, nCopy);
+			m_nBuffered += nCopy;
+			pData += nCopy;
+			nSize -= nCopy;
+			m_nPosition += nCopy;
+
+			if (nCopy == nRoom)
+			{
+				Flush();
+			}
+		}
+	}
+
+	virtual uint64 Tell(void)
+	{
+		return m_nPosition;
+	}
+
+	/**
+	 * Writes out whatever is pending.
+	 */
+	void Flush(void)
+	{
+		if (m_nBuffered)
+		{
+			WriteOut(m_pBuffer, m_nBuffered);
+			m_nBuffered = 0;
+		}
+	}
+
+	/**
+	 * \return False if a write failed
+	 */
+	bool IsValid(void) const
+	{
+		return !m_bError;
+	}
+
+private:
+	CBufferedFileStream(const CBufferedFileStream&) = delete;
+	CBufferedFileStream& operator=(const CBufferedFileStream&) = delete;
+
+	void Init(uint64 nPosition, unsigned int nBufferSize)
+	{
+		m_nBufferSize = Max(nBufferSize, 4096u);
+		m_pBuffer = (unsigned char*)malloc(m_nBufferSize);
+		m_nBuffered = 0;
+		m_nPosition = nPosition;
+		m_bError = false;
+	}
+
+	void WriteOut(const void* pMem, unsigned int size)
+	{
+		if (!size)
+		{
+			// fwrite of zero items returns 0, which is not a failure
+			return;
+		}
+
+		if (m_file)
+		{
+			m_bError |= (fwrite(pMem, size, 1, m_file) != 1);
+		}
+		else
+		{
+			DWORD numBytesWritten = 0;
+			BOOL bSuccess = WriteFile(m_hFile, pMem, size, &numBytesWritten, NULL);
+			m_bError |= (!bSuccess || numBytesWritten != size);
+		}
+	}
+
+	FILE*			m_file;
+	HANDLE			m_hFile;
+	unsigned char*	m_pBuffer;
+	unsigned int	m_nBufferSize;
+	unsigned int	m_nBuffered;
+	uint64			m_nPosition;
+	bool			m_bError;
+};
+
 #endif // _SOURCE_SDK_H_
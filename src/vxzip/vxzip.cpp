@@ -63,15 +63,45 @@ int CVXZipApp::Main()
 	auto idxBuildParam = CommandLine()->FindParm(this->m_szBuildToken);
 	auto idxExtractParam = CommandLine()->FindParm(this->m_szExtractToken);
 	auto idxTargetParam = CommandLine()->FindParm(this->m_szTargetToken);
+	auto idxVerifyParam = CommandLine()->FindParm(this->m_szVerifyToken);
 
 	auto paramTarget = CUtlString(CommandLine()->GetParm(idxTargetParam + 1));
 	auto paramAction = CUtlString();
 
-	if (idxBuildParam)
+	this->m_nJobs = CommandLine()->ParmValue(this->m_szJobsToken, 1);
+	this->m_nPreloadSize = Max(0, CommandLine()->ParmValue(this->m_szPreloadToken, 0));
+	this->m_bDeduplicate = (CommandLine()->FindParm(this->m_szDedupToken) != 0);
+	this->m_flMinGain = clamp(CommandLine()->ParmValue(this->m_szMinGainToken, this->m_flMinGain), 0.0f, 100.0f);
+	this->m_nCompressionLevel = CommandLine()->ParmValue(this->m_szLevelToken, 0);
+	this->m_bStats = (CommandLine()->FindParm(this->m_szStatsToken) != 0);
+	this->m_StatsPath = CommandLine()->ParmValue(this->m_szStatsToken, "");
+
+	const char* pszCodec = CommandLine()->ParmValue(this->m_szCodecToken, (const char*)NULL);
+	if (pszCodec)
+	{
+		this->m_eCompressionType = CXZipCodec::FromName(pszCodec);
+		if (!CXZipCodec::CanEncode(this->m_eCompressionType))
+		{
+			Warning("Codec %s is not available in this build\n", pszCodec);
+			return 1;
+		}
+	}
+
+	if (idxVerifyParam)
+	{
+		// verify xzip
+		paramAction.Set(CommandLine()->GetParm(idxVerifyParam + 1));
+		if (!this->VerifyXZip(paramAction))
+		{
+			Msg("Done, FAILED!\n");
+			return 1;
+		}
+	}
+	else if (idxBuildParam)
 	{
 		// build xzip
 		paramAction.Set(CommandLine()->GetParm(idxBuildParam + 1));
-		this->BuildXZip(paramTarget, paramAction);
+		this->BuildXZip(paramAction, paramTarget);
 	}
 	else
 	{
@@ -112,7 +142,15 @@ void CVXZipApp::PrintHelp()
 	Msg("Options:\n");
 	Msg("\t%s [input folder]            Build pak file(s)\n", this->m_szBuildToken);
 	Msg("\t%s [input zip]               Extract pak file\n", this->m_szExtractToken);
+	Msg("\t%s [input zip]          Verify pak file CRCs without extracting\n", this->m_szVerifyToken);
 	Msg("\t%s [target zip or folder]    Target zip filename or output folder\n", this->m_szTargetToken);
+	Msg("\t%s [threads]                 Worker threads, 0 for one per core (default 1)\n", this->m_szJobsToken);
+	Msg("\t%s [bytes]             Preload section size per entry when building (default 0, off)\n", this->m_szPreloadToken);
+	Msg("\t%s                       Store identical files only once when building\n", this->m_szDedupToken);
+	Msg("\t%s [percent]           Store files that compress by less than this (default %g)\n", this->m_szMinGainToken, XZIP_DEFAULT_MIN_GAIN * 100.0f);
+	Msg("\t%s [none|lzma|zstd|lz4]  Codec when building (default lzma when available)\n", this->m_szCodecToken);
+	Msg("\t%s [level]               Codec level for zstd and lz4, 0 for the codec default\n", this->m_szLevelToken);
+	Msg("\t%s [file]                Dump pak metrics as JSON to file, or to the console\n", this->m_szStatsToken);
 	Msg("\n");
 }
 
@@ -121,6 +159,19 @@ bool CVXZipApp::ParseCommandLine()
 	auto idxBuildArg = CommandLine()->FindParm(this->m_szBuildToken);
 	auto idxExtractArg = CommandLine()->FindParm(this->m_szExtractToken);
 	auto idxTargetArg = CommandLine()->FindParm(this->m_szTargetToken);
+	auto idxVerifyArg = CommandLine()->FindParm(this->m_szVerifyToken);
+
+	if (idxVerifyArg)
+	{
+		// verify only reads, it takes no target and no other action
+		if (idxBuildArg || idxExtractArg)
+		{
+			Error("Invalid parameter(s) provided.\n");
+			return false;
+		}
+
+		return true;
+	}
 
 	if (!idxTargetArg ||					// target parameter is always required
 		(!idxBuildArg && !idxExtractArg) ||	// we need a build/extract parameter
@@ -139,21 +190,266 @@ void CVXZipApp::ExtractXZip(CUtlString& outputPath, CUtlString& zipPath)
 	fs::path path { outputPath.AbsPath().Get() };
 	OpenXZip(zipPath);
 	ExtractAllFiles(path);
+	CloseXZip();
 }
 
+/**
+ * Files stored in text mode (CRLF on disk, LF in game).
+ */
+static bool IsTextFile(const fs::path& path)
+{
+	char szExt[16];
+	V_strncpy(szExt, path.extension().string().c_str(), sizeof(szExt));
+	V_strlower(szExt);
+
+	return !V_strcmp(szExt, ".cfg") || !V_strcmp(szExt, ".txt") ||
+		!V_strcmp(szExt, ".vmt");
+}
+
+/**
+ * Reads a whole file into a buffer.
+ */
+static bool ReadInputFile(const fs::path& path, bool bTextMode, CUtlBuffer& buf)
+{
+	FILE* fp = fopen(path.string().c_str(), "rb");
+	if (!fp)
+		return false;
+
+	fseek(fp, 0, SEEK_END);
+	int size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+
+	buf.EnsureCapacity(size);
+	bool bSuccess = (size >= 0) && (size == 0 || fread(buf.Base(), size, 1, fp) == 1);
+	fclose(fp);
+
+	if (!bSuccess)
+		return false;
+
+	if (bTextMode)
+	{
+		// text mode expands LF to CRLF, so bring CRLF sources back to LF first
+		size = CXZipText::Collapse((char*)buf.Base(), size);
+	}
+
+	buf.SeekPut(CUtlBuffer::SEEK_HEAD, size);
+	return true;
+}
+
+/**
+ * Unit of work flowing through the BuildXZip pipeline.
+ */
+struct BuildItem_t
+{
+	int								m_nSequence;
+	bool							m_bTextMode;
+	bool							m_bValid;
+	fs::path						m_FullPath;
+	CUtlString						m_RelPath;
+	CUtlBuffer						m_FileData;
+	CXZipFile::PreparedBuffer_t		m_Prepared;
+};
+typedef std::unique_ptr<BuildItem_t> BuildItemPtr;
+
 void CVXZipApp::BuildXZip(CUtlString& inputPath, CUtlString& zipPath)
 {
-	// todo: Build file list from inputPath
-	// todo: Convert files that qualify
-	// todo: Assemble XZip pak
-	// todo: Write XZip pak to disk
+	fs::path rootPath { inputPath.AbsPath().Get() };
+	fs::path pakPath { zipPath.AbsPath().Get() };
+
+	if (!fs::is_directory(rootPath))
+	{
+		Error("Input folder %s does not exist\n", rootPath.string().c_str());
+		return;
+	}
+
+	// payloads spill to a cache next to the pak as soon as they are added
+	m_pXZipFile = new CXZipFile(pakPath.parent_path().string().c_str(), true);
+	m_pXZipFile->SetMetricsEnabled(m_bStats);
+	m_pXZipFile->SetPreloadSize(this->m_nPreloadSize);
+	m_pXZipFile->SetDeduplicate(this->m_bDeduplicate);
+	m_pXZipFile->SetMinCompressionGain(this->m_flMinGain / 100.0f);
+	m_pXZipFile->SetCompressionLevel(this->m_nCompressionLevel);
+
+	const auto compressionType = this->m_eCompressionType;
+
+	const int nReadThreads = 2;
+	const int nCompressThreads = (this->m_nJobs > 0) ? this->m_nJobs : CJobPool::GetDefaultThreadCount();
+	const int nMaxInFlight = nCompressThreads * 4;
+
+	CBoundedQueue<BuildItemPtr> walkQueue(nCompressThreads);
+	CBoundedQueue<BuildItemPtr> readQueue(nCompressThreads);
+	CBoundedQueue<BuildItemPtr> compressQueue(nCompressThreads);
+
+	// the walker takes a ticket per file and the writer hands it back once the
+	// file is in the pak, this caps the items alive anywhere in the pipeline
+	CBoundedQueue<int> tickets(nMaxInFlight);
+	for (int i = 0; i < nMaxInFlight; i++)
+		tickets.Push(i);
+
+	// an exception would take the whole process down from a thread, so the
+	// walker sticks to the error_code overloads and stops the pipeline by
+	// closing its queue early when the folder can not be walked
+	std::atomic<bool> bWalkFailed(false);
+	std::thread walker([&]
+	{
+		int nSequence = 0;
+		std::error_code ec;
+		fs::recursive_directory_iterator it(rootPath, fs::directory_options::skip_permission_denied, ec);
+		for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+		{
+			const fs::directory_entry& dirEntry = *it;
+
+			std::error_code entryEc;
+			if (!dirEntry.is_regular_file(entryEc) || dirEntry.path() == pakPath)
+				continue;
+
+			fs::path relPath = fs::relative(dirEntry.path(), rootPath, entryEc);
+			std::string fullName;
+			std::string relName;
+			if (!entryEc)
+			{
+				try
+				{
+					// names that do not fit the narrow code page can not go in the pak
+					fullName = dirEntry.path().string();
+					relName = relPath.generic_string();
+				}
+				catch (const std::system_error& e)
+				{
+					entryEc = e.code();
+				}
+			}
+
+			if (entryEc)
+			{
+				Warning("Skipping an input file - %s\n", entryEc.message().c_str());
+				continue;
+			}
+
+			int nTicket;
+			tickets.Pop(nTicket);
+
+			auto pItem = std::make_unique<BuildItem_t>();
+			pItem->m_nSequence = nSequence++;
+			pItem->m_FullPath = fullName;
+			pItem->m_RelPath = relName.c_str();
+			pItem->m_bTextMode = IsTextFile(dirEntry.path());
+			pItem->m_bValid = false;
+
+			walkQueue.Push(std::move(pItem));
+		}
+
+		if (ec)
+		{
+			Warning("Failed walking %s - %s\n", rootPath.string().c_str(), ec.message().c_str());
+			bWalkFailed = true;
+		}
+		walkQueue.Close();
+	});
+
+	std::atomic<int> nActiveReaders(nReadThreads);
+	std::vector<std::thread> readers;
+	for (int i = 0; i < nReadThreads; i++)
+	{
+		readers.emplace_back([&]
+		{
+			BuildItemPtr pItem;
+			while (walkQueue.Pop(pItem))
+			{
+				pItem->m_bValid = ReadInputFile(pItem->m_FullPath, pItem->m_bTextMode, pItem->m_FileData);
+				readQueue.Push(std::move(pItem));
+			}
+
+			if (--nActiveReaders == 0)
+				readQueue.Close();
+		});
+	}
+
+	std::atomic<int> nActiveCompressors(nCompressThreads);
+	std::vector<std::thread> compressors;
+	for (int i = 0; i < nCompressThreads; i++)
+	{
+		compressors.emplace_back([&]
+		{
+			BuildItemPtr pItem;
+			while (readQueue.Pop(pItem))
+			{
+				if (pItem->m_bValid)
+				{
+					int fileSize = pItem->m_FileData.TellPut();
+					pItem->m_bValid = m_pXZipFile->PrepareBuffer(pItem->m_FileData.Base(), fileSize, pItem->m_bTextMode,
+						fileSize ? compressionType : IZip::eCompressionType_None, pItem->m_Prepared);
+				}
+				compressQueue.Push(std::move(pItem));
+			}
+
+			if (--nActiveCompressors == 0)
+				compressQueue.Close();
+		});
+	}
+
+	// ordered writer, items are added in walk order whatever order they finish in
+	std::map<int, BuildItemPtr> pendingItems;
+	int nNextSequence = 0;
+
+	BuildItemPtr pItem;
+	while (compressQueue.Pop(pItem))
+	{
+		int nSequence = pItem->m_nSequence;
+		pendingItems[nSequence] = std::move(pItem);
+
+		while (!pendingItems.empty() && pendingItems.begin()->first == nNextSequence)
+		{
+			auto& pReady = pendingItems.begin()->second;
+			if (pReady->m_bValid)
+			{
+				m_pXZipFile->CommitBuffer(pReady->m_RelPath.String(), pReady->m_Prepared, &pReady->m_FileData);
+				Msg("Added - %s\n", pReady->m_RelPath.String());
+			}
+			else
+			{
+				Warning("Failed to add - %s\n", pReady->m_RelPath.String());
+			}
+
+			pendingItems.erase(pendingItems.begin());
+			nNextSequence++;
+			tickets.Push(0);
+		}
+	}
+
+	walker.join();
+	for (auto& thread : readers)
+		thread.join();
+	for (auto& thread : compressors)
+		thread.join();
+	Assert(pendingItems.empty());
+
+	if (bWalkFailed)
+	{
+		// a partial pak would look like a good one, do not write it
+		Warning("Not writing %s, the input folder could not be read completely\n", pakPath.string().c_str());
+		CloseXZip();
+		return;
+	}
+
+	m_hXZipFile = CreateFile(pakPath.string().c_str(),
+		GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hXZipFile == INVALID_HANDLE_VALUE)
+	{
+		Error("Failed to create - %s\n", pakPath.string().c_str());
+		return;
+	}
+
+	SaveXZip(pakPath, true);
 }
 
 void CVXZipApp::OpenXZip(const char* pszZipPath)
 {
 	m_pXZipFile = new CXZipFile(NULL, true);
+	m_pXZipFile->SetMetricsEnabled(m_bStats);
 
-	m_hXZipFile = m_pXZipFile->OpenFromDisk(pszZipPath);
+	// map the pak, entries are read straight from the mapping
+	m_hXZipFile = m_pXZipFile->OpenFromDisk(pszZipPath, true);
 	Assert(m_hXZipFile);
 }
 
@@ -168,64 +464,266 @@ void CVXZipApp::SaveXZip(const fs::path& outputPath, bool bClose)
 void CVXZipApp::CloseXZip()
 {
 	if (m_hXZipFile != INVALID_HANDLE_VALUE)
+	{
+		if (m_hXZipFile)
+			CloseHandle(m_hXZipFile);
+
 		m_hXZipFile = INVALID_HANDLE_VALUE;
+	}
 
 	if (m_pXZipFile)
+	{
+		if (m_bStats)
+			DumpStats();
+
 		delete m_pXZipFile;
+		m_pXZipFile = NULL;
+	}
+}
+
+void CVXZipApp::DumpStats()
+{
+	XZipMetricsSnapshot_t snapshot;
+	m_pXZipFile->GetMetrics(snapshot);
+
+	CUtlBuffer buf(0, 0, CUtlBuffer::TEXT_BUFFER);
+	snapshot.WriteJSON(buf);
+
+	// straight to the stream, spew would truncate a long dump
+	FILE* fp = m_StatsPath.IsEmpty() ? stdout : fopen(m_StatsPath.String(), "w");
+	if (!fp || fwrite(buf.Base(), 1, buf.TellPut(), fp) != (size_t)buf.TellPut())
+		Warning("Failed to write stats to %s\n", m_StatsPath.IsEmpty() ? "the console" : m_StatsPath.String());
+
+	if (fp && fp != stdout)
+		fclose(fp);
 }
 
 
+struct ExtractJob_t
+{
+	int			m_iEntryID;
+	int			m_iFileSize;
+	CUtlString	m_RelPath;
+};
+
+static int __cdecl ExtractJobSortFunc(const ExtractJob_t* pLeft, const ExtractJob_t* pRight)
+{
+	// largest first, so no big entry is left for the tail
+	if (pLeft->m_iFileSize != pRight->m_iFileSize)
+		return (pLeft->m_iFileSize > pRight->m_iFileSize) ? -1 : 1;
+
+	return pLeft->m_iEntryID - pRight->m_iEntryID;
+}
+
+// Entries larger than this are streamed to disk instead of being read whole
+static const int EXTRACT_STREAM_THRESHOLD = 16 * 1024 * 1024;
+// Threads creating and writing extracted files, and the memory they may hold
+static const int EXTRACT_WRITE_THREADS = 4;
+static const size_t EXTRACT_WRITE_BUDGET = 64 * 1024 * 1024;
+
 void CVXZipApp::ExtractAllFiles(const fs::path& outputPath)
 {
 	auto iEntryID = -1;
 	auto iFileSize = 0;
-	CUtlSymbol entrySymbol;
+	const char* pszEntryName = NULL;
+	CUtlVector<ExtractJob_t> jobs;
+	fs::path lastParentPath;
 
 	// get first entry
-	iEntryID = m_pXZipFile->GetNextEntry(iEntryID, entrySymbol, iFileSize);
+	iEntryID = m_pXZipFile->GetNextEntry(iEntryID, pszEntryName, iFileSize);
 
 	// walk the directory
 	while (iEntryID > -1)
 	{
-		// extract file
-		if (ExtractFile(entrySymbol.String(), outputPath))
-			Msg("Extracted - %s\n", entrySymbol.String());
-		else
-			Error("Failed to extract - %s\n", entrySymbol.String());
+		auto& job = jobs[jobs.AddToTail()];
+		job.m_iEntryID = iEntryID;
+		job.m_iFileSize = iFileSize;
+		job.m_RelPath = pszEntryName;
+
+		// create the folders up front, workers only write files
+		auto parentPath = (fs::path{ outputPath } /= pszEntryName).parent_path();
+		if (parentPath != lastParentPath)
+		{
+			if (!(fs::exists(parentPath)))
+				fs::create_directories(parentPath);
+
+			lastParentPath = parentPath;
+		}
 
 		// next...
-		iEntryID = m_pXZipFile->GetNextEntry(iEntryID, entrySymbol, iFileSize);
+		iEntryID = m_pXZipFile->GetNextEntry(iEntryID, pszEntryName, iFileSize);
 	}
+
+	jobs.Sort(ExtractJobSortFunc);
+
+	// decode workers hand finished files to the writer and move on
+	CAsyncFileWriter writer(EXTRACT_WRITE_THREADS, EXTRACT_WRITE_BUDGET, [&](int i, bool bSuccess)
+	{
+		if (bSuccess)
+			Msg("Extracted - %s\n", jobs[i].m_RelPath.String());
+		else
+			Error("Failed to extract - %s\n", jobs[i].m_RelPath.String());
+	});
+
+	CJobPool pool(this->m_nJobs);
+	pool.Run(jobs.Count(), [&](int i)
+	{
+		auto& job = jobs[i];
+
+		// extract file
+		bool bQueued = false;
+		if (!ExtractFile(job.m_iEntryID, job.m_iFileSize, job.m_RelPath.String(), outputPath, writer, i, bQueued))
+			Error("Failed to extract - %s\n", job.m_RelPath.String());
+		else if (!bQueued)
+			Msg("Extracted - %s\n", job.m_RelPath.String());
+	});
+
+	// the mapping has to outlive the writes straight out of it
+	writer.Finish();
 }
 
-bool CVXZipApp::ExtractFile(const char* pszRelPath, const std::filesystem::path& path)
+/**
+ * Writes a streamed entry straight to a file.
+ */
+class CExtractFileSink : public IXZipEntrySink
+{
+public:
+	CExtractFileSink(HANDLE hFile) : m_hFile(hFile) {}
+
+	virtual bool Write(const void* pData, int nSize)
+	{
+		return CWin32File::FileWrite(m_hFile, (void*)pData, nSize);
+	}
+
+private:
+	HANDLE m_hFile;
+};
+
+bool CVXZipApp::ExtractFile(int iEntryID, int iFileSize, const char* pszRelPath, const std::filesystem::path& path,
+	CAsyncFileWriter& writer, int nTag, bool& bQueued)
 {
+	bQueued = false;
+
 	// create final path
 	auto finalPath = (fs::path{ path } /= pszRelPath);
-	CUtlBuffer fileBuffer;
 
-	bool bIsText = false;
-	auto fileExt = finalPath.extension();
+	bool bIsText = IsTextFile(finalPath);
+
+	// stored binary entries can be written straight from the mapping
+	const void* pFileData = NULL;
+	int fileSize = 0;
+	if (!bIsText && m_pXZipFile->GetEntryView(iEntryID, pFileData, fileSize))
+	{
+		writer.Write(finalPath.string().c_str(), pFileData, fileSize, false, nTag);
+		bQueued = true;
+		return true;
+	}
+
+	if (iFileSize > EXTRACT_STREAM_THRESHOLD)
+		return StreamFile(iEntryID, bIsText, finalPath);
 
-	if (fileExt == ".cfg" || fileExt == ".txt" ||
-		fileExt == ".vmt" /*|| fileExt == */ )
+	// the buffer goes to the writer, text mode needs room for the terminator
+	int nBufferSize = iFileSize + (bIsText ? 1 : 0);
+	void* pBuffer = malloc(Max(nBufferSize, 1));
+	if (!pBuffer)
+		return false;
+
+	if (!m_pXZipFile->ReadEntry(m_hXZipFile, iEntryID, bIsText, pBuffer, nBufferSize, fileSize))
 	{
-		bIsText = true;
+		free(pBuffer);
+		return false;
 	}
 
+	writer.Write(finalPath.string().c_str(), pBuffer, fileSize, true, nTag);
+	bQueued = true;
+	return true;
+}
 
-	auto fileSize = m_pXZipFile->ReadFile(m_hXZipFile, pszRelPath, bIsText, fileBuffer);
+bool CVXZipApp::StreamFile(int iEntryID, bool bIsText, const std::filesystem::path& finalPath)
+{
+	auto hFile = CreateFile(finalPath.string().c_str(),
+		GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
 
-	if (fileBuffer.IsValid())
+	CExtractFileSink sink(hFile);
+	bool bSuccess = m_pXZipFile->StreamEntry(m_hXZipFile, iEntryID, bIsText, sink);
+	CloseHandle(hFile);
+
+	return bSuccess;
+}
+
+/**
+ * Swallows streamed entry data, only the CRC check inside StreamEntry matters.
+ */
+class CVerifySink : public IXZipEntrySink
+{
+public:
+	virtual bool Write(const void* pData, int nSize)
 	{
-		if (!(fs::exists(finalPath.parent_path())))
-			fs::create_directories(finalPath.parent_path());
+		return true;
+	}
+};
 
-		auto hFile = CreateFile(finalPath.string().c_str(), 
-			GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+bool CVXZipApp::VerifyXZip(CUtlString& zipPath)
+{
+	m_pXZipFile = new CXZipFile(NULL, true);
+	m_pXZipFile->SetMetricsEnabled(m_bStats);
+	m_hXZipFile = m_pXZipFile->OpenFromDisk(zipPath, true);
+	if (!m_hXZipFile)
+	{
+		Warning("Failed to open - %s\n", zipPath.String());
+		CloseXZip();
+		return false;
+	}
+
+	m_pXZipFile->SetVerifyCRC(true);
+
+	auto iEntryID = -1;
+	auto iFileSize = 0;
+	const char* pszEntryName = NULL;
+	CUtlVector<ExtractJob_t> jobs;
+
+	iEntryID = m_pXZipFile->GetNextEntry(iEntryID, pszEntryName, iFileSize);
+	while (iEntryID > -1)
+	{
+		auto& job = jobs[jobs.AddToTail()];
+		job.m_iEntryID = iEntryID;
+		job.m_iFileSize = iFileSize;
+		job.m_RelPath = pszEntryName;
 
-		return CWin32File::FileWrite(hFile, fileBuffer.Base(), fileSize);
+		iEntryID = m_pXZipFile->GetNextEntry(iEntryID, pszEntryName, iFileSize);
 	}
 
-	return false;
+	jobs.Sort(ExtractJobSortFunc);
+
+	std::atomic<int> nFailed = 0;
+	std::atomic<long long> nBytes = 0;
+	double flStartTime = Plat_FloatTime();
+
+	CJobPool pool(this->m_nJobs);
+	pool.Run(jobs.Count(), [&](int i)
+	{
+		auto& job = jobs[i];
+
+		// decode as binary, the CRC covers the data as stored
+		CVerifySink sink;
+		if (m_pXZipFile->StreamEntry(m_hXZipFile, job.m_iEntryID, false, sink))
+		{
+			nBytes += job.m_iFileSize;
+		}
+		else
+		{
+			Warning("Verify FAILED - %s\n", job.m_RelPath.String());
+			nFailed++;
+		}
+	});
+
+	double flElapsed = Max(Plat_FloatTime() - flStartTime, 0.001);
+	double flMegabytes = nBytes / (1024.0 * 1024.0);
+	Msg("Verified %d entries, %d failed, %.1f MB in %.2f s (%.1f MB/s)\n",
+		jobs.Count(), nFailed.load(), flMegabytes, flElapsed, flMegabytes / flElapsed);
+
+	CloseXZip();
+	return nFailed == 0;
 }
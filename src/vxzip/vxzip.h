@@ -7,13 +7,19 @@
  *********************************************************************/
 
 #pragma once
+#include <atomic>
 #include <filesystem>
+#include <map>
+#include <thread>
 
 #include <appframework/appframework.h>
 #include <tier0/icommandline.h>
 #include <tier1/tier1.h>
 #include <tier2/tier2.h>
+#include "async_writer.h"
+#include "job_pool.h"
 #include "xzip_file.h"
+#include "xzip_text.h"
 
 namespace fs = std::filesystem;
 
@@ -70,17 +76,39 @@ public:
 	/**
 	 * Constructs an xzip pak from a given directory.
 	 *
+	 * Runs as a pipeline: a walker thread enumerates files, reader threads
+	 * load them, m_nJobs workers compress them and the calling thread adds
+	 * them to the pak in walk order. Stages are joined by bounded queues and
+	 * payloads spill to a disk cache, so memory is bounded by the pipeline
+	 * depth rather than by the size of the input folder.
+	 *
 	 * \param inputPath		Input directory to pack
 	 * \param zipPath		Output path for xzip pak
 	 * \return True indicates success
 	 */
 	void BuildXZip(CUtlString& inputPath, CUtlString& zipPath);
+	/**
+	 * Decodes every entry of an xzip pak over m_nJobs threads and checks it
+	 * against the CRC in the central directory. Nothing is written to disk.
+	 *
+	 * \param zipPath		Input path for xzip pak
+	 * \return True if every entry verified
+	 */
+	bool VerifyXZip(CUtlString& zipPath);
 
 private:
 	// parameter tokens
 	const char* m_szTargetToken = "-t";
 	const char* m_szExtractToken = "-e";
 	const char* m_szBuildToken = "-b";
+	const char* m_szJobsToken = "-j";
+	const char* m_szVerifyToken = "-verify";
+	const char* m_szPreloadToken = "-preload";
+	const char* m_szDedupToken = "-dedup";
+	const char* m_szMinGainToken = "-mingain";
+	const char* m_szCodecToken = "-codec";
+	const char* m_szLevelToken = "-level";
+	const char* m_szStatsToken = "-stats";
 
 	/**
 	 * Opens an XZip pak file for reading.
@@ -98,22 +126,91 @@ private:
 	void SaveXZip(const fs::path& outputPath, bool bClose = false);
 
 	/**
-	 * Closes the XZip pak file (deallocation).
+	 * Closes the XZip pak file (deallocation), dumping its metrics first with -stats.
 	 *
 	 */
 	void CloseXZip();
+	/**
+	 * Writes the metrics of the open pak as JSON, to the -stats file or the console.
+	 *
+	 */
+	void DumpStats();
 
+	/**
+	 * Extracts every entry of the open pak, spread over m_nJobs threads.
+	 *
+	 * \param outputPath	Output directory
+	 */
 	void ExtractAllFiles(const fs::path& outputPath);
-	bool ExtractFile(const char* pszRelPath, const fs::path& outputPath);
+	/**
+	 * Extracts a single entry. Thread safe, expects the parent directory to exist.
+	 * The file is decoded here and usually handed to the writer, entries too
+	 * large to hold are streamed to disk right away.
+	 *
+	 * \param iEntryID		Directory id of the entry
+	 * \param iFileSize		Uncompressed size of the entry
+	 * \param pszRelPath	Relative path of the entry
+	 * \param outputPath	Output directory
+	 * \param writer		Writer for the finished file
+	 * \param nTag			Tag for the writer's completion callback
+	 * \param bQueued		Receives true if the file went to the writer
+	 * \return True indicates success (so far, if queued)
+	 */
+	bool ExtractFile(int iEntryID, int iFileSize, const char* pszRelPath, const fs::path& outputPath,
+		CAsyncFileWriter& writer, int nTag, bool& bQueued);
+	/**
+	 * Extracts a single entry window by window, for entries too large to
+	 * read in one go. Thread safe.
+	 *
+	 * \param iEntryID		Directory id of the entry
+	 * \param bIsText		True to extract as text
+	 * \param finalPath		Output file
+	 * \return True indicates success
+	 */
+	bool StreamFile(int iEntryID, bool bIsText, const fs::path& finalPath);
+
+	/**
+	 * Number of worker threads (-j), 0 means one per core.
+	 */
+	int m_nJobs = 1;
+	/**
+	 * Bytes per entry kept in the preload section of built paks (-preload), 0 for none.
+	 */
+	int m_nPreloadSize = 0;
+	/**
+	 * Store identical payloads once when building (-dedup).
+	 */
+	bool m_bDeduplicate = false;
+	/**
+	 * Minimum compression gain in percent when building (-mingain), smaller gains are stored.
+	 */
+	float m_flMinGain = XZIP_DEFAULT_MIN_GAIN * 100.0f;
+	/**
+	 * Codec for built paks (-codec), LZMA when the encoder is available.
+	 */
+#ifdef ZIP_SUPPORT_LZMA_ENCODE
+	IZip::eCompressionType m_eCompressionType = IZip::eCompressionType_LZMA;
+#else
+	IZip::eCompressionType m_eCompressionType = IZip::eCompressionType_None;
+#endif
+	/**
+	 * Codec level for built paks (-level), 0 for the codec default.
+	 */
+	int m_nCompressionLevel = 0;
+	/**
+	 * Collect pak metrics and dump them as JSON when done (-stats [file]).
+	 */
+	bool m_bStats = false;
+	CUtlString m_StatsPath;
 
 	/**
 	 * Object pointer to CXZip for this instance.
 	 */
-	CXZipFile* m_pXZipFile;
+	CXZipFile* m_pXZipFile = NULL;
 	/**
 	 * Win32 handle to the XZip file.
 	 */
-	HANDLE m_hXZipFile;
+	HANDLE m_hXZipFile = INVALID_HANDLE_VALUE;
 };
 
 /**
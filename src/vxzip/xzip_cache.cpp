@@ -0,0 +1,127 @@
+/*****************************************************************//**
+ * \file   xzip_cache.cpp
+ * \brief  Byte budgeted LRU cache of decoded entries.
+ *********************************************************************/
+
+#include "xzip_cache.h"
+
+CXZipCachedData::CXZipCachedData(int nSize)
+{
+	m_nSize = Max(nSize, 0);
+	m_pData = m_nSize ? malloc(m_nSize) : NULL;
+}
+
+CXZipCachedData::~CXZipCachedData(void)
+{
+	if (m_pData)
+	{
+		free(m_pData);
+	}
+}
+
+CXZipEntryCache::CXZipEntryCache(void)
+{
+	m_nBytes = 0;
+	m_nMaxBytes = 0;
+	m_nHits = 0;
+	m_nMisses = 0;
+}
+
+void CXZipEntryCache::SetBudget(size_t nMaxBytes)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_nMaxBytes = nMaxBytes;
+	Evict(m_nMaxBytes);
+}
+
+XZipCacheHandle_t CXZipEntryCache::Find(int id)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	if (!m_Slots.IsValidIndex(id) || !m_Slots[id].m_Data)
+	{
+		m_nMisses++;
+		return XZipCacheHandle_t();
+	}
+
+	// move to the head
+	Slot_t& slot = m_Slots[id];
+	m_LRU.Remove(slot.m_nLRU);
+	slot.m_nLRU = m_LRU.AddToHead(id);
+
+	m_nHits++;
+	return slot.m_Data;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Two readers missing on the same id both insert, the second one
+//			just replaces the first
+//-----------------------------------------------------------------------------
+void CXZipEntryCache::Insert(int id, const XZipCacheHandle_t& data)
+{
+	if (id < 0 || !data)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Lock);
+	size_t nSize = (size_t)data->Size();
+	if (!m_nMaxBytes || nSize > m_nMaxBytes)
+	{
+		return;
+	}
+
+	while (m_Slots.Count() <= id)
+	{
+		Slot_t& slot = m_Slots[m_Slots.AddToTail()];
+		slot.m_nLRU = m_LRU.InvalidIndex();
+	}
+
+	Slot_t& slot = m_Slots[id];
+	if (slot.m_Data)
+	{
+		m_nBytes -= (size_t)slot.m_Data->Size();
+		m_LRU.Remove(slot.m_nLRU);
+	}
+
+	// make room before taking the new one in, so it is never the one to go
+	slot.m_Data.reset();
+	slot.m_nLRU = m_LRU.InvalidIndex();
+	Evict(m_nMaxBytes - nSize);
+
+	slot.m_Data = data;
+	slot.m_nLRU = m_LRU.AddToHead(id);
+	m_nBytes += nSize;
+}
+
+void CXZipEntryCache::Invalidate(void)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	m_Slots.Purge();
+	m_LRU.Purge();
+	m_nBytes = 0;
+}
+
+void CXZipEntryCache::GetStats(uint64& nHits, uint64& nMisses, size_t& nBytes)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+	nHits = m_nHits;
+	nMisses = m_nMisses;
+	nBytes = m_nBytes;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drops entries from the tail until at most nMaxBytes are held.
+//			Readers holding a handle keep their data alive.
+//-----------------------------------------------------------------------------
+void CXZipEntryCache::Evict(size_t nMaxBytes)
+{
+	while (m_nBytes > nMaxBytes && m_LRU.Count())
+	{
+		int nTail = m_LRU.Tail();
+		Slot_t& slot = m_Slots[m_LRU[nTail]];
+		m_nBytes -= (size_t)slot.m_Data->Size();
+		slot.m_Data.reset();
+		slot.m_nLRU = m_LRU.InvalidIndex();
+		m_LRU.Remove(nTail);
+	}
+}
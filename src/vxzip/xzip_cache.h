@@ -0,0 +1,106 @@
+/*****************************************************************//**
+ * \file   xzip_cache.h
+ * \brief  Byte budgeted LRU cache of decoded entries.
+ *********************************************************************/
+#ifndef _XZIP_CACHE_H
+#define _XZIP_CACHE_H
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "utllinkedlist.h"
+#include "utlvector.h"
+
+/**
+ * Decoded payload of an entry. Immutable once cached, readers share it.
+ */
+class CXZipCachedData
+{
+public:
+	CXZipCachedData(int nSize);
+	~CXZipCachedData(void);
+
+	const void*		Base(void) const { return m_pData; }
+	void*			Base(void) { return m_pData; }
+	int				Size(void) const { return m_nSize; }
+	bool			IsValid(void) const { return m_pData || !m_nSize; }
+
+private:
+	CXZipCachedData(const CXZipCachedData&) = delete;
+	CXZipCachedData& operator=(const CXZipCachedData&) = delete;
+
+	void*			m_pData;
+	int				m_nSize;
+};
+
+/**
+ * Shared reference to cached data, stays valid after eviction.
+ */
+typedef std::shared_ptr<const CXZipCachedData> XZipCacheHandle_t;
+
+/**
+ * Cache of decoded entries keyed by directory id. Least recently used
+ * entries are evicted once the cached bytes pass the budget. Thread safe.
+ */
+class CXZipEntryCache
+{
+public:
+	CXZipEntryCache(void);
+
+	/**
+	 * Sets the budget, evicting as needed. Zero disables the cache.
+	 *
+	 * \param nMaxBytes	Most decoded bytes to hold
+	 */
+	void			SetBudget(size_t nMaxBytes);
+	bool			IsEnabled(void) const { return m_nMaxBytes != 0; }
+
+	/**
+	 * Looks up an entry and marks it as most recently used.
+	 *
+	 * \param id	Directory id
+	 * \return Cached data, empty on a miss
+	 */
+	XZipCacheHandle_t	Find(int id);
+	/**
+	 * Adds an entry, data larger than the whole budget is not kept.
+	 *
+	 * \param id		Directory id
+	 * \param data		Decoded (and verified) payload
+	 */
+	void			Insert(int id, const XZipCacheHandle_t& data);
+	/**
+	 * Drops everything, for when directory ids change. Counters are kept.
+	 */
+	void			Invalidate(void);
+
+	/**
+	 * \param nHits		Receives the number of lookups served from the cache
+	 * \param nMisses	Receives the number of lookups that were not
+	 * \param nBytes	Receives the number of decoded bytes held
+	 */
+	void			GetStats(uint64& nHits, uint64& nMisses, size_t& nBytes);
+
+private:
+	struct Slot_t
+	{
+		XZipCacheHandle_t	m_Data;
+		int					m_nLRU;
+	};
+
+	void			Evict(size_t nMaxBytes);
+
+	std::mutex				m_Lock;
+	// per directory id, m_nLRU is the position in m_LRU or invalid
+	CUtlVector<Slot_t>		m_Slots;
+	// ids, most recently used at the head
+	CUtlLinkedList<int, int>	m_LRU;
+	size_t					m_nBytes;
+	size_t					m_nMaxBytes;
+	uint64					m_nHits;
+	uint64					m_nMisses;
+};
+
+#endif // _XZIP_CACHE_H
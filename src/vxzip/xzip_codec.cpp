@@ -0,0 +1,337 @@
+/*****************************************************************//**
+ * \file   xzip_codec.cpp
+ * \brief  Compression codecs for pak entries.
+ *********************************************************************/
+
+#include <string.h>
+
+#include "xzip_codec.h"
+
+/**
+ * Names for the app and log output.
+ */
+static const struct
+{
+	int			m_nCompressionType;
+	const char*	m_pszName;
+} s_CodecNames[] =
+{
+	{ IZip::eCompressionType_None,	"none" },
+	{ IZip::eCompressionType_LZMA,	"lzma" },
+	{ XZIP_COMPRESSION_ZSTD,		"zstd" },
+	{ XZIP_COMPRESSION_LZ4,			"lz4" },
+};
+
+const char* CXZipCodec::GetName(int nCompressionType)
+{
+	for (int i = 0; i < ARRAYSIZE(s_CodecNames); i++)
+	{
+		if (s_CodecNames[i].m_nCompressionType == nCompressionType)
+		{
+			return s_CodecNames[i].m_pszName;
+		}
+	}
+
+	return "unknown";
+}
+
+IZip::eCompressionType CXZipCodec::FromName(const char* pszName)
+{
+	for (int i = 0; i < ARRAYSIZE(s_CodecNames); i++)
+	{
+		if (!V_stricmp(s_CodecNames[i].m_pszName, pszName))
+		{
+			return (IZip::eCompressionType)s_CodecNames[i].m_nCompressionType;
+		}
+	}
+
+	return IZip::eCompressionType_Unknown;
+}
+
+bool CXZipCodec::CanDecode(int nCompressionType)
+{
+	switch (nCompressionType)
+	{
+	case IZip::eCompressionType_None:
+	case IZip::eCompressionType_LZMA:
+		return true;
+#ifdef XZIP_SUPPORT_ZSTD
+	case XZIP_COMPRESSION_ZSTD:
+		return true;
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	case XZIP_COMPRESSION_LZ4:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+bool CXZipCodec::CanEncode(int nCompressionType)
+{
+	switch (nCompressionType)
+	{
+	case IZip::eCompressionType_None:
+		return true;
+#ifdef ZIP_SUPPORT_LZMA_ENCODE
+	case IZip::eCompressionType_LZMA:
+		return true;
+#endif
+#ifdef XZIP_SUPPORT_ZSTD
+	case XZIP_COMPRESSION_ZSTD:
+		return true;
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	case XZIP_COMPRESSION_LZ4:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: LZMA and zstd per ZIP spec 5.8.8 / 4.4.3.2, LZ4 is treated the same
+//-----------------------------------------------------------------------------
+unsigned short CXZipCodec::GetVersionNeeded(int nCompressionType)
+{
+	if (nCompressionType == IZip::eCompressionType_None)
+	{
+		// No special features or even compression here, set to 1.0
+		return 10;
+	}
+
+	return 63;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compresses a lump into a ZIP payload
+//-----------------------------------------------------------------------------
+bool CXZipCodec::Compress(int nCompressionType, int nLevel, const void* pData, int nSize, CUtlBuffer& out)
+{
+	out.Clear();
+
+	switch (nCompressionType)
+	{
+#ifdef ZIP_SUPPORT_LZMA_ENCODE
+	case IZip::eCompressionType_LZMA:
+	{
+		unsigned int compressedSize = 0;
+		unsigned char* pCompressedOutput = LZMA_Compress((unsigned char*)pData, nSize, &compressedSize);
+		if (!pCompressedOutput || compressedSize < sizeof(lzma_header_t))
+		{
+			free(pCompressedOutput);
+			return false;
+		}
+
+		// Fixup LZMA header for ZIP payload usage
+		// The output of LZMA_Compress uses lzma_header_t, defined alongside it.
+		//
+		// ZIP payload format, see ZIP spec 5.8.8:
+		//  LZMA Version Information 2 bytes
+		//  LZMA Properties Size 2 bytes
+		//  LZMA Properties Data variable, defined by "LZMA Properties Size"
+		unsigned int nZIPHeader = 2 + 2 + sizeof(lzma_header_t().properties);
+		unsigned int finalCompressedSize = compressedSize - sizeof(lzma_header_t) + nZIPHeader;
+		out.EnsureCapacity(finalCompressedSize);
+
+		// LZMA version
+		out.PutUnsignedChar(LZMA_SDK_VERSION_MAJOR);
+		out.PutUnsignedChar(LZMA_SDK_VERSION_MINOR);
+		// properties size
+		uint16 nSwappedPropertiesSize = LittleWord(sizeof(lzma_header_t().properties));
+		out.Put(&nSwappedPropertiesSize, sizeof(nSwappedPropertiesSize));
+		// properties
+		out.Put(&(((lzma_header_t*)pCompressedOutput)->properties), sizeof(lzma_header_t().properties));
+		// payload
+		out.Put(pCompressedOutput + sizeof(lzma_header_t), compressedSize - sizeof(lzma_header_t));
+
+		// Free original
+		free(pCompressedOutput);
+		return out.IsValid();
+	}
+#endif
+#ifdef XZIP_SUPPORT_ZSTD
+	case XZIP_COMPRESSION_ZSTD:
+	{
+		// a plain frame with the content size in it
+		size_t nBound = ZSTD_compressBound(nSize);
+		out.EnsureCapacity((int)nBound);
+		size_t nCompressed = ZSTD_compress(out.Base(), nBound, pData, nSize, nLevel ? nLevel : ZSTD_CLEVEL_DEFAULT);
+		if (ZSTD_isError(nCompressed))
+		{
+			return false;
+		}
+
+		out.SeekPut(CUtlBuffer::SEEK_HEAD, (int)nCompressed);
+		return true;
+	}
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	case XZIP_COMPRESSION_LZ4:
+	{
+		// levels from LZ4HC_CLEVEL_MIN up use the high compression encoder
+		LZ4F_preferences_t prefs;
+		memset(&prefs, 0, sizeof(prefs));
+		prefs.frameInfo.contentSize = (unsigned long long)nSize;
+		prefs.compressionLevel = nLevel;
+
+		size_t nBound = LZ4F_compressFrameBound(nSize, &prefs);
+		out.EnsureCapacity((int)nBound);
+		size_t nCompressed = LZ4F_compressFrame(out.Base(), nBound, pData, nSize, &prefs);
+		if (LZ4F_isError(nCompressed))
+		{
+			return false;
+		}
+
+		out.SeekPut(CUtlBuffer::SEEK_HEAD, (int)nCompressed);
+		return true;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CXZipDecoder
+//-----------------------------------------------------------------------------
+CXZipDecoder::CXZipDecoder(void)
+{
+	m_nCompressionType = IZip::eCompressionType_Unknown;
+#ifdef XZIP_SUPPORT_ZSTD
+	m_pZstd = NULL;
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	m_pLZ4 = NULL;
+#endif
+}
+
+CXZipDecoder::~CXZipDecoder(void)
+{
+#ifdef XZIP_SUPPORT_ZSTD
+	ZSTD_freeDCtx(m_pZstd);
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	if (m_pLZ4)
+	{
+		LZ4F_freeDecompressionContext(m_pLZ4);
+	}
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Contexts are created on first use and reset when reused
+//-----------------------------------------------------------------------------
+bool CXZipDecoder::Init(int nCompressionType, unsigned int nCompressedSize, unsigned int nUncompressedSize)
+{
+	m_nCompressionType = nCompressionType;
+
+	switch (nCompressionType)
+	{
+	case IZip::eCompressionType_LZMA:
+		m_LZMA.InitZIPHeader(nCompressedSize, nUncompressedSize);
+		return true;
+#ifdef XZIP_SUPPORT_ZSTD
+	case XZIP_COMPRESSION_ZSTD:
+		if (m_pZstd)
+		{
+			ZSTD_DCtx_reset(m_pZstd, ZSTD_reset_session_only);
+		}
+		else
+		{
+			m_pZstd = ZSTD_createDCtx();
+		}
+		return m_pZstd != NULL;
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	case XZIP_COMPRESSION_LZ4:
+		if (m_pLZ4)
+		{
+			LZ4F_resetDecompressionContext(m_pLZ4);
+		}
+		else if (LZ4F_isError(LZ4F_createDecompressionContext(&m_pLZ4, LZ4F_VERSION)))
+		{
+			m_pLZ4 = NULL;
+		}
+		return m_pLZ4 != NULL;
+#endif
+	default:
+		m_nCompressionType = IZip::eCompressionType_Unknown;
+		return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: zstd and LZ4 may stop early with input and room left, they are
+//			called until they stop making progress
+//-----------------------------------------------------------------------------
+bool CXZipDecoder::Read(unsigned char* pInput, unsigned int nInputSize, unsigned char* pOutput, unsigned int nOutputSize,
+	unsigned int& nCompressedBytesRead, unsigned int& nOutputBytesWritten)
+{
+	nCompressedBytesRead = 0;
+	nOutputBytesWritten = 0;
+
+	switch (m_nCompressionType)
+	{
+	case IZip::eCompressionType_LZMA:
+		return m_LZMA.Read(pInput, nInputSize, pOutput, nOutputSize, nCompressedBytesRead, nOutputBytesWritten);
+#ifdef XZIP_SUPPORT_ZSTD
+	case XZIP_COMPRESSION_ZSTD:
+	{
+		ZSTD_inBuffer in = { pInput, nInputSize, 0 };
+		ZSTD_outBuffer out = { pOutput, nOutputSize, 0 };
+		for (;;)
+		{
+			size_t nPrevIn = in.pos;
+			size_t nPrevOut = out.pos;
+			size_t nResult = ZSTD_decompressStream(m_pZstd, &out, &in);
+			if (ZSTD_isError(nResult))
+			{
+				return false;
+			}
+
+			// 0 once the frame is complete
+			if (!nResult || out.pos == out.size || (in.pos == nPrevIn && out.pos == nPrevOut))
+			{
+				break;
+			}
+		}
+
+		nCompressedBytesRead = (unsigned int)in.pos;
+		nOutputBytesWritten = (unsigned int)out.pos;
+		return true;
+	}
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	case XZIP_COMPRESSION_LZ4:
+	{
+		for (;;)
+		{
+			size_t nDst = nOutputSize - nOutputBytesWritten;
+			size_t nSrc = nInputSize - nCompressedBytesRead;
+			size_t nResult = LZ4F_decompress(m_pLZ4, pOutput + nOutputBytesWritten, &nDst,
+				pInput + nCompressedBytesRead, &nSrc, NULL);
+			if (LZ4F_isError(nResult))
+			{
+				return false;
+			}
+
+			nCompressedBytesRead += (unsigned int)nSrc;
+			nOutputBytesWritten += (unsigned int)nDst;
+
+			// 0 once the frame is complete
+			if (!nResult || nOutputBytesWritten == nOutputSize || (!nSrc && !nDst))
+			{
+				break;
+			}
+		}
+
+		return true;
+	}
+#endif
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,124 @@
+/*****************************************************************//**
+ * \file   xzip_codec.h
+ * \brief  Compression codecs for pak entries.
+ *********************************************************************/
+#ifndef _XZIP_CODEC_H
+#define _XZIP_CODEC_H
+
+#pragma once
+
+#include "source_sdk.h"
+
+#include "lzmaDecoder.h"
+#include "utlbuffer.h"
+#include "zip_utils.h"
+
+#ifdef XZIP_SUPPORT_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef XZIP_SUPPORT_LZ4
+#include <lz4frame.h>
+#endif
+
+/**
+ * Zstandard, ZIP method 93 (APPNOTE 4.4.5). Needs XZIP_SUPPORT_ZSTD.
+ */
+#define XZIP_COMPRESSION_ZSTD ((IZip::eCompressionType)93)
+
+/**
+ * LZ4 frame. The ZIP spec assigns no method to LZ4, this one is private to
+ * xzip paks. Needs XZIP_SUPPORT_LZ4.
+ */
+#define XZIP_COMPRESSION_LZ4 ((IZip::eCompressionType)244)
+
+/**
+ * Codec dispatch by ZIP compression method.
+ */
+class CXZipCodec
+{
+public:
+	/**
+	 * \return Short name of a codec ("lzma", "zstd", ...), "unknown" if there is none
+	 */
+	static const char*	GetName(int nCompressionType);
+	/**
+	 * \param pszName	Codec name as returned by GetName
+	 * \return Compression type, eCompressionType_Unknown if there is none
+	 */
+	static IZip::eCompressionType FromName(const char* pszName);
+
+	/**
+	 * \return True if entries with this compression type can be read
+	 */
+	static bool			CanDecode(int nCompressionType);
+	/**
+	 * \return True if entries can be added with this compression type
+	 */
+	static bool			CanEncode(int nCompressionType);
+	/**
+	 * \return Version needed to extract for the ZIP headers
+	 */
+	static unsigned short GetVersionNeeded(int nCompressionType);
+
+	/**
+	 * Compresses a payload in ZIP format.
+	 *
+	 * \param nCompressionType	Codec, CanEncode must be true
+	 * \param nLevel			Codec level, 0 for the codec default (LZMA has none)
+	 * \param pData				Uncompressed data
+	 * \param nSize				Size of the data
+	 * \param out				Receives the payload, cleared first
+	 * \return False on failure
+	 */
+	static bool			Compress(int nCompressionType, int nLevel, const void* pData, int nSize, CUtlBuffer& out);
+};
+
+/**
+ * Streaming decoder for any codec CXZipCodec can decode. Read has the same
+ * contract as CLZMAStream::Read, so input can come from memory in one go or
+ * from disk a chunk at a time.
+ */
+class CXZipDecoder
+{
+public:
+	CXZipDecoder(void);
+	~CXZipDecoder(void);
+
+	/**
+	 * \param nCompressionType	Codec of the payload
+	 * \param nCompressedSize	Size of the payload
+	 * \param nUncompressedSize	Size of the decoded data
+	 * \return False if the codec is not supported
+	 */
+	bool	Init(int nCompressionType, unsigned int nCompressedSize, unsigned int nUncompressedSize);
+
+	/**
+	 * Decodes as much as fits.
+	 *
+	 * \param pInput				Compressed input
+	 * \param nInputSize			Size of the input
+	 * \param pOutput				Output
+	 * \param nOutputSize			Room in the output
+	 * \param nCompressedBytesRead	Receives the input bytes taken, the rest must be passed again
+	 * \param nOutputBytesWritten	Receives the bytes decoded
+	 * \return False on corrupt data
+	 */
+	bool	Read(unsigned char* pInput, unsigned int nInputSize, unsigned char* pOutput, unsigned int nOutputSize,
+		unsigned int& nCompressedBytesRead, unsigned int& nOutputBytesWritten);
+
+private:
+	CXZipDecoder(const CXZipDecoder&) = delete;
+	CXZipDecoder& operator=(const CXZipDecoder&) = delete;
+
+	int				m_nCompressionType;
+	CLZMAStream		m_LZMA;
+#ifdef XZIP_SUPPORT_ZSTD
+	ZSTD_DCtx*		m_pZstd;
+#endif
+#ifdef XZIP_SUPPORT_LZ4
+	LZ4F_dctx*		m_pLZ4;
+#endif
+};
+
+#endif // _XZIP_CODEC_H
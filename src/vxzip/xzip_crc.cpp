@@ -0,0 +1,280 @@
+/*****************************************************************//**
+ * \file   xzip_crc.cpp
+ * \brief  Fast CRC-32 for pak payloads.
+ *********************************************************************/
+
+#include <string.h>
+
+#include "xzip_crc.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define XZIP_PCLMUL
+#ifdef _MSC_VER
+#include <intrin.h>
+#define XZIP_TARGET_PCLMUL
+#else
+#define XZIP_TARGET_PCLMUL __attribute__((target("pclmul,sse2")))
+#endif
+#endif
+
+//-----------------------------------------------------------------------------
+// Slice-by-16 tables, table 0 is the classic byte table and table k advances
+// a byte through k more zero bytes
+//-----------------------------------------------------------------------------
+struct CRCTables_t
+{
+	CRCTables_t(void)
+	{
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			unsigned int crc = i;
+			for (int bit = 0; bit < 8; bit++)
+			{
+				crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+			}
+			m_Table[0][i] = crc;
+		}
+
+		for (unsigned int i = 0; i < 256; i++)
+		{
+			for (int k = 1; k < 16; k++)
+			{
+				unsigned int prev = m_Table[k - 1][i];
+				m_Table[k][i] = (prev >> 8) ^ m_Table[0][prev & 0xFF];
+			}
+		}
+	}
+
+	unsigned int m_Table[16][256];
+};
+
+static const CRCTables_t& GetCRCTables(void)
+{
+	static const CRCTables_t s_Tables;
+	return s_Tables;
+}
+
+static inline unsigned int LoadLittleDword(const unsigned char* p)
+{
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+/**
+ * Works on the raw (pre-inverted) register, like CRC32_ProcessBuffer.
+ */
+static unsigned int ProcessBuffer_Slice16(unsigned int crc, const unsigned char* pData, size_t nSize)
+{
+	const unsigned int(*table)[256] = GetCRCTables().m_Table;
+
+	while (nSize >= 16)
+	{
+		unsigned int a = LoadLittleDword(pData) ^ crc;
+		unsigned int b = LoadLittleDword(pData + 4);
+		unsigned int c = LoadLittleDword(pData + 8);
+		unsigned int d = LoadLittleDword(pData + 12);
+
+		crc = table[15][a & 0xFF] ^ table[14][(a >> 8) & 0xFF] ^ table[13][(a >> 16) & 0xFF] ^ table[12][a >> 24] ^
+			table[11][b & 0xFF] ^ table[10][(b >> 8) & 0xFF] ^ table[9][(b >> 16) & 0xFF] ^ table[8][b >> 24] ^
+			table[7][c & 0xFF] ^ table[6][(c >> 8) & 0xFF] ^ table[5][(c >> 16) & 0xFF] ^ table[4][c >> 24] ^
+			table[3][d & 0xFF] ^ table[2][(d >> 8) & 0xFF] ^ table[1][(d >> 16) & 0xFF] ^ table[0][d >> 24];
+
+		pData += 16;
+		nSize -= 16;
+	}
+
+	while (nSize--)
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *pData++) & 0xFF];
+	}
+
+	return crc;
+}
+
+#ifdef XZIP_PCLMUL
+//-----------------------------------------------------------------------------
+// Carry-less multiply folding (Intel, "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ"), 64 bytes per round. Needs at least 64 bytes
+// and a multiple of 16.
+//-----------------------------------------------------------------------------
+XZIP_TARGET_PCLMUL static unsigned int ProcessBlocks_PCLMUL(unsigned int crc, const unsigned char* pData, size_t nSize)
+{
+	// bit reflected fold constants and the Barrett reduction constants
+	alignas(16) static const unsigned long long k1k2[2] = { 0x0154442bd4ull, 0x01c6e41596ull };
+	alignas(16) static const unsigned long long k3k4[2] = { 0x01751997d0ull, 0x00ccaa009eull };
+	alignas(16) static const unsigned long long k5k0[2] = { 0x0163cd6124ull, 0x0000000000ull };
+	alignas(16) static const unsigned long long poly[2] = { 0x01db710641ull, 0x01f7011641ull };
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i*)(pData + 0x00));
+	x2 = _mm_loadu_si128((const __m128i*)(pData + 0x10));
+	x3 = _mm_loadu_si128((const __m128i*)(pData + 0x20));
+	x4 = _mm_loadu_si128((const __m128i*)(pData + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+
+	x0 = _mm_load_si128((const __m128i*)k1k2);
+	pData += 64;
+	nSize -= 64;
+
+	// four lanes in parallel
+	while (nSize >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(pData + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(pData + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(pData + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(pData + 0x30)));
+
+		pData += 64;
+		nSize -= 64;
+	}
+
+	// fold the lanes into one
+	x0 = _mm_load_si128((const __m128i*)k3k4);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+	x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	// remaining 16 byte blocks
+	while (nSize >= 16)
+	{
+		x2 = _mm_loadu_si128((const __m128i*)pData);
+
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+		pData += 16;
+		nSize -= 16;
+	}
+
+	// 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+
+	x0 = _mm_loadl_epi64((const __m128i*)k5k0);
+
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128((const __m128i*)poly);
+
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return (unsigned int)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+
+static unsigned int ProcessBuffer_PCLMUL(unsigned int crc, const unsigned char* pData, size_t nSize)
+{
+	if (nSize >= 64)
+	{
+		size_t nBlocks = nSize & ~(size_t)15;
+		crc = ProcessBlocks_PCLMUL(crc, pData, nBlocks);
+		pData += nBlocks;
+		nSize -= nBlocks;
+	}
+
+	return ProcessBuffer_Slice16(crc, pData, nSize);
+}
+
+/**
+ * True if the CPU supports PCLMULQDQ.
+ */
+static bool CPUHasPCLMUL(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 1)) != 0;
+#else
+	return __builtin_cpu_supports("pclmul");
+#endif
+}
+#endif // XZIP_PCLMUL
+
+//-----------------------------------------------------------------------------
+// Dispatch
+//-----------------------------------------------------------------------------
+typedef unsigned int (*CRCProcessFn_t)(unsigned int crc, const unsigned char* pData, size_t nSize);
+
+static CRCProcessFn_t SelectCRCKernel(void)
+{
+	// the tables are also used for short tails, build them up front
+	GetCRCTables();
+
+#ifdef XZIP_PCLMUL
+	if (CPUHasPCLMUL())
+	{
+		return ProcessBuffer_PCLMUL;
+	}
+#endif
+
+	return ProcessBuffer_Slice16;
+}
+
+static CRCProcessFn_t GetCRCKernel(void)
+{
+	static const CRCProcessFn_t s_pfnKernel = SelectCRCKernel();
+	return s_pfnKernel;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same register convention as CRC32_Init/ProcessBuffer/Final
+//-----------------------------------------------------------------------------
+void CXZipCRC::Init(CRC32_t* pulCRC)
+{
+	*pulCRC = 0xFFFFFFFFu;
+}
+
+void CXZipCRC::ProcessBuffer(CRC32_t* pulCRC, const void* pBuffer, int nBuffer)
+{
+	if (nBuffer <= 0)
+	{
+		return;
+	}
+
+	*pulCRC = GetCRCKernel()(*pulCRC, (const unsigned char*)pBuffer, (size_t)nBuffer);
+}
+
+void CXZipCRC::Final(CRC32_t* pulCRC)
+{
+	*pulCRC ^= 0xFFFFFFFFu;
+}
+
+CRC32_t CXZipCRC::ProcessSingleBuffer(const void* pBuffer, int nBuffer)
+{
+	CRC32_t crc;
+	Init(&crc);
+	ProcessBuffer(&crc, pBuffer, nBuffer);
+	Final(&crc);
+	return crc;
+}
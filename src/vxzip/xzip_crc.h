@@ -0,0 +1,40 @@
+/*****************************************************************//**
+ * \file   xzip_crc.h
+ * \brief  Fast CRC-32 for pak payloads.
+ *********************************************************************/
+#ifndef _XZIP_CRC_H
+#define _XZIP_CRC_H
+
+#pragma once
+
+#include "checksum_crc.h"
+
+/**
+ * CRC-32 (the zip polynomial), same results and calling pattern as the
+ * CRC32_* functions from checksum_crc.h.
+ *
+ * Uses PCLMULQDQ folding when the CPU supports it and slice-by-16 tables
+ * otherwise, picked on first use.
+ */
+class CXZipCRC
+{
+public:
+	static void		Init(CRC32_t* pulCRC);
+	/**
+	 * Adds data to a running CRC, may be called any number of times
+	 * between Init and Final.
+	 *
+	 * \param pulCRC	Running CRC
+	 * \param pBuffer	Data
+	 * \param nBuffer	Size of the data
+	 */
+	static void		ProcessBuffer(CRC32_t* pulCRC, const void* pBuffer, int nBuffer);
+	static void		Final(CRC32_t* pulCRC);
+
+	/**
+	 * CRC of a single buffer, Init + ProcessBuffer + Final.
+	 */
+	static CRC32_t	ProcessSingleBuffer(const void* pBuffer, int nBuffer);
+};
+
+#endif // _XZIP_CRC_H
@@ -0,0 +1,116 @@
+/*****************************************************************//**
+ * \file   xzip_dedup.cpp
+ * \brief  Content keys used to store identical payloads only once.
+ *********************************************************************/
+
+#include <string.h>
+
+#include "xzip_dedup.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: MD5 of the data, the CRC and size make a collision practically
+//			impossible on top of it
+//-----------------------------------------------------------------------------
+void XZipContentKey_t::Compute(const void* pData, int nSize, CRC32_t crc, int nCompressionType)
+{
+	MD5Context_t ctx;
+	MD5Init(&ctx);
+	MD5Update(&ctx, (const unsigned char*)pData, nSize);
+	MD5Final(m_Hash, &ctx);
+
+	m_CRC = crc;
+	m_nSize = nSize;
+	m_nCompressionType = nCompressionType;
+}
+
+unsigned int XZipContentKey_t::GetHash(void) const
+{
+	unsigned int nHash;
+	memcpy(&nHash, m_Hash, sizeof(nHash));
+	return nHash;
+}
+
+bool XZipContentKey_t::operator==(const XZipContentKey_t& other) const
+{
+	return m_CRC == other.m_CRC &&
+		m_nSize == other.m_nSize &&
+		m_nCompressionType == other.m_nCompressionType &&
+		!memcmp(m_Hash, other.m_Hash, sizeof(m_Hash));
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Slot of a key, the lock must be held
+//-----------------------------------------------------------------------------
+int CXZipContentTable::FindSlot(const XZipContentKey_t& key) const
+{
+	return m_Index.Find(key.GetHash(), [&](int id) { return m_Slots[id].m_Key == key; });
+}
+
+int CXZipContentTable::FindOrAddSlot(const XZipContentKey_t& key)
+{
+	int nSlot = FindSlot(key);
+	if (nSlot < 0)
+	{
+		nSlot = m_Slots.AddToTail();
+		m_Slots[nSlot].m_Key = key;
+		m_Slots[nSlot].m_nHolder = -1;
+		m_Slots[nSlot].m_bClaimed = false;
+		m_Index.Insert(key.GetHash(), nSlot);
+	}
+
+	return nSlot;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: First claim wins, until it is released or its holder goes away
+//-----------------------------------------------------------------------------
+bool CXZipContentTable::Claim(const XZipContentKey_t& key)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	Slot_t& slot = m_Slots[FindOrAddSlot(key)];
+	if (slot.m_nHolder >= 0 || slot.m_bClaimed)
+	{
+		return false;
+	}
+
+	slot.m_bClaimed = true;
+	return true;
+}
+
+void CXZipContentTable::Release(const XZipContentKey_t& key)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	int nSlot = FindSlot(key);
+	if (nSlot >= 0)
+	{
+		m_Slots[nSlot].m_bClaimed = false;
+	}
+}
+
+int CXZipContentTable::FindHolder(const XZipContentKey_t& key) const
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	int nSlot = FindSlot(key);
+	return (nSlot >= 0) ? m_Slots[nSlot].m_nHolder : -1;
+}
+
+void CXZipContentTable::SetHolder(const XZipContentKey_t& key, int id)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	m_Slots[FindOrAddSlot(key)].m_nHolder = id;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drop everything
+//-----------------------------------------------------------------------------
+void CXZipContentTable::Purge(void)
+{
+	std::lock_guard<std::mutex> lock(m_Lock);
+
+	m_Slots.Purge();
+	m_Index.Purge();
+}
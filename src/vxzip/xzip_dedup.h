@@ -0,0 +1,102 @@
+/*****************************************************************//**
+ * \file   xzip_dedup.h
+ * \brief  Content keys used to store identical payloads only once.
+ *********************************************************************/
+#ifndef _XZIP_DEDUP_H
+#define _XZIP_DEDUP_H
+
+#pragma once
+
+#include <mutex>
+
+#include "checksum_crc.h"
+#include "checksum_md5.h"
+#include "utlvector.h"
+
+#include "xzip_index.h"
+
+/**
+ * Identifies a payload by content: MD5, CRC and size of the uncompressed
+ * data, plus the codec it gets stored with. Two entries with equal keys
+ * store the exact same bytes.
+ */
+struct XZipContentKey_t
+{
+	unsigned char	m_Hash[MD5_DIGEST_LENGTH];
+	CRC32_t			m_CRC;
+	int				m_nSize;
+	int				m_nCompressionType;
+
+	/**
+	 * Builds the key of a payload.
+	 *
+	 * \param pData				Uncompressed data, after any text transform
+	 * \param nSize				Size of the data
+	 * \param crc				CRC of the data
+	 * \param nCompressionType	Codec the payload is stored with
+	 */
+	void			Compute(const void* pData, int nSize, CRC32_t crc, int nCompressionType);
+	/**
+	 * \return Hash for CXZipHashIndex, taken from the digest
+	 */
+	unsigned int	GetHash(void) const;
+	bool			operator==(const XZipContentKey_t& other) const;
+};
+
+/**
+ * Tracks which entry holds each payload, and which payloads a compression
+ * worker is busy with. Thread safe, so the workers can skip a payload
+ * someone else already has. Holders are only set from the committing
+ * thread.
+ */
+class CXZipContentTable
+{
+public:
+	/**
+	 * Claims a key for compression.
+	 *
+	 * \param key	Content key
+	 * \return True if nobody holds or claimed the payload yet, the claim
+	 *			must then be released once it is committed or dropped
+	 */
+	bool	Claim(const XZipContentKey_t& key);
+	/**
+	 * Drops a claim taken with Claim.
+	 *
+	 * \param key	Content key
+	 */
+	void	Release(const XZipContentKey_t& key);
+	/**
+	 * \param key	Content key
+	 * \return Id of the entry holding the payload, -1 if none does
+	 */
+	int		FindHolder(const XZipContentKey_t& key) const;
+	/**
+	 * Sets the entry holding a payload.
+	 *
+	 * \param key	Content key
+	 * \param id	Entry id, -1 once no entry holds it anymore
+	 */
+	void	SetHolder(const XZipContentKey_t& key, int id);
+	/**
+	 * Forgets every key.
+	 */
+	void	Purge(void);
+
+private:
+	struct Slot_t
+	{
+		XZipContentKey_t	m_Key;
+		int					m_nHolder;
+		bool				m_bClaimed;
+	};
+
+	int		FindSlot(const XZipContentKey_t& key) const;
+	int		FindOrAddSlot(const XZipContentKey_t& key);
+
+	mutable std::mutex		m_Lock;
+	CUtlVector<Slot_t>		m_Slots;
+	CXZipHashIndex			m_Index;
+};
+
+#endif // _XZIP_DEDUP_H
@@ -0,0 +1,213 @@
+/*****************************************************************//**
+ * \file   xzip_directory.cpp
+ * \brief  Compact structure-of-arrays directory for XZip paks.
+ *********************************************************************/
+
+#include <algorithm>
+
+#include "xzip_directory.h"
+#include "strtools.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: Construction
+//-----------------------------------------------------------------------------
+CXZipDirectory::CXZipDirectory(void)
+{
+	m_bSorted = true;
+	m_bSortCaseless = true;
+	m_nRemovedNameBytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Append a new entry
+//-----------------------------------------------------------------------------
+int CXZipDirectory::AddEntry(const char* pName)
+{
+	int nameLength = V_strlen(pName);
+	Assert(nameLength <= 0xFFFF);
+
+	// names are stored lowercase and null terminated
+	unsigned int nameOffset = m_NameBlob.Count();
+	m_NameBlob.AddMultipleToTail(nameLength + 1, pName);
+	V_strlower(m_NameBlob.Base() + nameOffset);
+
+	int id = m_NameOffsets.AddToTail(nameOffset);
+	m_NameLengths.AddToTail((unsigned short)nameLength);
+	m_NameHashes.AddToTail(CXZipHashIndex::HashName(pName));
+
+	m_DataOffsets.AddToTail(0);
+	m_CompressedSizes.AddToTail(0);
+	m_UncompressedSizes.AddToTail(0);
+	m_CompressionTypes.AddToTail(0);
+	m_CRCs.AddToTail(0);
+	m_PreloadOffsets.AddToTail(0);
+	m_PreloadLengths.AddToTail(0);
+
+	m_Index.Insert(m_NameHashes[id], id);
+	m_bSorted = false;
+
+	return id;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Remove an entry, the last one moves into its slot. The name stays
+//			in the blob until removed names make up half of it.
+//-----------------------------------------------------------------------------
+void CXZipDirectory::RemoveEntry(int id)
+{
+	Assert(IsValidEntry(id));
+
+	// only the removed entry and the last one change, the index follows them
+	int last = Count() - 1;
+	m_Index.Remove(m_NameHashes[id], id);
+	if (id != last)
+	{
+		m_Index.ChangeID(m_NameHashes[last], last, id);
+	}
+	m_nRemovedNameBytes += m_NameLengths[id] + 1;
+
+	m_NameOffsets.FastRemove(id);
+	m_NameLengths.FastRemove(id);
+	m_NameHashes.FastRemove(id);
+	m_DataOffsets.FastRemove(id);
+	m_CompressedSizes.FastRemove(id);
+	m_UncompressedSizes.FastRemove(id);
+	m_CompressionTypes.FastRemove(id);
+	m_CRCs.FastRemove(id);
+	m_PreloadOffsets.FastRemove(id);
+	m_PreloadLengths.FastRemove(id);
+
+	if (m_nRemovedNameBytes * 2 > m_NameBlob.Count())
+	{
+		CompactNames();
+	}
+
+	m_bSorted = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drop the names of removed entries from the blob. Runs once they
+//			make up half of it, so the cost is amortized over the removals.
+//-----------------------------------------------------------------------------
+void CXZipDirectory::CompactNames(void)
+{
+	CUtlVector<char> nameBlob;
+	nameBlob.EnsureCapacity(m_NameBlob.Count() - m_nRemovedNameBytes);
+	for (int i = 0; i < Count(); i++)
+	{
+		unsigned int nameOffset = nameBlob.Count();
+		nameBlob.AddMultipleToTail(m_NameLengths[i] + 1, GetName(i));
+		m_NameOffsets[i] = nameOffset;
+	}
+
+	m_NameBlob.Swap(nameBlob);
+	m_nRemovedNameBytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drop everything
+//-----------------------------------------------------------------------------
+void CXZipDirectory::Purge(void)
+{
+	m_NameBlob.Purge();
+	m_nRemovedNameBytes = 0;
+	m_NameOffsets.Purge();
+	m_NameLengths.Purge();
+	m_NameHashes.Purge();
+	m_DataOffsets.Purge();
+	m_CompressedSizes.Purge();
+	m_UncompressedSizes.Purge();
+	m_CompressionTypes.Purge();
+	m_CRCs.Purge();
+	m_PreloadOffsets.Purge();
+	m_PreloadLengths.Purge();
+	m_Index.Purge();
+	m_SortedEntries.Purge();
+	m_EntryRanks.Purge();
+	m_bSorted = true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Size everything up front for a bulk load
+//-----------------------------------------------------------------------------
+void CXZipDirectory::Reserve(int nEntries, int nNameBytes)
+{
+	int nTotal = Count() + nEntries;
+
+	m_NameBlob.EnsureCapacity(m_NameBlob.Count() + nNameBytes + nEntries);
+	m_NameOffsets.EnsureCapacity(nTotal);
+	m_NameLengths.EnsureCapacity(nTotal);
+	m_NameHashes.EnsureCapacity(nTotal);
+	m_DataOffsets.EnsureCapacity(nTotal);
+	m_CompressedSizes.EnsureCapacity(nTotal);
+	m_UncompressedSizes.EnsureCapacity(nTotal);
+	m_CompressionTypes.EnsureCapacity(nTotal);
+	m_CRCs.EnsureCapacity(nTotal);
+	m_PreloadOffsets.EnsureCapacity(nTotal);
+	m_PreloadLengths.EnsureCapacity(nTotal);
+	m_Index.Reserve(nTotal);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Hash lookup, case insensitive
+//-----------------------------------------------------------------------------
+int CXZipDirectory::Find(const char* pName) const
+{
+	return m_Index.Find(CXZipHashIndex::HashName(pName), [&](int candidate)
+	{
+		return !V_stricmp(GetName(candidate), pName);
+	});
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Iteration order
+//-----------------------------------------------------------------------------
+void CXZipDirectory::SetSortCaseless(bool bCaseless)
+{
+	m_bSortCaseless = bCaseless;
+	m_bSorted = false;
+}
+
+void CXZipDirectory::SortEntries(void)
+{
+	m_SortedEntries.SetCount(Count());
+	for (int i = 0; i < Count(); i++)
+	{
+		m_SortedEntries[i] = i;
+	}
+
+	std::sort(m_SortedEntries.Base(), m_SortedEntries.Base() + m_SortedEntries.Count(), [this](int left, int right)
+	{
+		int result = m_bSortCaseless ? V_stricmp(GetName(left), GetName(right)) : V_strcmp(GetName(left), GetName(right));
+		return (result != 0) ? (result < 0) : (left < right);
+	});
+
+	m_EntryRanks.SetCount(Count());
+	for (int i = 0; i < m_SortedEntries.Count(); i++)
+	{
+		m_EntryRanks[m_SortedEntries[i]] = i;
+	}
+
+	m_bSorted = true;
+}
+
+int CXZipDirectory::FirstInOrder(void)
+{
+	if (!m_bSorted)
+	{
+		SortEntries();
+	}
+
+	return Count() ? m_SortedEntries[0] : -1;
+}
+
+int CXZipDirectory::NextInOrder(int id)
+{
+	if (!m_bSorted)
+	{
+		SortEntries();
+	}
+
+	int rank = m_EntryRanks[id] + 1;
+	return (rank < m_SortedEntries.Count()) ? m_SortedEntries[rank] : -1;
+}
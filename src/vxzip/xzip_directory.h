@@ -0,0 +1,117 @@
+/*****************************************************************//**
+ * \file   xzip_directory.h
+ * \brief  Compact structure-of-arrays directory for XZip paks.
+ *********************************************************************/
+#ifndef _XZIP_DIRECTORY_H
+#define _XZIP_DIRECTORY_H
+
+#pragma once
+
+#include "checksum_crc.h"
+#include "utlvector.h"
+
+#include "xzip_index.h"
+
+/**
+ * Directory of a pak, one entry per file.
+ *
+ * Entries are addressed by id (0 .. Count() - 1) and every per-entry field
+ * lives in its own packed array. Names are kept lowercase in a single blob
+ * owned by the directory, so there is no per-entry allocation and no
+ * dependency on the process wide symbol table. Lookups are const and may
+ * run on any number of threads while the directory is not modified.
+ */
+class CXZipDirectory
+{
+public:
+	CXZipDirectory(void);
+
+	/**
+	 * Appends an entry, all fields other than the name start out zeroed.
+	 *
+	 * \param pName		Relative name (path + name), stored lowercase
+	 * \return Id of the new entry
+	 */
+	int			AddEntry(const char* pName);
+	/**
+	 * Removes an entry. The last entry takes over its id. The blob gives
+	 * back the space of removed names once they make up half of it.
+	 *
+	 * \param id	Entry to remove
+	 */
+	void		RemoveEntry(int id);
+	/**
+	 * Removes all entries and frees the storage.
+	 */
+	void		Purge(void);
+	/**
+	 * Pre-sizes the storage for a bulk load.
+	 *
+	 * \param nEntries		Expected number of entries
+	 * \param nNameBytes	Expected size of all names (without terminators)
+	 */
+	void		Reserve(int nEntries, int nNameBytes);
+
+	/**
+	 * Case insensitive lookup, no allocations.
+	 *
+	 * \param pName		Relative name (path + name)
+	 * \return Entry id, -1 if not found
+	 */
+	int			Find(const char* pName) const;
+
+	int			Count(void) const { return m_NameOffsets.Count(); }
+	bool		IsValidEntry(int id) const { return id >= 0 && id < Count(); }
+	const char*	GetName(int id) const { return m_NameBlob.Base() + m_NameOffsets[id]; }
+	int			GetNameLength(int id) const { return m_NameLengths[id]; }
+
+	/**
+	 * Selects how entries are ordered for iteration (and therefore in saved paks).
+	 *
+	 * \param bCaseless	True for a case insensitive sort
+	 */
+	void		SetSortCaseless(bool bCaseless);
+	/**
+	 * Entry ids in name order. The order is rebuilt on first use after a change,
+	 * so the first call after modifying the directory is not thread safe.
+	 *
+	 * \return First entry id, -1 if empty
+	 */
+	int			FirstInOrder(void);
+	/**
+	 * \param id	Current entry id
+	 * \return Next entry id in name order, -1 at the end
+	 */
+	int			NextInOrder(int id);
+
+public:
+	// Hot fields, read on every lookup / read
+	CUtlVector<uint64>			m_DataOffsets;			// Offset of the payload in the source pak, 64 bit for ZIP64
+	CUtlVector<int>				m_CompressedSizes;		// Length of the stored payload
+	CUtlVector<int>				m_UncompressedSizes;	// Original, uncompressed size
+	CUtlVector<unsigned char>	m_CompressionTypes;		// IZip::eCompressionType
+
+	// Cold fields
+	CUtlVector<CRC32_t>			m_CRCs;					// CRC of the uncompressed data
+	CUtlVector<unsigned int>	m_PreloadOffsets;		// Offset of the preloaded bytes in the preload data
+	CUtlVector<unsigned int>	m_PreloadLengths;		// Number of leading payload bytes preloaded, 0 for none
+
+private:
+	void		SortEntries(void);
+	void		CompactNames(void);
+
+	CUtlVector<char>			m_NameBlob;
+	int							m_nRemovedNameBytes;	// Blob bytes of removed names
+	CUtlVector<unsigned int>	m_NameOffsets;
+	CUtlVector<unsigned short>	m_NameLengths;
+	CUtlVector<unsigned int>	m_NameHashes;
+	CXZipHashIndex				m_Index;
+
+	// Name order, and the position of every entry within it
+	CUtlVector<int>				m_SortedEntries;
+	CUtlVector<int>				m_EntryRanks;
+	bool						m_bSorted;
+	bool						m_bSortCaseless;
+};
+
+#endif // _XZIP_DIRECTORY_H
@@ -7,7 +7,23 @@
  * \date   July 2022
  *********************************************************************/
 
+#include <limits.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "xzip_file.h"
+#include "job_pool.h"
+#include "xzip_codec.h"
+#include "xzip_crc.h"
+#include "xzip_text.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XZIP_SSE2
+#endif
 
  // Data descriptions for byte swapping
 BEGIN_BYTESWAP_DATADESC(ZIP_EndOfCentralDirRecord)
@@ -67,90 +83,147 @@ DEFINE_FIELD(Length, FIELD_INTEGER),
 DEFINE_FIELD(DataOffset, FIELD_INTEGER),
 END_BYTESWAP_DATADESC()
 
+//-----------------------------------------------------------------------------
+// ZIP64 records (APPNOTE 4.3.14, 4.3.15 and 4.5.3). The data descriptions
+// have no 64 bit field type, so these get swapped field by field.
+//-----------------------------------------------------------------------------
+#pragma pack(1)
+struct ZIP64_EndOfCentralDirRecord
+{
+	unsigned int	signature;					// PKID(6, 6)
+	uint64			sizeOfRecord;				// not counting signature and this field
+	unsigned short	versionMadeBy;
+	unsigned short	versionNeededToExtract;
+	unsigned int	numberOfThisDisk;
+	unsigned int	numberOfTheDiskWithStartOfCentralDirectory;
+	uint64			nCentralDirectoryEntries_ThisDisk;
+	uint64			nCentralDirectoryEntries_Total;
+	uint64			centralDirectorySize;
+	uint64			startOfCentralDirOffset;
+};
+
+struct ZIP64_EndOfCentralDirLocator
+{
+	unsigned int	signature;					// PKID(6, 7)
+	unsigned int	numberOfTheDiskWithZip64Record;
+	uint64			zip64RecordOffset;
+	unsigned int	totalNumberOfDisks;
+};
+
+// Only the local header offset ever needs 64 bits, entry sizes stay 32 bit
+struct ZIP64_ExtraFieldOffset
+{
+	unsigned short	headerID;					// ZIP64_EXTRA_FIELD_ID
+	unsigned short	dataSize;
+	uint64			relativeOffsetOfLocalHeader;
+};
+#pragma pack()
+
+// Version needed to extract anything with ZIP64 records (APPNOTE 4.4.3.2)
+#define ZIP64_VERSION_NEEDED 45
+
+static void SwapZip64Fields(CByteswap& swap, ZIP64_EndOfCentralDirRecord& rec)
+{
+	swap.SwapBufferToTargetEndian(&rec.signature);
+	swap.SwapBufferToTargetEndian(&rec.sizeOfRecord);
+	swap.SwapBufferToTargetEndian(&rec.versionMadeBy);
+	swap.SwapBufferToTargetEndian(&rec.versionNeededToExtract);
+	swap.SwapBufferToTargetEndian(&rec.numberOfThisDisk);
+	swap.SwapBufferToTargetEndian(&rec.numberOfTheDiskWithStartOfCentralDirectory);
+	swap.SwapBufferToTargetEndian(&rec.nCentralDirectoryEntries_ThisDisk);
+	swap.SwapBufferToTargetEndian(&rec.nCentralDirectoryEntries_Total);
+	swap.SwapBufferToTargetEndian(&rec.centralDirectorySize);
+	swap.SwapBufferToTargetEndian(&rec.startOfCentralDirOffset);
+}
+
+static void SwapZip64Fields(CByteswap& swap, ZIP64_EndOfCentralDirLocator& locator)
+{
+	swap.SwapBufferToTargetEndian(&locator.signature);
+	swap.SwapBufferToTargetEndian(&locator.numberOfTheDiskWithZip64Record);
+	swap.SwapBufferToTargetEndian(&locator.zip64RecordOffset);
+	swap.SwapBufferToTargetEndian(&locator.totalNumberOfDisks);
+}
+
+static void SwapZip64Fields(CByteswap& swap, ZIP64_ExtraFieldOffset& extra)
+{
+	swap.SwapBufferToTargetEndian(&extra.headerID);
+	swap.SwapBufferToTargetEndian(&extra.dataSize);
+	swap.SwapBufferToTargetEndian(&extra.relativeOffsetOfLocalHeader);
+}
+
 /**
- * Copies text data from a form appropriate for disk to a normal string.
- *
- * \param pSrc
- * \param nSrcSize
- * \param buf
+ * Rounds an archive offset up to a power of two alignment. AlignValue goes
+ * through a pointer sized integer, which would truncate past 4 GB.
  */
-	static void ReadTextData(const char* pSrc, int nSrcSize, CUtlBuffer& buf)
+static inline uint64 AlignOffset(uint64 offset, unsigned int alignment)
 {
-	buf.EnsureCapacity(nSrcSize + 1);
-	const char* pSrcEnd = pSrc + nSrcSize;
-	for (const char* pSrcScan = pSrc; pSrcScan < pSrcEnd; ++pSrcScan)
-	{
-		if (*pSrcScan == '\r')
-		{
-			if (pSrcScan[1] == '\n')
-			{
-				buf.PutChar('\n');
-				++pSrcScan;
-				continue;
-			}
-		}
-
-		buf.PutChar(*pSrcScan);
-	}
+	return (offset + alignment - 1) & ~(uint64)(alignment - 1);
+}
 
-	// Null terminate
-	buf.PutChar('\0');
+/**
+ * Index of the highest set bit, mask must not be zero.
+ */
+static inline int HighestBitIndex(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, mask);
+	return (int)index;
+#else
+	return 31 - __builtin_clz(mask);
+#endif
 }
 
 /**
- * Copies text data into a form appropriate for disk.
+ * Finds the last end of central directory record in the tail of an archive.
  *
- * \param pDst
- * \param pSrc
- * \param dstSize
- * \param srcSize
+ * \param pData			Tail of the archive
+ * \param nSize			Size of the tail
+ * \param nSignature	Record signature as laid out in the file
+ * \return Offset of the record within the tail, -1 if not found
  */
-static void CopyTextData(char* pDst, const char* pSrc, int dstSize, int srcSize)
+static int FindEndOfCentralDirRecord(const unsigned char* pData, unsigned int nSize, unsigned int nSignature)
 {
-	const char* pSrcScan = pSrc;
-	const char* pSrcEnd = pSrc + srcSize;
-	char* pDstScan = pDst;
+	if (nSize < sizeof(ZIP_EndOfCentralDirRecord))
+	{
+		return -1;
+	}
 
-#ifdef DBGFLAG_ASSERT
-	char* pDstEnd = pDst + dstSize;
-#endif
+	unsigned char signatureBytes[4];
+	memcpy(signatureBytes, &nSignature, sizeof(signatureBytes));
+
+	// last position the whole record fits at
+	int pos = nSize - sizeof(ZIP_EndOfCentralDirRecord);
 
-	for (; pSrcScan < pSrcEnd; pSrcScan++)
+#ifdef XZIP_SSE2
+	// match the first signature byte 16 candidates at a time, newest first
+	const __m128i firstByte = _mm_set1_epi8((char)signatureBytes[0]);
+	for (; pos >= 15; pos -= 16)
 	{
-		if (*pSrcScan == '\n')
+		__m128i block = _mm_loadu_si128((const __m128i*)(pData + pos - 15));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, firstByte));
+		while (mask)
 		{
-			*pDstScan = '\r';
-			pDstScan++;
-			*pDstScan = '\n';
-			pDstScan++;
-		}
-		else
-		{
-			*pDstScan = *pSrcScan;
-			pDstScan++;
+			int bit = HighestBitIndex(mask);
+			int candidate = pos - 15 + bit;
+			if (!memcmp(pData + candidate, signatureBytes, sizeof(signatureBytes)))
+			{
+				return candidate;
+			}
+			mask &= ~(1u << bit);
 		}
 	}
-	Assert(pSrcScan == pSrcEnd);
-	Assert(pDstScan == pDstEnd);
-}
+#endif
 
-static int GetLengthOfBinStringAsText(const char* pSrc, int srcSize)
-{
-	const char* pSrcScan = pSrc;
-	const char* pSrcEnd = pSrc + srcSize;
-	int numChars = 0;
-	for (; pSrcScan < pSrcEnd; pSrcScan++)
+	for (; pos >= 0; pos--)
 	{
-		if (*pSrcScan == '\n')
+		if (pData[pos] == signatureBytes[0] && !memcmp(pData + pos, signatureBytes, sizeof(signatureBytes)))
 		{
-			numChars += 2;
-		}
-		else
-		{
-			numChars++;
+			return pos;
 		}
 	}
-	return numChars;
+
+	return -1;
 }
 
 //-----------------------------------------------------------------------------
@@ -158,42 +231,53 @@ static int GetLengthOfBinStringAsText(const char* pSrc, int srcSize)
 //-----------------------------------------------------------------------------
 CXZipFile::CZipEntry::CZipEntry(void)
 {
-	m_Name = "";
-	m_nCompressedSize = 0;
-	m_nUncompressedSize = 0;
 	m_pData = NULL;
+	m_nDataSize = 0;
 	m_ZipOffset = 0;
-	m_ZipCRC = 0;
 	m_DiskCacheOffset = 0;
-	m_SourceDiskOffset = 0;
-	m_eCompressionType = IZip::eCompressionType_None;
+	m_bSpilled = false;
+	m_bHasContentKey = false;
+	m_bSharedPayload = false;
 }
 
 //-----------------------------------------------------------------------------
-// Purpose:
+// Purpose: Takes over the payload of src, which is left empty
 // Input  : src -
 //-----------------------------------------------------------------------------
-CXZipFile::CZipEntry::CZipEntry(const CXZipFile::CZipEntry& src)
+CXZipFile::CZipEntry::CZipEntry(CXZipFile::CZipEntry&& src)
 {
-	m_Name = src.m_Name;
-	m_nCompressedSize = src.m_nCompressedSize;
-	m_nUncompressedSize = src.m_nUncompressedSize;
-	m_eCompressionType = src.m_eCompressionType;
+	m_pData = NULL;
+	m_nDataSize = 0;
+	*this = std::move(src);
+}
 
-	if (src.m_nCompressedSize > 0 && src.m_pData)
-	{
-		m_pData = malloc(src.m_nCompressedSize);
-		memcpy(m_pData, src.m_pData, src.m_nCompressedSize);
-	}
-	else
+CXZipFile::CZipEntry& CXZipFile::CZipEntry::operator=(CXZipFile::CZipEntry&& src)
+{
+	if (this != &src)
 	{
-		m_pData = NULL;
+		if (m_pData)
+		{
+			free(m_pData);
+		}
+
+		m_pData = src.m_pData;
+		m_nDataSize = src.m_nDataSize;
+		src.m_pData = NULL;
+		src.m_nDataSize = 0;
+
+		m_ZipOffset = src.m_ZipOffset;
+		m_DiskCacheOffset = src.m_DiskCacheOffset;
+		m_bSpilled = src.m_bSpilled;
+		m_bHasContentKey = src.m_bHasContentKey;
+		m_bSharedPayload = src.m_bSharedPayload;
+		if (m_bHasContentKey)
+		{
+			m_ContentKey = src.m_ContentKey;
+		}
+		src.m_bSpilled = false;
 	}
 
-	m_ZipOffset = src.m_ZipOffset;
-	m_ZipCRC = src.m_ZipCRC;
-	m_DiskCacheOffset = src.m_DiskCacheOffset;
-	m_SourceDiskOffset = src.m_SourceDiskOffset;
+	return *this;
 }
 
 //-----------------------------------------------------------------------------
@@ -211,24 +295,30 @@ CXZipFile::CZipEntry::~CZipEntry(void)
 // Purpose: Construction
 //-----------------------------------------------------------------------------
 CXZipFile::CXZipFile(const char* pDiskCacheWritePath, bool bSortByName)
-	: m_Files(0, 32)
 {
 	m_AlignmentSize = 0;
 	m_bForceAlignment = false;
 	m_bCompatibleFormat = true;
+	m_bVerifyCRC = false;
+	m_bDeduplicate = false;
+	m_nCompressionLevel = 0;
+	m_nPreloadSize = 0;
+	m_nPreloadSectionSize = 0;
 
 	m_bUseDiskCacheForWrites = (pDiskCacheWritePath != NULL);
 	m_DiskCacheWritePath = pDiskCacheWritePath;
-	m_hDiskCacheWriteFile = INVALID_HANDLE_VALUE;
-
-	if (bSortByName)
-	{
-		m_Files.SetLessFunc(CZipEntry::ZipFileLessFunc_CaselessSort);
-	}
-	else
+	if (m_bUseDiskCacheForWrites)
 	{
-		m_Files.SetLessFunc(CZipEntry::ZipFileLessFunc);
+		m_SpillArena.Open(m_DiskCacheWritePath);
 	}
+
+	m_hArchiveMapping = INVALID_HANDLE_VALUE;
+	m_pArchiveView = NULL;
+	m_nArchiveViewSize = 0;
+	m_bBorrowedView = false;
+	m_pArchiveOwner = NULL;
+
+	m_Directory.SetSortCaseless(bSortByName);
 }
 
 //-----------------------------------------------------------------------------
@@ -245,35 +335,80 @@ CXZipFile::~CXZipFile(void)
 //-----------------------------------------------------------------------------
 void CXZipFile::Clear(void)
 {
-	m_Files.RemoveAll();
-
-	if (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE)
+	m_Directory.Purge();
+	m_Entries.Purge();
+	m_PreloadData.Purge();
+	m_nPreloadSectionSize = 0;
+	m_ContentTable.Purge();
+	m_EntryCache.Invalidate();
+	CloseArchiveView();
+
+	m_SpillArena.Close();
+	if (m_bUseDiskCacheForWrites)
 	{
-		CloseHandle(m_hDiskCacheWriteFile);
-		DeleteFile(m_DiskCacheName.String());
-		m_hDiskCacheWriteFile = INVALID_HANDLE_VALUE;
+		m_SpillArena.Open(m_DiskCacheWritePath);
 	}
+}
 
-	if (m_bUseDiskCacheForWrites)
+//-----------------------------------------------------------------------------
+// Purpose: Release the archive mapping (if any)
+//-----------------------------------------------------------------------------
+void CXZipFile::CloseArchiveView(void)
+{
+	if (m_bBorrowedView)
+	{
+		// hand the buffer back, it is not ours to unmap
+		if (m_pArchiveOwner)
+		{
+			m_pArchiveOwner->Release();
+		}
+	}
+	else
 	{
-		m_hDiskCacheWriteFile = CWin32File::CreateTempFile(m_DiskCacheWritePath, m_DiskCacheName);
+		CWin32File::UnmapFile(m_pArchiveView, m_hArchiveMapping);
 	}
+
+	m_hArchiveMapping = INVALID_HANDLE_VALUE;
+	m_pArchiveView = NULL;
+	m_nArchiveViewSize = 0;
+	m_bBorrowedView = false;
+	m_pArchiveOwner = NULL;
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Comparison for sorting entries
-// Input  : src1 -
-//			src2 -
-// Output : Returns true on success, false on failure.
+// Purpose: Adds a directory entry and its (empty) payload slot
+// Output : Entry id
 //-----------------------------------------------------------------------------
-bool CXZipFile::CZipEntry::ZipFileLessFunc(CZipEntry const& src1, CZipEntry const& src2)
+int CXZipFile::AddEntry(const char* pRelativeName)
 {
-	return (src1.m_Name < src2.m_Name);
+	int id = m_Directory.AddEntry(pRelativeName);
+	m_Entries.AddToTail();
+	Assert(m_Entries.Count() == m_Directory.Count());
+
+	return id;
 }
 
-bool CXZipFile::CZipEntry::ZipFileLessFunc_CaselessSort(CZipEntry const& src1, CZipEntry const& src2)
+//-----------------------------------------------------------------------------
+// Purpose: Removes an entry, the last entry takes over its id
+//-----------------------------------------------------------------------------
+void CXZipFile::RemoveEntry(int id)
 {
-	return (V_stricmp(src1.m_Name.String(), src2.m_Name.String()) < 0);
+	DropPayload(id);
+
+	int last = m_Entries.Count() - 1;
+	m_Directory.RemoveEntry(id);
+	m_Entries.FastRemove(id);
+
+	// the last entry took over the id
+	m_EntryCache.Invalidate();
+	if (id != last)
+	{
+		const CZipEntry& moved = m_Entries[id];
+		if (moved.m_bHasContentKey && !moved.m_bSharedPayload && m_ContentTable.FindHolder(moved.m_ContentKey) == last)
+		{
+			m_ContentTable.SetHolder(moved.m_ContentKey, id);
+		}
+	}
 }
 
 void CXZipFile::ForceAlignment(bool bAligned, bool bCompatibleFormat, unsigned int alignment)
@@ -313,7 +448,22 @@ void CXZipFile::ActivateByteSwapping(bool bActivate)
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Load pak file from raw buffer
+// Purpose: Compare the CRC of read data against the directory
+//-----------------------------------------------------------------------------
+bool CXZipFile::CheckEntryCRC(int id, CRC32_t crc)
+{
+	if (crc != m_Directory.m_CRCs[id])
+	{
+		Warning("Zip: CRC mismatch in %s (expected %08x, got %08x)\n", m_Directory.GetName(id), m_Directory.m_CRCs[id], crc);
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Load pak file from raw buffer, the payloads are copied so the
+//			buffer may go away afterwards
 // Input  : *buffer -
 //			bufferlength -
 //-----------------------------------------------------------------------------
@@ -322,502 +472,1750 @@ void CXZipFile::OpenFromBuffer(void* buffer, int bufferlength)
 	// Throw away old data
 	Clear();
 
-	// Initialize a buffer
-	CUtlBuffer buf(0, bufferlength + 1);					// +1 for null termination
+	if (!ReadDirectoryFromBuffer((const unsigned char*)buffer, bufferlength))
+	{
+		return;
+	}
 
-	// need to swap bytes, so set the buffer opposite the machine's endian
-	buf.ActivateByteSwapping(m_Swap.IsSwappingBytes());
+	// Copy in the payloads, the data offsets are only meaningful for the source buffer
+	for (int i = 0; i < m_Entries.Count(); i++)
+	{
+		CZipEntry& e = m_Entries[i];
+		int nLength = m_Directory.m_CompressedSizes[i];
+		uint64 nDataOffset = m_Directory.m_DataOffsets[i];
+
+		// Make sure length is reasonable
+		if (nLength > 0 && bufferlength > 0 && nDataOffset + (uint64)nLength <= (uint64)bufferlength)
+		{
+			e.m_pData = malloc(nLength);
+			e.m_nDataSize = nLength;
+			memcpy(e.m_pData, (const unsigned char*)buffer + (size_t)nDataOffset, nLength);
+		}
+		m_Directory.m_DataOffsets[i] = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Load pak file from a buffer owned by the caller, entries are read
+//			straight from it like from a mapped archive
+//-----------------------------------------------------------------------------
+bool CXZipFile::OpenFromBorrowedBuffer(const void* pBuffer, int nLength, IRefCounted* pOwner)
+{
+	// Throw away old data
+	Clear();
+
+	if (!ReadDirectoryFromBuffer((const unsigned char*)pBuffer, nLength))
+	{
+		Clear();
+		return false;
+	}
+
+	m_pArchiveView = (const unsigned char*)pBuffer;
+	m_nArchiveViewSize = nLength;
+	m_bBorrowedView = true;
+	m_pArchiveOwner = pOwner;
+	if (m_pArchiveOwner)
+	{
+		m_pArchiveOwner->AddRef();
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Builds the directory from a whole archive in memory. The buffer is
+//			parsed in place, data offsets are left relative to it.
+//-----------------------------------------------------------------------------
+bool CXZipFile::ReadDirectoryFromBuffer(const unsigned char* pArchive, int nLength)
+{
+	if (!pArchive || nLength < (int)sizeof(ZIP_EndOfCentralDirRecord))
+	{
+		return false;
+	}
 
-	buf.Put(buffer, bufferlength);
+	// Wrap the archive, no copy
+	CUtlBuffer buf(pArchive, nLength, CUtlBuffer::READ_ONLY);
 
-	buf.SeekGet(CUtlBuffer::SEEK_TAIL, 0);
-	unsigned int fileLen = buf.TellGet();
+	// need to swap bytes, so set the buffer opposite the machine's endian
+	buf.ActivateByteSwapping(m_Swap.IsSwappingBytes());
 
-	// Start from beginning
-	buf.SeekGet(CUtlBuffer::SEEK_HEAD, 0);
+	unsigned int fileLen = (unsigned int)nLength;
 
 	ZIP_EndOfCentralDirRecord rec = { 0 };
 
-#ifdef DBGFLAG_ASSERT
-	bool bFoundEndOfCentralDirRecord = false;
-#endif
-	unsigned int offset = fileLen - sizeof(ZIP_EndOfCentralDirRecord);
-	// If offset is ever greater than startOffset then it means that it has
-	// wrapped. This used to be a tautological >= 0 test.
-	ANALYZE_SUPPRESS(6293); // warning C6293: Ill-defined for-loop: counts down from minimum
-	for (unsigned int startOffset = offset; offset <= startOffset; offset--)
+	// The record is followed by at most a 64k comment, scan that tail in place
+	unsigned int tailSize = Min(fileLen, (unsigned int)(sizeof(ZIP_EndOfCentralDirRecord) + 0xFFFF));
+	unsigned int tailOffset = fileLen - tailSize;
+	unsigned int nSignature = PKID(5, 6);
+	m_Swap.SwapBufferToTargetEndian(&nSignature);
+
+	CentralDirInfo_t dir = { 0, 0, 0 };
+	bool bXZip = false;
+	int recordOffset = FindEndOfCentralDirRecord(pArchive + tailOffset, tailSize, nSignature);
+	Assert(recordOffset >= 0);
+	if (recordOffset >= 0)
 	{
-		buf.SeekGet(CUtlBuffer::SEEK_HEAD, offset);
+		buf.SeekGet(CUtlBuffer::SEEK_HEAD, tailOffset + recordOffset);
 		buf.GetObjects(&rec);
-		if (rec.signature == PKID(5, 6))
+
+		if (!ReadCentralDirInfo(rec, pArchive, NULL, tailOffset + recordOffset, dir))
 		{
-#ifdef DBGFLAG_ASSERT
-			bFoundEndOfCentralDirRecord = true;
-#endif
+			// bad format
+			return false;
+		}
 
-			// Set any xzip configuration
-			if (rec.commentLength)
-			{
-				char commentString[128];
-				int commentLength = min(rec.commentLength, sizeof(commentString));
-				buf.Get(commentString, commentLength);
-				if (commentLength == sizeof(commentString))
-					--commentLength;
-				commentString[commentLength] = '\0';
-				ParseXZipCommentString(commentString);
-			}
-			break;
+		// Set any xzip configuration
+		if (rec.commentLength)
+		{
+			char commentString[128];
+			int commentLength = Min((unsigned int)rec.commentLength, (unsigned int)sizeof(commentString));
+			commentLength = Min(commentLength, (int)(tailSize - recordOffset - sizeof(rec)));
+			buf.Get(commentString, commentLength);
+			if (commentLength == sizeof(commentString))
+				--commentLength;
+			commentString[commentLength] = '\0';
+			bXZip = ParseXZipCommentString(commentString);
 		}
-		else
+
+		if (!bXZip)
 		{
-			// wrong record
-			rec.nCentralDirectoryEntries_Total = 0;
+			// other writers keep every extra field in the central records
+			m_bCompatibleFormat = true;
 		}
 	}
-	Assert(bFoundEndOfCentralDirRecord);
 
 	// Make sure there are some files to parse
-	int numzipfiles = rec.nCentralDirectoryEntries_Total;
-	if (numzipfiles <= 0)
+	if (dir.m_nEntries == 0 || dir.m_nEntries > INT_MAX || dir.m_nOffset + dir.m_nSize > fileLen)
 	{
 		// No files
-		return;
+		return false;
 	}
 
-	buf.SeekGet(CUtlBuffer::SEEK_HEAD, rec.startOfCentralDirOffset);
+	int numzipfiles = (int)dir.m_nEntries;
+	buf.SeekGet(CUtlBuffer::SEEK_HEAD, (int)dir.m_nOffset);
+
+	// every entry is already in memory, a preload section buys nothing here
+	m_nPreloadSectionSize = 0;
 
-	// Allocate space for directory
-	TmpFileInfo_t* newfiles = new TmpFileInfo_t[numzipfiles];
-	Assert(newfiles);
+	// The central directory is mostly names, size the directory from it in one go
+	m_Directory.Reserve(numzipfiles, Max(0, (int)dir.m_nSize - numzipfiles * (int)sizeof(ZIP_FileHeader)));
+	m_Entries.EnsureCapacity(m_Entries.Count() + numzipfiles);
 
 	// build directory
 	int i;
-	for (i = 0; i < rec.nCentralDirectoryEntries_Total; i++)
+	for (i = 0; i < numzipfiles; i++)
 	{
 		ZIP_FileHeader zipFileHeader;
 		buf.GetObjects(&zipFileHeader);
 		Assert(zipFileHeader.signature == PKID(1, 2));
-		if (zipFileHeader.compressionMethod != IZip::eCompressionType_None &&
-			zipFileHeader.compressionMethod != IZip::eCompressionType_LZMA)
+		if (!CXZipCodec::CanDecode(zipFileHeader.compressionMethod))
 		{
 			Assert(false);
 			Warning("Opening ZIP file with unsupported compression type\n");
 		}
 
 		char tmpString[1024] = { 0 };
-		buf.Get(tmpString, Min((unsigned int)zipFileHeader.fileNameLength, (unsigned int)sizeof(tmpString)));
-		Q_strlower(tmpString);
+		buf.Get(tmpString, Min((unsigned int)zipFileHeader.fileNameLength, (unsigned int)sizeof(tmpString) - 1));
+
+		uint64 nCompressedSize = zipFileHeader.compressedSize;
+		uint64 nUncompressedSize = zipFileHeader.uncompressedSize;
+		uint64 nLocalHeaderOffset = zipFileHeader.relativeOffsetOfLocalHeader;
+		int nZip64Length;
+		int nExtraRead = ReadZip64ExtraField(buf, zipFileHeader, nCompressedSize, nUncompressedSize, nLocalHeaderOffset, nZip64Length);
+		if (nExtraRead < 0 || nCompressedSize > INT_MAX || nUncompressedSize > INT_MAX)
+		{
+			Warning("Zip: Unsupported ZIP64 entry %s\n", tmpString);
+			Clear();
+			return false;
+		}
+
+		// can determine actual filepos, assuming a well formed zip
+		int id = AddEntry(tmpString);
+		m_Directory.m_CompressedSizes[id] = (int)nCompressedSize;
+		m_Directory.m_UncompressedSizes[id] = (int)nUncompressedSize;
+		m_Directory.m_CRCs[id] = zipFileHeader.crc32;
+		m_Directory.m_CompressionTypes[id] = (unsigned char)zipFileHeader.compressionMethod;
+		m_Directory.m_DataOffsets[id] = GetEntryDataOffset(pArchive, NULL, fileLen, zipFileHeader, nLocalHeaderOffset, nZip64Length, bXZip);
+
+		int nextOffset;
+		if (m_bCompatibleFormat)
+		{
+			nextOffset = zipFileHeader.extraFieldLength - nExtraRead + zipFileHeader.fileCommentLength;
+		}
+		else
+		{
+			nextOffset = 0;
+		}
+		buf.SeekGet(CUtlBuffer::SEEK_CURRENT, nextOffset);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Mount pak file from disk
+//-----------------------------------------------------------------------------
+HANDLE CXZipFile::OpenFromDisk(const char* pFilename, bool bMapArchive)
+{
+	// Throw away any previous mapping
+	CloseArchiveView();
+
+	HANDLE hFile = CreateFile(pFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		// not found
+		return NULL;
+	}
+
+	if (bMapArchive)
+	{
+		m_pArchiveView = (const unsigned char*)CWin32File::MapFile(hFile, m_hArchiveMapping, m_nArchiveViewSize);
+		if (!m_pArchiveView)
+		{
+			Warning("Zip: Unable to map %s, falling back to file reads\n", pFilename);
+		}
+	}
+
+	uint64 fileLen = CWin32File::FileSeek(hFile, 0, FILE_END);
+	CWin32File::FileSeek(hFile, 0, FILE_BEGIN);
+	if (fileLen == (uint64)-1 || fileLen < sizeof(ZIP_EndOfCentralDirRecord))
+	{
+		// bad format
+		CloseArchiveView();
+		CloseHandle(hFile);
+		return NULL;
+	}
+
+	// need to get the central dir
+	ZIP_EndOfCentralDirRecord rec = { 0 };
+	m_nPreloadSectionSize = 0;
+
+	// The record is followed by at most a 64k comment, so one read of that
+	// tail (or the mapping) is enough to find it
+	unsigned int tailSize = (unsigned int)Min(fileLen, (uint64)(sizeof(ZIP_EndOfCentralDirRecord) + 0xFFFF));
+	uint64 tailOffset = fileLen - tailSize;
+	CUtlBuffer tailBuff;
+	const unsigned char* pTail;
+	if (m_pArchiveView)
+	{
+		pTail = m_pArchiveView + (size_t)tailOffset;
+	}
+	else
+	{
+		tailBuff.EnsureCapacity(tailSize);
+		if (!CWin32File::FileReadAt(hFile, tailOffset, tailBuff.Base(), tailSize))
+		{
+			// bad format
+			CloseArchiveView();
+			CloseHandle(hFile);
+			return NULL;
+		}
+		pTail = (const unsigned char*)tailBuff.Base();
+	}
+
+	unsigned int nSignature = PKID(5, 6);
+	m_Swap.SwapBufferToTargetEndian(&nSignature);
+
+	CentralDirInfo_t dir = { 0, 0, 0 };
+	bool bXZip = false;
+	int recordOffset = FindEndOfCentralDirRecord(pTail, tailSize, nSignature);
+	if (recordOffset >= 0)
+	{
+		memcpy(&rec, pTail + recordOffset, sizeof(rec));
+		m_Swap.SwapFieldsToTargetEndian(&rec);
+
+		if (!ReadCentralDirInfo(rec, m_pArchiveView, hFile, tailOffset + recordOffset, dir))
+		{
+			// bad format
+			CloseArchiveView();
+			CloseHandle(hFile);
+			return NULL;
+		}
+
+		// Set any xzip configuration
+		if (rec.commentLength)
+		{
+			char commentString[128];
+			int commentLength = Min((unsigned int)rec.commentLength, (unsigned int)sizeof(commentString));
+			commentLength = Min(commentLength, (int)(tailSize - recordOffset - sizeof(rec)));
+			memcpy(commentString, pTail + recordOffset + sizeof(rec), commentLength);
+			if (commentLength == sizeof(commentString))
+				--commentLength;
+			commentString[commentLength] = '\0';
+			bXZip = ParseXZipCommentString(commentString);
+		}
+
+		if (!bXZip)
+		{
+			// other writers keep every extra field in the central records
+			m_bCompatibleFormat = true;
+		}
+	}
+
+	// Make sure there are some files to parse, and that the directory fits in memory
+	if (dir.m_nEntries == 0 || dir.m_nEntries > INT_MAX || dir.m_nSize > INT_MAX || dir.m_nOffset + dir.m_nSize > fileLen)
+	{
+		// No files
+		CloseArchiveView();
+		CloseHandle(hFile);
+		return NULL;
+	}
+
+	int numZipFiles = (int)dir.m_nEntries;
+	int centralDirSize = (int)dir.m_nSize;
+
+	// read entire central dir into memory
+	CUtlBuffer zipDirBuff(0, centralDirSize, 0);
+	zipDirBuff.ActivateByteSwapping(m_Swap.IsSwappingBytes());
+	if (!CWin32File::FileReadAt(hFile, dir.m_nOffset, zipDirBuff.Base(), centralDirSize))
+	{
+		// bad format
+		CloseArchiveView();
+		CloseHandle(hFile);
+		return NULL;
+	}
+	zipDirBuff.SeekPut(CUtlBuffer::SEEK_HEAD, centralDirSize);
+
+	// build directory
+	m_Directory.Reserve(numZipFiles, Max(0, centralDirSize - numZipFiles * (int)sizeof(ZIP_FileHeader)));
+	m_Entries.EnsureCapacity(m_Entries.Count() + numZipFiles);
+	int firstID = m_Directory.Count();
+	for (int i = 0; i < numZipFiles; i++)
+	{
+		ZIP_FileHeader zipFileHeader;
+		zipDirBuff.GetObjects(&zipFileHeader);
+
+		if (zipFileHeader.signature != PKID(1, 2)
+			|| !CXZipCodec::CanDecode(zipFileHeader.compressionMethod))
+		{
+			// bad contents
+			CloseArchiveView();
+			CloseHandle(hFile);
+			return NULL;
+		}
+
+		char fileName[1024];
+		int fileNameLength = Min((int)zipFileHeader.fileNameLength, (int)sizeof(fileName) - 1);
+		zipDirBuff.Get(fileName, fileNameLength);
+		zipDirBuff.SeekGet(CUtlBuffer::SEEK_CURRENT, zipFileHeader.fileNameLength - fileNameLength);
+		fileName[fileNameLength] = '\0';
+
+		uint64 nCompressedSize = zipFileHeader.compressedSize;
+		uint64 nUncompressedSize = zipFileHeader.uncompressedSize;
+		uint64 nLocalHeaderOffset = zipFileHeader.relativeOffsetOfLocalHeader;
+		int nZip64Length;
+		int nExtraRead = ReadZip64ExtraField(zipDirBuff, zipFileHeader, nCompressedSize, nUncompressedSize, nLocalHeaderOffset, nZip64Length);
+		if (nExtraRead < 0 || nCompressedSize > INT_MAX || nUncompressedSize > INT_MAX)
+		{
+			// entries stay below 2 GB, only the archive may be larger
+			Warning("Zip: Unsupported ZIP64 entry %s\n", fileName);
+			CloseArchiveView();
+			CloseHandle(hFile);
+			return NULL;
+		}
 
 		// can determine actual filepos, assuming a well formed zip
-		newfiles[i].m_Name = tmpString;
-		newfiles[i].filelen = zipFileHeader.compressedSize;
-		newfiles[i].uncompressedLen = zipFileHeader.uncompressedSize;
-		newfiles[i].crc32 = zipFileHeader.crc32;
-		newfiles[i].filepos = zipFileHeader.relativeOffsetOfLocalHeader +
-			sizeof(ZIP_LocalFileHeader) +
-			zipFileHeader.fileNameLength +
-			zipFileHeader.extraFieldLength;
-		newfiles[i].compressionType = (IZip::eCompressionType)zipFileHeader.compressionMethod;
+		int id = AddEntry(fileName);
+		m_Directory.m_CompressedSizes[id] = (int)nCompressedSize;
+		m_Directory.m_UncompressedSizes[id] = (int)nUncompressedSize;
+		m_Directory.m_CRCs[id] = zipFileHeader.crc32;
+		m_Directory.m_CompressionTypes[id] = (unsigned char)zipFileHeader.compressionMethod;
+		m_Directory.m_DataOffsets[id] = GetEntryDataOffset(m_pArchiveView, hFile, fileLen, zipFileHeader, nLocalHeaderOffset, nZip64Length, bXZip);
 
 		int nextOffset;
 		if (m_bCompatibleFormat)
 		{
-			nextOffset = zipFileHeader.extraFieldLength + zipFileHeader.fileCommentLength;
+			nextOffset = zipFileHeader.extraFieldLength - nExtraRead + zipFileHeader.fileCommentLength;
 		}
 		else
 		{
 			nextOffset = 0;
 		}
-		buf.SeekGet(CUtlBuffer::SEEK_CURRENT, nextOffset);
+
+		zipDirBuff.SeekGet(CUtlBuffer::SEEK_CURRENT, nextOffset);
+	}
+
+	// the preload section follows the records, it came in with the same read
+	if (m_nPreloadSectionSize)
+	{
+		LoadPreloadSection(zipDirBuff, firstID, numZipFiles);
+	}
+
+	// the positional reads above moved the file pointer, hand it back at the start
+	CWin32File::FileSeek(hFile, 0, FILE_BEGIN);
+	return hFile;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Picks up the preload section at the get position of the central
+//			directory buffer. Entries firstID.. are in central directory order.
+//-----------------------------------------------------------------------------
+void CXZipFile::LoadPreloadSection(CUtlBuffer& buf, int firstID, int numEntries)
+{
+	unsigned int tableSize = sizeof(ZIP_PreloadHeader) + numEntries * sizeof(ZIP_PreloadDirectoryEntry);
+	if (m_nPreloadSectionSize < tableSize ||
+		m_nPreloadSectionSize > (unsigned int)(buf.TellPut() - buf.TellGet()))
+	{
+		Warning("Zip: Ignoring truncated preload section\n");
+		return;
+	}
+
+	ZIP_PreloadHeader hdr;
+	buf.GetObjects(&hdr);
+	if (hdr.Version != XZIP_PRELOAD_VERSION || hdr.DirectoryEntries != (unsigned int)numEntries)
+	{
+		Warning("Zip: Ignoring unknown preload section\n");
+		return;
+	}
+
+	unsigned int dataSize = m_nPreloadSectionSize - tableSize;
+	unsigned int dataBase = m_PreloadData.Count();
+	for (int i = 0; i < numEntries; i++)
+	{
+		ZIP_PreloadDirectoryEntry entry;
+		buf.GetObjects(&entry);
+
+		int id = firstID + i;
+		if (!entry.Length ||
+			entry.Length > (unsigned int)m_Directory.m_CompressedSizes[id] ||
+			entry.Length > dataSize || entry.DataOffset > dataSize - entry.Length)
+		{
+			continue;
+		}
+
+		m_Directory.m_PreloadOffsets[id] = dataBase + entry.DataOffset;
+		m_Directory.m_PreloadLengths[id] = entry.Length;
+	}
+
+	m_PreloadData.AddMultipleToTail(dataSize);
+	buf.Get(m_PreloadData.Base() + dataBase, dataSize);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Number of leading payload bytes of an entry that go into the
+//			preload section when saving
+//-----------------------------------------------------------------------------
+unsigned int CXZipFile::GetPreloadLength(int id)
+{
+	unsigned int nCompressedSize = m_Directory.m_CompressedSizes[id];
+	if (!m_nPreloadSize || !nCompressedSize)
+	{
+		return 0;
+	}
+
+	if (m_Directory.m_CompressionTypes[id] == IZip::eCompressionType_None)
+	{
+		return Min(m_nPreloadSize, nCompressedSize);
+	}
+
+	// a compressed prefix is no use on its own
+	return (nCompressedSize <= m_nPreloadSize) ? nCompressedSize : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Locates the central directory. When the end of central dir record
+//			has a saturated field the real values come from the ZIP64 record,
+//			found through the locator just in front of it.
+// Input  : pArchive - whole archive in memory, NULL to read through hFile
+//			nRecordOffset - archive offset of the end of central dir record
+//-----------------------------------------------------------------------------
+bool CXZipFile::ReadCentralDirInfo(const ZIP_EndOfCentralDirRecord& rec, const unsigned char* pArchive, HANDLE hFile, uint64 nRecordOffset, CentralDirInfo_t& dir)
+{
+	dir.m_nEntries = rec.nCentralDirectoryEntries_Total;
+	dir.m_nSize = rec.centralDirectorySize;
+	dir.m_nOffset = rec.startOfCentralDirOffset;
+
+	if (rec.nCentralDirectoryEntries_Total != 0xFFFF &&
+		rec.centralDirectorySize != 0xFFFFFFFF &&
+		rec.startOfCentralDirOffset != 0xFFFFFFFF)
+	{
+		// plain zip
+		return true;
+	}
+
+	auto readAt = [&](uint64 offset, void* pDest, unsigned int size) -> bool
+	{
+		if (pArchive)
+		{
+			memcpy(pDest, pArchive + (size_t)offset, size);
+			return true;
+		}
+		return CWin32File::FileReadAt(hFile, offset, pDest, size);
+	};
+
+	// the record and its locator both sit ahead of the classic record
+	ZIP64_EndOfCentralDirLocator locator;
+	ZIP64_EndOfCentralDirRecord rec64;
+	if (nRecordOffset < sizeof(locator) + sizeof(rec64) || !readAt(nRecordOffset - sizeof(locator), &locator, sizeof(locator)))
+	{
+		Warning("Zip: Missing ZIP64 end of central directory locator\n");
+		return false;
+	}
+	SwapZip64Fields(m_Swap, locator);
+
+	if (locator.signature != PKID(6, 7) ||
+		locator.zip64RecordOffset > nRecordOffset - sizeof(locator) - sizeof(rec64) ||
+		!readAt(locator.zip64RecordOffset, &rec64, sizeof(rec64)))
+	{
+		Warning("Zip: Bad ZIP64 end of central directory locator\n");
+		return false;
+	}
+	SwapZip64Fields(m_Swap, rec64);
+
+	if (rec64.signature != PKID(6, 6))
+	{
+		Warning("Zip: Bad ZIP64 end of central directory record\n");
+		return false;
+	}
+
+	dir.m_nEntries = rec64.nCentralDirectoryEntries_Total;
+	dir.m_nSize = rec64.centralDirectorySize;
+	dir.m_nOffset = rec64.startOfCentralDirOffset;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Picks the 64 bit values out of the ZIP64 extended information field
+//			of a central directory record, the buffer is at its extra field.
+//			The extra field records are walked and the ones other than ZIP64
+//			skipped, an XZP2 pak only stores the ZIP64 field there though.
+// Output : Extra field bytes consumed, -1 if a saturated value has no ZIP64
+//			field. nZip64Length receives the size of that field.
+//-----------------------------------------------------------------------------
+int CXZipFile::ReadZip64ExtraField(CUtlBuffer& buf, const ZIP_FileHeader& hdr, uint64& nCompressedSize, uint64& nUncompressedSize, uint64& nLocalHeaderOffset, int& nZip64Length)
+{
+	nZip64Length = 0;
+
+	// the field holds exactly the values that are saturated in the header, in this order
+	uint64* pFields[3];
+	int numFields = 0;
+	if (hdr.uncompressedSize == 0xFFFFFFFF)
+	{
+		pFields[numFields++] = &nUncompressedSize;
+	}
+	if (hdr.compressedSize == 0xFFFFFFFF)
+	{
+		pFields[numFields++] = &nCompressedSize;
+	}
+	if (hdr.relativeOffsetOfLocalHeader == 0xFFFFFFFF)
+	{
+		pFields[numFields++] = &nLocalHeaderOffset;
+	}
+
+	if (!numFields)
+	{
+		return 0;
+	}
+
+	int nConsumed = 0;
+	while (nConsumed + 4 <= hdr.extraFieldLength)
+	{
+		unsigned short headerID;
+		unsigned short dataSize;
+		buf.Get(&headerID, sizeof(headerID));
+		buf.Get(&dataSize, sizeof(dataSize));
+		m_Swap.SwapBufferToTargetEndian(&headerID);
+		m_Swap.SwapBufferToTargetEndian(&dataSize);
+		nConsumed += sizeof(headerID) + sizeof(dataSize);
+
+		if (nConsumed + dataSize > hdr.extraFieldLength)
+		{
+			// not a record, the rest is padding
+			break;
+		}
+
+		if (headerID == ZIP64_EXTRA_FIELD_ID && numFields * (int)sizeof(uint64) <= dataSize)
+		{
+			for (int i = 0; i < numFields; i++)
+			{
+				buf.Get(pFields[i], sizeof(uint64));
+				m_Swap.SwapBufferToTargetEndian(pFields[i]);
+			}
+
+			// skip what is left (the disk number)
+			buf.SeekGet(CUtlBuffer::SEEK_CURRENT, dataSize - numFields * (int)sizeof(uint64));
+			nZip64Length = sizeof(headerID) + sizeof(dataSize) + dataSize;
+			return nConsumed + dataSize;
+		}
+
+		if (!m_bCompatibleFormat)
+		{
+			// XZP2 records have nothing but the ZIP64 field
+			break;
+		}
+
+		buf.SeekGet(CUtlBuffer::SEEK_CURRENT, dataSize);
+		nConsumed += dataSize;
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Offset of the data of an entry. SaveDirectory gives the local
+//			header the central extra field minus the ZIP64 field, other
+//			writers don't, so their local headers are read.
+//-----------------------------------------------------------------------------
+uint64 CXZipFile::GetEntryDataOffset(const unsigned char* pArchive, HANDLE hFile, uint64 nArchiveSize, const ZIP_FileHeader& hdr, uint64 nLocalHeaderOffset, int nZip64Length, bool bXZip)
+{
+	if (!bXZip && nLocalHeaderOffset + sizeof(ZIP_LocalFileHeader) <= nArchiveSize)
+	{
+		ZIP_LocalFileHeader localHdr;
+		bool bRead;
+		if (pArchive)
+		{
+			memcpy(&localHdr, pArchive + (size_t)nLocalHeaderOffset, sizeof(localHdr));
+			bRead = true;
+		}
+		else
+		{
+			bRead = CWin32File::FileReadAt(hFile, nLocalHeaderOffset, &localHdr, sizeof(localHdr));
+		}
+
+		if (bRead)
+		{
+			m_Swap.SwapFieldsToTargetEndian(&localHdr);
+			if (localHdr.signature == PKID(3, 4))
+			{
+				return nLocalHeaderOffset + sizeof(ZIP_LocalFileHeader) + localHdr.fileNameLength + localHdr.extraFieldLength;
+			}
+		}
+	}
+
+	return nLocalHeaderOffset +
+		sizeof(ZIP_LocalFileHeader) +
+		hdr.fileNameLength +
+		hdr.extraFieldLength - nZip64Length;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a new lump, or overwrites existing one
+// Input  : *relativename -
+//			*data -
+//			length -
+//-----------------------------------------------------------------------------
+void CXZipFile::AddBuffer(const char* relativename, void* data, int length, bool bTextMode, IZip::eCompressionType compressionType)
+{
+	PreparedBuffer_t prepared;
+	if (PrepareBuffer(data, length, bTextMode, compressionType, prepared))
+	{
+		CommitBuffer(relativename, prepared);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Adds a batch of lumps, compressing them over several threads.
+//			Entries are committed in the order given, so the result is the
+//			same as calling AddBuffer for each entry in turn.
+//-----------------------------------------------------------------------------
+void CXZipFile::AddBuffers(const AddBufferInfo_t* pBuffers, int nBuffers, int nThreads)
+{
+	if (nBuffers <= 0)
+	{
+		return;
+	}
+
+	int nWorkers = Min((nThreads > 0) ? nThreads : CJobPool::GetDefaultThreadCount(), nBuffers);
+
+	// reorder window, workers run at most this many entries ahead of the
+	// commits so only a few entries worth of compressed data is alive
+	int nWindow = nWorkers * 4;
+	PreparedBuffer_t* pPrepared = new PreparedBuffer_t[nWindow];
+	std::vector<char> ready(nWindow, 0);
+
+	std::mutex lock;
+	std::condition_variable readyChanged;
+	std::condition_variable windowMoved;
+	int nNextJob = 0;
+	int nNextCommit = 0;
+
+	// workers live for the whole batch and take the next entry in the window
+	std::vector<std::thread> workers;
+	for (int i = 0; i < nWorkers; i++)
+	{
+		workers.emplace_back([&]
+		{
+			for (;;)
+			{
+				int job;
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					windowMoved.wait(guard, [&] { return nNextJob >= nBuffers || nNextJob < nNextCommit + nWindow; });
+					if (nNextJob >= nBuffers)
+					{
+						return;
+					}
+					job = nNextJob++;
+				}
+
+				// the slot was committed and recycled before the window got here
+				const AddBufferInfo_t& info = pBuffers[job];
+				PrepareBuffer(info.m_pData, info.m_nLength, info.m_bTextMode, info.m_eCompressionType, pPrepared[job % nWindow]);
+
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					ready[job % nWindow] = 1;
+				}
+				readyChanged.notify_one();
+			}
+		});
+	}
+
+	// commit in order, as soon as the next entry is ready
+	for (int i = 0; i < nBuffers; i++)
+	{
+		int nSlot = i % nWindow;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			readyChanged.wait(guard, [&] { return ready[nSlot] != 0; });
+		}
+
+		if (pPrepared[nSlot].m_bValid)
+		{
+			CommitBuffer(pBuffers[i].m_pRelativeName, pPrepared[nSlot]);
+		}
+
+		// recycle
+		pPrepared[nSlot].m_TextTransform.Purge();
+		pPrepared[nSlot].m_CompressionTransform.Purge();
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			ready[nSlot] = 0;
+			nNextCommit = i + 1;
+		}
+		windowMoved.notify_all();
+	}
+
+	for (auto& thread : workers)
+	{
+		thread.join();
+	}
+
+	delete[] pPrepared;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Text transform, CRC and compression of a lump. May run on any
+//			thread, the member state it touches is:
+//			- m_ContentTable, guarded by its own lock
+//			- m_Metrics, sharded relaxed atomics
+//			- settings such as m_bDeduplicate, only read (not set while adding)
+//-----------------------------------------------------------------------------
+bool CXZipFile::PrepareBuffer(void* data, int length, bool bTextMode, IZip::eCompressionType compressionType, PreparedBuffer_t& prepared)
+{
+	int outLength = length;
+	int uncompressedLength = length;
+	void* outData = data;
+	CUtlBuffer& textTransform = prepared.m_TextTransform;
+
+	prepared.m_bValid = false;
+
+	if (!CXZipCodec::CanEncode(compressionType))
+	{
+		Error("Calling AddBuffer with unknown compression type\n");
+		return false;
+	}
+
+	if (bTextMode)
+	{
+		int textLen = CXZipText::GetExpandedLength((const char*)outData, outLength);
+		textTransform.EnsureCapacity(textLen);
+		CXZipText::Expand((char*)textTransform.Base(), (char*)outData, textLen, outLength);
+
+		outData = (void*)textTransform.Base();
+		outLength = textLen;
+		uncompressedLength = textLen;
+	}
+
+	// uncompressed data final at this point (CRC is before compression)
+	CRC32_t zipCRC = CXZipCRC::ProcessSingleBuffer(outData, outLength);
+
+	prepared.m_nUncompressedLength = uncompressedLength;
+	prepared.m_CRC = zipCRC;
+	prepared.m_bHasContentKey = false;
+	prepared.m_bSharedPayload = false;
+	if (m_bDeduplicate && outLength > 0)
+	{
+		prepared.m_ContentKey.Compute(outData, outLength, zipCRC, compressionType);
+		prepared.m_bHasContentKey = true;
+		if (!m_ContentTable.Claim(prepared.m_ContentKey))
+		{
+			// someone else stores these bytes, no need to compress them again.
+			// Keep them as they are in case that entry never gets committed.
+			prepared.m_pData = outData;
+			prepared.m_nLength = outLength;
+			prepared.m_eCompressionType = compressionType;
+			prepared.m_bSharedPayload = true;
+			prepared.m_bValid = true;
+
+			m_Metrics.Add(XZIP_COUNTER_ADDS);
+			m_Metrics.Add(XZIP_COUNTER_ADD_BYTES_IN, uncompressedLength);
+			m_Metrics.Add(XZIP_COUNTER_ADD_SHARED);
+			return true;
+		}
+	}
+
+	if (!EncodeBuffer(outData, outLength, compressionType, prepared))
+	{
+		if (prepared.m_bHasContentKey)
+		{
+			// let the next entry with these bytes have a go at them
+			m_ContentTable.Release(prepared.m_ContentKey);
+		}
+		return false;
+	}
+
+	m_Metrics.Add(XZIP_COUNTER_ADDS);
+	m_Metrics.Add(XZIP_COUNTER_ADD_BYTES_IN, uncompressedLength);
+
+	prepared.m_bValid = true;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compresses the final uncompressed data of a lump, unless the
+//			policy says to store it
+//-----------------------------------------------------------------------------
+bool CXZipFile::EncodeBuffer(void* data, int length, IZip::eCompressionType compressionType, PreparedBuffer_t& prepared)
+{
+	void* outData = data;
+	int outLength = length;
+	CUtlBuffer& compressionTransform = prepared.m_CompressionTransform;
+
+	if (compressionType != IZip::eCompressionType_None && !m_CompressionPolicy.ShouldCompress(outData, outLength))
+	{
+		// looks incompressible, do not spend the time
+		compressionType = IZip::eCompressionType_None;
+		m_Metrics.Add(XZIP_COUNTER_ADD_STORED);
+	}
+	else if (compressionType != IZip::eCompressionType_None)
+	{
+		uint64 nStart = m_Metrics.IsEnabled() ? CXZipMetrics::Now() : 0;
+		if (!CXZipCodec::Compress(compressionType, m_nCompressionLevel, outData, outLength, compressionTransform))
+		{
+			Warning("ZipFile: %s compression failed\n", CXZipCodec::GetName(compressionType));
+			return false;
+		}
+
+		int compressedLength = compressionTransform.TellPut();
+		if (nStart)
+		{
+			m_Metrics.AddEncode(compressionType, CXZipMetrics::Now() - nStart, outLength, compressedLength);
+		}
+
+		if (!m_CompressionPolicy.IsWorthwhile(outLength, compressedLength))
+		{
+			// not enough of a gain, store it and keep the zero copy read path
+			compressionType = IZip::eCompressionType_None;
+			m_Metrics.Add(XZIP_COUNTER_ADD_STORED);
+		}
+		else
+		{
+			outData = (void*)compressionTransform.Base();
+			outLength = compressedLength;
+			// (Not updating uncompressedLength)
+		}
+	}
+
+	m_Metrics.Add(XZIP_COUNTER_ADD_BYTES_OUT, outLength);
+
+	prepared.m_pData = outData;
+	prepared.m_nLength = outLength;
+	prepared.m_eCompressionType = compressionType;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Inserts a prepared lump into the directory (and disk cache)
+//-----------------------------------------------------------------------------
+void CXZipFile::CommitBuffer(const char* relativename, PreparedBuffer_t& prepared, CUtlBuffer* pSource)
+{
+	// Lower case only
+	char name[512];
+	Q_strcpy(name, relativename);
+	Q_strlower(name);
+
+	// See if entry is in list already, otherwise create a new one
+	int id = m_Directory.Find(name);
+	if (id < 0)
+	{
+		id = AddEntry(name);
+	}
+
+	// a cached decode of the old data is stale now
+	m_EntryCache.Invalidate();
+
+	// the claim of PrepareBuffer ends here, whether or not this entry keeps the bytes
+	bool bClaimed = prepared.m_bHasContentKey && !prepared.m_bSharedPayload;
+	int holder = prepared.m_bHasContentKey ? m_ContentTable.FindHolder(prepared.m_ContentKey) : -1;
+	if (holder == id)
+	{
+		// added again with the same bytes, keep the payload we have
+		if (bClaimed)
+		{
+			m_ContentTable.Release(prepared.m_ContentKey);
+		}
+		return;
+	}
+
+	// Throw away old data, another entry may take it over
+	DropPayload(id);
+	CZipEntry* update = &m_Entries[id];
+
+	if (prepared.m_bHasContentKey && holder < 0 && prepared.m_bSharedPayload)
+	{
+		// whoever claimed the content never made it into the zip, so this
+		// entry stores the bytes after all
+		if (!EncodeBuffer(prepared.m_pData, prepared.m_nLength, prepared.m_eCompressionType, prepared))
+		{
+			EncodeBuffer(prepared.m_pData, prepared.m_nLength, IZip::eCompressionType_None, prepared);
+		}
+		prepared.m_bSharedPayload = false;
+	}
+
+	void* outData = prepared.m_pData;
+	int outLength = prepared.m_nLength;
+	IZip::eCompressionType compressionType = prepared.m_eCompressionType;
+
+	update->m_bHasContentKey = prepared.m_bHasContentKey;
+	if (prepared.m_bHasContentKey)
+	{
+		update->m_ContentKey = prepared.m_ContentKey;
+		if (holder >= 0)
+		{
+			// the payload is someone else's, which may have ended up stored
+			update->m_bSharedPayload = true;
+			compressionType = (IZip::eCompressionType)m_Directory.m_CompressionTypes[holder];
+			outLength = m_Directory.m_CompressedSizes[holder];
+		}
+		else
+		{
+			m_ContentTable.SetHolder(prepared.m_ContentKey, id);
+		}
+
+		if (bClaimed)
+		{
+			m_ContentTable.Release(prepared.m_ContentKey);
+		}
+	}
+
+	m_Directory.m_CompressionTypes[id] = (unsigned char)compressionType;
+	m_Directory.m_CompressedSizes[id] = outLength;
+	m_Directory.m_UncompressedSizes[id] = prepared.m_nUncompressedLength;
+	m_Directory.m_CRCs[id] = prepared.m_CRC;
+
+	if (outLength > 0 && !update->m_bSharedPayload)
+	{
+		if (m_SpillArena.IsOpen())
+		{
+			update->m_DiskCacheOffset = m_SpillArena.Append(outData, outLength);
+			update->m_bSpilled = (update->m_DiskCacheOffset != (uint64)-1);
+		}
+		else
+		{
+			// adopt the payload if it sits in a buffer we may take, copy otherwise
+			CUtlBuffer* pOwner = NULL;
+			if (outData == prepared.m_CompressionTransform.Base())
+			{
+				pOwner = &prepared.m_CompressionTransform;
+			}
+			else if (outData == prepared.m_TextTransform.Base())
+			{
+				pOwner = &prepared.m_TextTransform;
+			}
+			else if (pSource && outData == pSource->Base())
+			{
+				pOwner = pSource;
+			}
+
+			if (pOwner && !pOwner->IsExternallyAllocated())
+			{
+				update->m_pData = pOwner->DetachMemory();
+				prepared.m_pData = NULL;
+			}
+			else
+			{
+				update->m_pData = malloc(outLength);
+				memcpy(update->m_pData, outData, outLength);
+			}
+			update->m_nDataSize = outLength;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Frees the payload of an entry that gets replaced or removed. The
+//			holder of shared content hands its payload to an entry sharing
+//			it, if any is left.
+//-----------------------------------------------------------------------------
+void CXZipFile::DropPayload(int id)
+{
+	CZipEntry& e = m_Entries[id];
+	if (e.m_bHasContentKey && !e.m_bSharedPayload && m_ContentTable.FindHolder(e.m_ContentKey) == id)
+	{
+		int heir = -1;
+		for (int i = 0; i < m_Entries.Count(); i++)
+		{
+			if (i != id && m_Entries[i].m_bSharedPayload && m_Entries[i].m_ContentKey == e.m_ContentKey)
+			{
+				heir = i;
+				break;
+			}
+		}
+
+		m_ContentTable.SetHolder(e.m_ContentKey, heir);
+		if (heir >= 0)
+		{
+			// sharers already carry the sizes and codec of the payload
+			CZipEntry& to = m_Entries[heir];
+			to.m_pData = e.m_pData;
+			to.m_nDataSize = e.m_nDataSize;
+			to.m_DiskCacheOffset = e.m_DiskCacheOffset;
+			to.m_bSpilled = e.m_bSpilled;
+			to.m_bSharedPayload = false;
+			e.m_pData = NULL;
+		}
+	}
+
+	if (e.m_pData)
+	{
+		free(e.m_pData);
+	}
+	e.m_pData = NULL;
+	e.m_nDataSize = 0;
+	e.m_bSpilled = false;
+	e.m_bHasContentKey = false;
+	e.m_bSharedPayload = false;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Groups the entries sharing content (see SetDeduplicate). A group
+//			stores its payload once, behind the local header of the member
+//			with the longest name (ties go to the first name in byte order),
+//			so the others reach it through their own name length plus a non
+//			negative extra field. Only looks at the names, so the layout does
+//			not depend on which entry happened to compress the payload.
+// Output : Number of entries using another entry's local header,
+//			localHeaderOwners[id] = entry whose local header holds the data,
+//			payloadOwners[id] = entry holding the payload bytes
+//-----------------------------------------------------------------------------
+int CXZipFile::ResolveSharedPayloads(CUtlVector<int>& localHeaderOwners, CUtlVector<int>& payloadOwners) const
+{
+	int numEntries = m_Directory.Count();
+	localHeaderOwners.SetCount(numEntries);
+	payloadOwners.SetCount(numEntries);
+	for (int i = 0; i < numEntries; i++)
+	{
+		localHeaderOwners[i] = i;
+		payloadOwners[i] = i;
+	}
+
+	if (!m_bDeduplicate)
+	{
+		return 0;
+	}
+
+	auto isBetterLeader = [&](int a, int b) -> bool
+	{
+		int nLengthA = m_Directory.GetNameLength(a);
+		int nLengthB = m_Directory.GetNameLength(b);
+		if (nLengthA != nLengthB)
+		{
+			return nLengthA > nLengthB;
+		}
+		return V_strcmp(m_Directory.GetName(a), m_Directory.GetName(b)) < 0;
+	};
+
+	for (int i = 0; i < numEntries; i++)
+	{
+		if (!m_Entries[i].m_bSharedPayload)
+		{
+			continue;
+		}
+
+		// CommitBuffer and DropPayload keep a holder for every sharer
+		int holder = m_ContentTable.FindHolder(m_Entries[i].m_ContentKey);
+		Assert(holder >= 0 && holder != i);
+		if (holder < 0)
+		{
+			continue;
+		}
+
+		payloadOwners[i] = holder;
+		if (isBetterLeader(i, localHeaderOwners[holder]))
+		{
+			localHeaderOwners[holder] = i;
+		}
+	}
+
+	// localHeaderOwners of the holders has the leader of their group now
+	int numShared = 0;
+	for (int i = 0; i < numEntries; i++)
+	{
+		localHeaderOwners[i] = localHeaderOwners[payloadOwners[i]];
+		numShared += (localHeaderOwners[i] != i);
+	}
+
+	return numShared;
+}
+
+//-----------------------------------------------------------------------------
+// Reads a file from the zip
+//-----------------------------------------------------------------------------
+bool CXZipFile::ReadFile(const char* pRelativeName, bool bTextMode, CUtlBuffer& buf)
+{
+	return ReadFile(0, pRelativeName, bTextMode, buf);
+}
+
+//-----------------------------------------------------------------------------
+// Reads a file from the zip. Requires the zip file handle if this zip was loaded via OpenFromDisk
+//-----------------------------------------------------------------------------
+int CXZipFile::ReadFile(HANDLE hZipFile, const char* pRelativeName, bool bTextMode, CUtlBuffer& buf)
+{
+	int id = FindEntry(pRelativeName);
+	if (id < 0)
+	{
+		// not found
+		return 0;
+	}
+
+	return ReadEntry(hZipFile, id, bTextMode, buf);
+}
+
+//-----------------------------------------------------------------------------
+// Reads a file from the zip into a caller-provided buffer
+//-----------------------------------------------------------------------------
+bool CXZipFile::ReadFile(HANDLE hZipFile, const char* pRelativeName, bool bTextMode, void* pBuffer, int nBufferSize, int& nBytesWritten)
+{
+	nBytesWritten = 0;
+
+	int id = FindEntry(pRelativeName);
+	if (id < 0)
+	{
+		// not found
+		return false;
+	}
+
+	return ReadEntry(hZipFile, id, bTextMode, pBuffer, nBufferSize, nBytesWritten);
+}
+
+//-----------------------------------------------------------------------------
+// Reads a file from the zip by directory id. Safe to call concurrently.
+//-----------------------------------------------------------------------------
+int CXZipFile::ReadEntry(HANDLE hZipFile, int id, bool bTextMode, CUtlBuffer& buf)
+{
+	if (!m_Directory.IsValidEntry(id))
+	{
+		return 0;
+	}
+
+	// decode straight into the caller's buffer, after whatever it already holds
+	int nUncompressedSize = m_Directory.m_UncompressedSizes[id];
+	int nPut = buf.TellPut();
+	buf.SetBufferType(bTextMode, false);
+	buf.EnsureCapacity(nPut + nUncompressedSize + 1);
+
+	int nBytesWritten = 0;
+	if (!ReadEntry(hZipFile, id, bTextMode, (char*)buf.Base() + nPut, buf.Size() - nPut, nBytesWritten))
+	{
+		return 0;
+	}
+
+	// text data keeps its null terminator
+	buf.SeekPut(CUtlBuffer::SEEK_HEAD, nPut + nBytesWritten + (bTextMode ? 1 : 0));
+
+	return nUncompressedSize;
+}
+
+//-----------------------------------------------------------------------------
+// Reads a file from the zip by directory id into a caller-provided buffer.
+// Stored data is read (or copied) straight into the buffer and compressed data
+// is decoded straight into it, compressed input read from disk is fed to the
+// decoder through a fixed stack buffer. Safe to call concurrently.
+//-----------------------------------------------------------------------------
+bool CXZipFile::ReadEntry(HANDLE hZipFile, int id, bool bTextMode, void* pBuffer, int nBufferSize, int& nBytesWritten)
+{
+	CXZipReadTimer timer(m_Metrics);
+	nBytesWritten = 0;
+
+	if (!m_Directory.IsValidEntry(id))
+	{
+		return false;
+	}
+
+	int nUncompressedSize = m_Directory.m_UncompressedSizes[id];
+
+	// text data gets a null terminator
+	int nRequiredSize = nUncompressedSize + (bTextMode ? 1 : 0);
+	if (nBufferSize < nRequiredSize)
+	{
+		nBytesWritten = nRequiredSize;
+		return false;
+	}
+
+	if (m_EntryCache.IsEnabled() && m_Directory.m_CompressionTypes[id] != IZip::eCompressionType_None)
+	{
+		// decode once, later reads are a copy out of the cache
+		XZipCacheHandle_t data;
+		if (!GetCachedEntry(hZipFile, id, data))
+		{
+			return false;
+		}
+		memcpy(pBuffer, data->Base(), nUncompressedSize);
+	}
+	else
+	{
+		if (!ReadEntryData(hZipFile, id, pBuffer, nUncompressedSize))
+		{
+			return false;
+		}
+
+		// the CRC covers the data as stored, before any text transform
+		if (m_bVerifyCRC && !CheckEntryCRC(id, CXZipCRC::ProcessSingleBuffer(pBuffer, nUncompressedSize)))
+		{
+			return false;
+		}
+	}
+
+	nBytesWritten = nUncompressedSize;
+	if (bTextMode)
+	{
+		nBytesWritten = CXZipText::Collapse((char*)pBuffer, nUncompressedSize);
+		((char*)pBuffer)[nBytesWritten] = '\0';
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Shared decoded payload of an entry. Only compressed entries are cached,
+// stored ones are a copy out of the mapping anyway. Safe to call concurrently.
+//-----------------------------------------------------------------------------
+bool CXZipFile::GetCachedEntry(HANDLE hZipFile, int id, XZipCacheHandle_t& data)
+{
+	data.reset();
+
+	if (!m_Directory.IsValidEntry(id))
+	{
+		return false;
+	}
+
+	bool bCacheable = m_EntryCache.IsEnabled() && m_Directory.m_CompressionTypes[id] != IZip::eCompressionType_None;
+	if (bCacheable)
+	{
+		data = m_EntryCache.Find(id);
+		m_Metrics.Add(data ? XZIP_COUNTER_CACHE_HITS : XZIP_COUNTER_CACHE_MISSES);
+		if (data)
+		{
+			// verified when it went in
+			return true;
+		}
+	}
+
+	int nUncompressedSize = m_Directory.m_UncompressedSizes[id];
+	std::shared_ptr<CXZipCachedData> pDecoded = std::make_shared<CXZipCachedData>(nUncompressedSize);
+	if (!pDecoded->IsValid() || !ReadEntryData(hZipFile, id, pDecoded->Base(), nUncompressedSize))
+	{
+		return false;
+	}
+
+	if (m_bVerifyCRC && !CheckEntryCRC(id, CXZipCRC::ProcessSingleBuffer(pDecoded->Base(), nUncompressedSize)))
+	{
+		return false;
+	}
+
+	data = pDecoded;
+	if (bCacheable)
+	{
+		m_EntryCache.Insert(id, data);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Reads the leading bytes of an entry, raw. Stored entries whose prefix is in
+// the preload section need no I/O at all.
+//-----------------------------------------------------------------------------
+bool CXZipFile::ReadFilePrefix(HANDLE hZipFile, const char* pRelativeName, void* pBuffer, int nBufferSize, int& nBytesWritten)
+{
+	nBytesWritten = 0;
+
+	int id = FindEntry(pRelativeName);
+	if (id < 0)
+	{
+		// not found
+		return false;
+	}
+
+	return ReadEntryPrefix(hZipFile, id, pBuffer, nBufferSize, nBytesWritten);
+}
+
+bool CXZipFile::ReadEntryPrefix(HANDLE hZipFile, int id, void* pBuffer, int nBufferSize, int& nBytesWritten)
+{
+	nBytesWritten = 0;
+
+	if (!m_Directory.IsValidEntry(id))
+	{
+		return false;
+	}
+
+	int nBytes = Min(Max(nBufferSize, 0), m_Directory.m_UncompressedSizes[id]);
+	if (!ReadEntryData(hZipFile, id, pBuffer, nBytes))
+	{
+		return false;
+	}
+
+	nBytesWritten = nBytes;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Finds the payload of an entry in memory, in the preload section or
+//			in the mapping. pData is left NULL if it has to be read through the
+//			file handle.
+//-----------------------------------------------------------------------------
+bool CXZipFile::GetEntrySource(HANDLE hZipFile, int id, const unsigned char*& pData)
+{
+	int nCompressedSize = m_Directory.m_CompressedSizes[id];
+	uint64 nDataOffset = m_Directory.m_DataOffsets[id];
+
+	pData = (const unsigned char*)m_Entries[id].m_pData;
+	if (!pData && nCompressedSize > 0 && m_Directory.m_PreloadLengths[id] == (unsigned int)nCompressedSize)
+	{
+		// the whole payload was preloaded
+		pData = m_PreloadData.Base() + m_Directory.m_PreloadOffsets[id];
+	}
+	else if (!pData && m_pArchiveView)
+	{
+		// read straight from the mapping, no staging copy
+		if ((unsigned int)nCompressedSize > m_nArchiveViewSize ||
+			nDataOffset > m_nArchiveViewSize - nCompressedSize)
+		{
+			Warning("Zip: Entry %s is out of bounds\n", m_Directory.GetName(id));
+			return false;
+		}
+
+		pData = m_pArchiveView + (size_t)nDataOffset;
+	}
+	else if (!pData && !hZipFile && nCompressedSize != 0)
+	{
+		// data is only on disk
+		return false;
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Reads (and decodes) the first nBytes of an entry straight into
+//			pBuffer, see DecodeEntryData. Counts bytes and decode time.
+//-----------------------------------------------------------------------------
+bool CXZipFile::ReadEntryData(HANDLE hZipFile, int id, void* pBuffer, int nBytes)
+{
+	if (!m_Metrics.IsEnabled())
+	{
+		return DecodeEntryData(hZipFile, id, pBuffer, nBytes);
+	}
+
+	uint64 nStart = CXZipMetrics::Now();
+	if (!DecodeEntryData(hZipFile, id, pBuffer, nBytes))
+	{
+		return false;
+	}
+
+	unsigned char compressionType = m_Directory.m_CompressionTypes[id];
+	if (compressionType == IZip::eCompressionType_None)
+	{
+		m_Metrics.Add(XZIP_COUNTER_BYTES_READ, nBytes);
+	}
+	else
+	{
+		// a prefix read may stop early, count the whole input anyway
+		m_Metrics.Add(XZIP_COUNTER_BYTES_READ, m_Directory.m_CompressedSizes[id]);
+		m_Metrics.AddDecode(compressionType, CXZipMetrics::Now() - nStart, nBytes);
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Compressed input read from disk goes through a fixed stack buffer
+//-----------------------------------------------------------------------------
+bool CXZipFile::DecodeEntryData(HANDLE hZipFile, int id, void* pBuffer, int nBytes)
+{
+	int nCompressedSize = m_Directory.m_CompressedSizes[id];
+	int nUncompressedSize = m_Directory.m_UncompressedSizes[id];
+	uint64 nDataOffset = m_Directory.m_DataOffsets[id];
+	unsigned char compressionType = m_Directory.m_CompressionTypes[id];
+	Assert(nBytes >= 0 && nBytes <= nUncompressedSize);
+
+	if (compressionType == IZip::eCompressionType_None && !m_Entries[id].m_pData &&
+		m_Directory.m_PreloadLengths[id] >= (unsigned int)nBytes)
+	{
+		// small or prefix read, served from the preload section
+		memcpy(pBuffer, m_PreloadData.Base() + m_Directory.m_PreloadOffsets[id], nBytes);
+		return true;
+	}
+
+	const unsigned char* pData;
+	if (!GetEntrySource(hZipFile, id, pData))
+	{
+		return false;
+	}
+
+	if (compressionType == IZip::eCompressionType_None)
+	{
+		if (pData)
+		{
+			memcpy(pBuffer, pData, nBytes);
+		}
+		else if (!CWin32File::FileReadAt(hZipFile, nDataOffset, pBuffer, nBytes))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		CXZipDecoder decompressStream;
+		if (!decompressStream.Init(compressionType, nCompressedSize, nUncompressedSize))
+		{
+			Warning("Zip: Unsupported compression type %u in %s\n", compressionType, m_Directory.GetName(id));
+			return false;
+		}
+
+		unsigned int nCompressedBytesRead = 0;
+		unsigned int nOutputBytesWritten = 0;
+		if (pData)
+		{
+			bool bSuccess = decompressStream.Read((unsigned char*)pData, nCompressedSize,
+				(unsigned char*)pBuffer, nBytes,
+				nCompressedBytesRead, nOutputBytesWritten);
+			if (!bSuccess ||
+				(nBytes == nUncompressedSize && (int)nCompressedBytesRead != nCompressedSize) ||
+				(int)nOutputBytesWritten != nBytes)
+			{
+				Warning("Zip: Failed decompressing %s data in %s\n", CXZipCodec::GetName(compressionType), m_Directory.GetName(id));
+				return false;
+			}
+		}
+		else
+		{
+			// feed the decoder from disk a chunk at a time
+			unsigned char inputChunk[16 * 1024];
+			unsigned int nBuffered = 0;
+			uint64 nReadOffset = nDataOffset;
+			unsigned int nInputLeft = nCompressedSize;
+			unsigned int nOutput = 0;
+			while (nOutput < (unsigned int)nBytes)
+			{
+				unsigned int nRead = Min(nInputLeft, (unsigned int)sizeof(inputChunk) - nBuffered);
+				if (nRead)
+				{
+					if (!CWin32File::FileReadAt(hZipFile, nReadOffset, inputChunk + nBuffered, nRead))
+					{
+						return false;
+					}
+
+					nReadOffset += nRead;
+					nInputLeft -= nRead;
+					nBuffered += nRead;
+				}
+
+				bool bSuccess = decompressStream.Read(inputChunk, nBuffered,
+					(unsigned char*)pBuffer + nOutput, nBytes - nOutput,
+					nCompressedBytesRead, nOutputBytesWritten);
+				if (!bSuccess || (!nCompressedBytesRead && !nOutputBytesWritten && !nRead))
+				{
+					Warning("Zip: Failed decompressing %s data in %s\n", CXZipCodec::GetName(compressionType), m_Directory.GetName(id));
+					return false;
+				}
+
+				// keep whatever the decoder did not take for the next round
+				nBuffered -= nCompressedBytesRead;
+				memmove(inputChunk, inputChunk + nCompressedBytesRead, nBuffered);
+				nOutput += nOutputBytesWritten;
+			}
+		}
 	}
 
-	// Insert current data into rb tree
-	for (i = 0; i < numzipfiles; i++)
-	{
-		CZipEntry e;
-		e.m_Name = newfiles[i].m_Name;
-		e.m_nCompressedSize = newfiles[i].filelen;
-		e.m_ZipCRC = newfiles[i].crc32;
-		e.m_nUncompressedSize = newfiles[i].uncompressedLen;
-		e.m_eCompressionType = newfiles[i].compressionType;
-
-		// Make sure length is reasonable
-		if (e.m_nCompressedSize > 0)
-		{
-			e.m_pData = malloc(e.m_nCompressedSize);
+	return true;
+}
 
-			// Copy in data
-			buf.SeekGet(CUtlBuffer::SEEK_HEAD, newfiles[i].filepos);
-			buf.Get(e.m_pData, e.m_nCompressedSize);
-		}
-		else
+/**
+ * Hands a filled window to a sink. In text mode the window is collapsed
+ * first, a trailing CR is held back (moved to the front of the window) in
+ * case the next window starts with its LF.
+ *
+ * \param sink
+ * \param pWindow
+ * \param nFilled		Bytes in the window, receives the bytes carried over
+ * \param bTextMode
+ * \param bFinal		True for the last window of the entry
+ * \return False if the sink failed
+ */
+static bool EmitWindow(IXZipEntrySink& sink, unsigned char* pWindow, int& nFilled, bool bTextMode, bool bFinal)
+{
+	int nSize = nFilled;
+	int nCarry = 0;
+	if (bTextMode)
+	{
+		nSize = CXZipText::Collapse((char*)pWindow, nSize);
+		if (!bFinal && nSize > 0 && pWindow[nSize - 1] == '\r')
 		{
-			e.m_pData = NULL;
+			--nSize;
+			nCarry = 1;
 		}
+	}
+
+	if (nSize > 0 && !sink.Write(pWindow, nSize))
+	{
+		return false;
+	}
 
-		// Add to tree
-		m_Files.Insert(e);
+	if (nCarry)
+	{
+		pWindow[0] = '\r';
 	}
 
-	// Through away directory
-	delete[] newfiles;
+	nFilled = nCarry;
+	return true;
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Mount pak file from disk
+// Reads a file from the zip by directory id, one window at a time
 //-----------------------------------------------------------------------------
-HANDLE CXZipFile::OpenFromDisk(const char* pFilename)
+bool CXZipFile::StreamEntry(HANDLE hZipFile, int id, bool bTextMode, IXZipEntrySink& sink, int nWindowSize)
 {
-	HANDLE hFile = CreateFile(pFilename, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (hFile == INVALID_HANDLE_VALUE)
+	CXZipReadTimer timer(m_Metrics);
+
+	if (!m_Directory.IsValidEntry(id))
 	{
-		// not found
-		return NULL;
+		return false;
 	}
 
-	unsigned int fileLen = CWin32File::FileSeek(hFile, 0, FILE_END);
-	CWin32File::FileSeek(hFile, 0, FILE_BEGIN);
-	if (fileLen < sizeof(ZIP_EndOfCentralDirRecord))
+	int nCompressedSize = m_Directory.m_CompressedSizes[id];
+	unsigned int nUncompressedSize = m_Directory.m_UncompressedSizes[id];
+	uint64 nDataOffset = m_Directory.m_DataOffsets[id];
+	unsigned char compressionType = m_Directory.m_CompressionTypes[id];
+
+	const unsigned char* pData;
+	if (!GetEntrySource(hZipFile, id, pData))
 	{
-		// bad format
-		CloseHandle(hFile);
-		return NULL;
+		return false;
 	}
 
-	// need to get the central dir
-	ZIP_EndOfCentralDirRecord rec = { 0 };
-	unsigned int offset = fileLen - sizeof(ZIP_EndOfCentralDirRecord);
-	// If offset is ever greater than startOffset then it means that it has
-	// wrapped. This used to be a tautological >= 0 test.
-	ANALYZE_SUPPRESS(6293); // warning C6293: Ill-defined for-loop: counts down from minimum
-	for (unsigned int startOffset = offset; offset <= startOffset; offset--)
+	// decoding interleaves with the sink, so there is no decode time here
+	m_Metrics.Add(XZIP_COUNTER_BYTES_READ, nCompressedSize);
+	if (compressionType != IZip::eCompressionType_None)
+	{
+		m_Metrics.Add(XZIP_COUNTER_BYTES_DECOMPRESSED, nUncompressedSize);
+	}
+
+	if (!CXZipCodec::CanDecode(compressionType))
 	{
-		CWin32File::FileSeek(hFile, offset, FILE_BEGIN);
+		Warning("Zip: Unsupported compression type %u in %s\n", compressionType, m_Directory.GetName(id));
+		return false;
+	}
 
-		CWin32File::FileRead(hFile, &rec, sizeof(rec));
-		m_Swap.SwapFieldsToTargetEndian(&rec);
+	// running CRC of the data as stored, checked once everything is out
+	CRC32_t crc;
+	CXZipCRC::Init(&crc);
 
-		if (rec.signature == PKID(5, 6))
+	// stored binary data in memory needs no window at all
+	if (compressionType == IZip::eCompressionType_None && pData && !bTextMode)
+	{
+		for (unsigned int nOffset = 0; nOffset < nUncompressedSize; )
 		{
-			// Set any xzip configuration
-			if (rec.commentLength)
+			int nSize = (int)Min(nUncompressedSize - nOffset, (unsigned int)Max(nWindowSize, 1));
+			if (m_bVerifyCRC)
 			{
-				char commentString[128];
-				int commentLength = min(rec.commentLength, sizeof(commentString));
-				CWin32File::FileRead(hFile, commentString, commentLength);
-				if (commentLength == sizeof(commentString))
-					--commentLength;
-				commentString[commentLength] = '\0';
-				ParseXZipCommentString(commentString);
+				CXZipCRC::ProcessBuffer(&crc, pData + nOffset, nSize);
 			}
-			break;
-		}
-		else
-		{
-			// wrong record
-			rec.nCentralDirectoryEntries_Total = 0;
+
+			if (!sink.Write(pData + nOffset, nSize))
+			{
+				return false;
+			}
+
+			nOffset += nSize;
 		}
-	}
 
-	// Make sure there are some files to parse
-	int numZipFiles = rec.nCentralDirectoryEntries_Total;
-	if (numZipFiles <= 0)
-	{
-		// No files
-		CloseHandle(hFile);
-		return NULL;
+		CXZipCRC::Final(&crc);
+		return !m_bVerifyCRC || CheckEntryCRC(id, crc);
 	}
 
-	CWin32File::FileSeek(hFile, rec.startOfCentralDirOffset, FILE_BEGIN);
+	// no point in a window larger than the entry, and text mode needs room to carry a CR
+	nWindowSize = (int)Min((unsigned int)Max(nWindowSize, 2), Max(nUncompressedSize, 1u) + 1);
 
-	// read entire central dir into memory
-	CUtlBuffer zipDirBuff(0, rec.centralDirectorySize, 0);
-	zipDirBuff.ActivateByteSwapping(m_Swap.IsSwappingBytes());
-	CWin32File::FileRead(hFile, zipDirBuff.Base(), rec.centralDirectorySize);
-	zipDirBuff.SeekPut(CUtlBuffer::SEEK_HEAD, rec.centralDirectorySize);
+	CUtlBuffer window;
+	window.EnsureCapacity(nWindowSize);
+	unsigned char* pWindow = (unsigned char*)window.Base();
+	int nFilled = 0;
 
-	// build directory
-	for (int i = 0; i < numZipFiles; i++)
+	if (compressionType == IZip::eCompressionType_None)
 	{
-		ZIP_FileHeader zipFileHeader;
-		zipDirBuff.GetObjects(&zipFileHeader);
-
-		if (zipFileHeader.signature != PKID(1, 2)
-			|| (zipFileHeader.compressionMethod != IZip::eCompressionType_None
-				&& zipFileHeader.compressionMethod != IZip::eCompressionType_LZMA))
+		for (unsigned int nOffset = 0; nOffset < nUncompressedSize; )
 		{
-			// bad contents
-			CloseHandle(hFile);
-			return NULL;
-		}
-
-		char fileName[1024];
-		zipDirBuff.Get(fileName, zipFileHeader.fileNameLength);
-		fileName[zipFileHeader.fileNameLength] = '\0';
-		Q_strlower(fileName);
+			unsigned int nSize = Min(nUncompressedSize - nOffset, (unsigned int)(nWindowSize - nFilled));
+			if (pData)
+			{
+				memcpy(pWindow + nFilled, pData + nOffset, nSize);
+			}
+			else if (!CWin32File::FileReadAt(hZipFile, nDataOffset + nOffset, pWindow + nFilled, nSize))
+			{
+				return false;
+			}
 
-		// can determine actual filepos, assuming a well formed zip
-		CZipEntry e;
-		e.m_Name = fileName;
-		e.m_nCompressedSize = zipFileHeader.compressedSize;
-		e.m_nUncompressedSize = zipFileHeader.uncompressedSize;
-		e.m_ZipCRC = zipFileHeader.crc32;
-		e.m_SourceDiskOffset = zipFileHeader.relativeOffsetOfLocalHeader +
-			sizeof(ZIP_LocalFileHeader) +
-			zipFileHeader.fileNameLength +
-			zipFileHeader.extraFieldLength;
-		e.m_eCompressionType = (IZip::eCompressionType)zipFileHeader.compressionMethod;
-
-		// Add to tree
-		m_Files.Insert(e);
+			if (m_bVerifyCRC)
+			{
+				CXZipCRC::ProcessBuffer(&crc, pWindow + nFilled, nSize);
+			}
 
-		int nextOffset;
-		if (m_bCompatibleFormat)
-		{
-			nextOffset = zipFileHeader.extraFieldLength + zipFileHeader.fileCommentLength;
-		}
-		else
-		{
-			nextOffset = 0;
+			nOffset += nSize;
+			nFilled += nSize;
+			if (!EmitWindow(sink, pWindow, nFilled, bTextMode, nOffset == nUncompressedSize))
+			{
+				return false;
+			}
 		}
 
-		zipDirBuff.SeekGet(CUtlBuffer::SEEK_CURRENT, nextOffset);
+		CXZipCRC::Final(&crc);
+		return !m_bVerifyCRC || CheckEntryCRC(id, crc);
 	}
 
-	return hFile;
-}
-
-//-----------------------------------------------------------------------------
-// Purpose: Adds a new lump, or overwrites existing one
-// Input  : *relativename -
-//			*data -
-//			length -
-//-----------------------------------------------------------------------------
-void CXZipFile::AddBuffer(const char* relativename, void* data, int length, bool bTextMode, IZip::eCompressionType compressionType)
-{
-	// Lower case only
-	char name[512];
-	Q_strcpy(name, relativename);
-	Q_strlower(name);
-
-	int outLength = length;
-	int uncompressedLength = length;
-	void* outData = data;
-	CUtlBuffer textTransform;
-	CUtlBuffer compressionTransform;
-
-	if (bTextMode)
+	CXZipDecoder decompressStream;
+	if (!decompressStream.Init(compressionType, nCompressedSize, nUncompressedSize))
 	{
-		int textLen = GetLengthOfBinStringAsText((const char*)outData, outLength);
-		textTransform.EnsureCapacity(textLen);
-		CopyTextData((char*)textTransform.Base(), (char*)outData, textLen, outLength);
-
-		outData = (void*)textTransform.Base();
-		outLength = textLen;
-		uncompressedLength = textLen;
+		return false;
 	}
 
-	// uncompressed data final at this point (CRC is before compression)
-	CRC32_t zipCRC;
-	CRC32_Init(&zipCRC);
-	CRC32_ProcessBuffer(&zipCRC, outData, outLength);
-	CRC32_Final(&zipCRC);
-
-#ifdef ZIP_SUPPORT_LZMA_ENCODE
-	if (compressionType == IZip::eCompressionType_LZMA)
-	{
-		unsigned int compressedSize = 0;
-		unsigned char* pCompressedOutput = LZMA_Compress((unsigned char*)outData, outLength, &compressedSize);
-		if (!pCompressedOutput || compressedSize < sizeof(lzma_header_t))
-		{
-			Warning("ZipFile: LZMA compression failed\n");
-			return;
-		}
-
-		// Fixup LZMA header for ZIP payload usage
-		// The output of LZMA_Compress uses lzma_header_t, defined alongside it.
-		//
-		// ZIP payload format, see ZIP spec 5.8.8:
-		//  LZMA Version Information 2 bytes
-		//  LZMA Properties Size 2 bytes
-		//  LZMA Properties Data variable, defined by "LZMA Properties Size"
-		unsigned int nZIPHeader = 2 + 2 + sizeof(lzma_header_t().properties);
-		unsigned int finalCompressedSize = compressedSize - sizeof(lzma_header_t) + nZIPHeader;
-		compressionTransform.EnsureCapacity(finalCompressedSize);
-
-		// LZMA version
-		compressionTransform.PutUnsignedChar(LZMA_SDK_VERSION_MAJOR);
-		compressionTransform.PutUnsignedChar(LZMA_SDK_VERSION_MINOR);
-		// properties size
-		uint16 nSwappedPropertiesSize = LittleWord(sizeof(lzma_header_t().properties));
-		compressionTransform.Put(&nSwappedPropertiesSize, sizeof(nSwappedPropertiesSize));
-		// properties
-		compressionTransform.Put(&(((lzma_header_t*)pCompressedOutput)->properties), sizeof(lzma_header_t().properties));
-		// payload
-		compressionTransform.Put(pCompressedOutput + sizeof(lzma_header_t), compressedSize - sizeof(lzma_header_t));
-
-		// Free original
-		free(pCompressedOutput);
-		pCompressedOutput = NULL;
-
-		outData = (void*)compressionTransform.Base();
-		outLength = finalCompressedSize;
-		// (Not updating uncompressedLength)
-	}
-	else
-#endif
-		/* else from ifdef */ if (compressionType != IZip::eCompressionType_None)
+	// compressed input comes straight from memory, or through a stack buffer from disk
+	unsigned char inputChunk[16 * 1024];
+	unsigned int nBuffered = 0;
+	unsigned int nInputOffset = 0;
+	unsigned int nOutput = 0;
+	while (nOutput < nUncompressedSize)
+	{
+		unsigned char* pInput;
+		unsigned int nInputSize;
+		unsigned int nRead = 0;
+		if (pData)
 		{
-			Error("Calling AddBuffer with unknown compression type\n");
-			return;
+			pInput = (unsigned char*)pData + nInputOffset;
+			nInputSize = nCompressedSize - nInputOffset;
 		}
+		else
+		{
+			nRead = Min(nCompressedSize - nInputOffset - nBuffered, (unsigned int)sizeof(inputChunk) - nBuffered);
+			if (nRead && !CWin32File::FileReadAt(hZipFile, nDataOffset + nInputOffset + nBuffered, inputChunk + nBuffered, nRead))
+			{
+				return false;
+			}
 
-	// See if entry is in list already
-	CZipEntry e;
-	e.m_Name = name;
-	int index = m_Files.Find(e);
+			nBuffered += nRead;
+			pInput = inputChunk;
+			nInputSize = nBuffered;
+		}
 
-	// If already existing, throw away old data and update data and length
-	if (index != m_Files.InvalidIndex())
-	{
-		CZipEntry* update = &m_Files[index];
-		if (update->m_pData)
+		unsigned int nCompressedBytesRead = 0;
+		unsigned int nOutputBytesWritten = 0;
+		bool bSuccess = decompressStream.Read(pInput, nInputSize,
+			pWindow + nFilled, nWindowSize - nFilled,
+			nCompressedBytesRead, nOutputBytesWritten);
+		if (!bSuccess || (!nCompressedBytesRead && !nOutputBytesWritten && !nRead))
 		{
-			free(update->m_pData);
+			Warning("Zip: Failed decompressing %s data in %s\n", CXZipCodec::GetName(compressionType), m_Directory.GetName(id));
+			return false;
 		}
 
-		update->m_eCompressionType = compressionType;
-		update->m_pData = malloc(outLength);
-		memcpy(update->m_pData, outData, outLength);
-		update->m_nCompressedSize = outLength;
-		update->m_nUncompressedSize = uncompressedLength;
-		update->m_ZipCRC = zipCRC;
-
-		if (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE)
+		nInputOffset += nCompressedBytesRead;
+		if (!pData)
 		{
-			update->m_DiskCacheOffset = CWin32File::FileTell(m_hDiskCacheWriteFile);
-			CWin32File::FileWrite(m_hDiskCacheWriteFile, update->m_pData, update->m_nCompressedSize);
-			free(update->m_pData);
-			update->m_pData = NULL;
+			// keep whatever the decoder did not take for the next round
+			nBuffered -= nCompressedBytesRead;
+			memmove(inputChunk, inputChunk + nCompressedBytesRead, nBuffered);
 		}
-	}
-	else
-	{
-		// Create a new entry
-		e.m_nCompressedSize = outLength;
-		e.m_nUncompressedSize = uncompressedLength;
-		e.m_eCompressionType = compressionType;
-		e.m_ZipCRC = zipCRC;
-		if (outLength > 0)
+
+		if (m_bVerifyCRC)
 		{
-			e.m_pData = malloc(outLength);
-			memcpy(e.m_pData, outData, outLength);
+			CXZipCRC::ProcessBuffer(&crc, pWindow + nFilled, nOutputBytesWritten);
+		}
 
-			if (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE)
+		nOutput += nOutputBytesWritten;
+		nFilled += nOutputBytesWritten;
+		if (nFilled == nWindowSize || nOutput == nUncompressedSize)
+		{
+			if (!EmitWindow(sink, pWindow, nFilled, bTextMode, nOutput == nUncompressedSize))
 			{
-				e.m_DiskCacheOffset = CWin32File::FileTell(m_hDiskCacheWriteFile);
-				CWin32File::FileWrite(m_hDiskCacheWriteFile, e.m_pData, e.m_nCompressedSize);
-				free(e.m_pData);
-				e.m_pData = NULL;
+				return false;
 			}
 		}
-		else
-		{
-			e.m_pData = NULL;
-		}
-
-		m_Files.Insert(e);
 	}
-}
 
-//-----------------------------------------------------------------------------
-// Reads a file from the zip
-//-----------------------------------------------------------------------------
-bool CXZipFile::ReadFile(const char* pRelativeName, bool bTextMode, CUtlBuffer& buf)
-{
-	return ReadFile(0, pRelativeName, bTextMode, buf);
+	CXZipCRC::Final(&crc);
+	return !m_bVerifyCRC || CheckEntryCRC(id, crc);
 }
 
 //-----------------------------------------------------------------------------
-// Reads a file from the zip. Requires the zip file handle if this zip was loaded via OpenFromDisk
+// Purpose: Zero-copy access to stored entries held in memory or in the mapping
 //-----------------------------------------------------------------------------
-int CXZipFile::ReadFile(HANDLE hZipFile, const char* pRelativeName, bool bTextMode, CUtlBuffer& buf)
+bool CXZipFile::GetFileView(const char* pRelativeName, const void*& pView, int& nSize)
 {
-	// Lower case only
-	char pName[512];
-	Q_strncpy(pName, pRelativeName, 512);
-	Q_strlower(pName);
+	pView = NULL;
+	nSize = 0;
 
-	// See if entry is in list already
-	CZipEntry e;
-	e.m_Name = pName;
-	int nIndex = m_Files.Find(e);
-	if (nIndex == m_Files.InvalidIndex())
+	int id = FindEntry(pRelativeName);
+	if (id < 0)
 	{
 		// not found
-		return 0;
+		return false;
 	}
 
-	CZipEntry* pEntry = &m_Files[nIndex];
+	return GetEntryView(id, pView, nSize);
+}
 
-	void* pData = pEntry->m_pData;
-	CUtlBuffer readBuffer;
-	if (!pData && hZipFile)
-	{
-		readBuffer.EnsureCapacity(pEntry->m_nCompressedSize);
-		CWin32File::FileSeek(hZipFile, pEntry->m_SourceDiskOffset, FILE_BEGIN);
-		if (!CWin32File::FileRead(hZipFile, readBuffer.Base(), pEntry->m_nCompressedSize))
-		{
-			return 0;
-		}
+bool CXZipFile::GetEntryView(int id, const void*& pView, int& nSize)
+{
+	pView = NULL;
+	nSize = 0;
 
-		pData = readBuffer.Base();
+	if (!m_Directory.IsValidEntry(id))
+	{
+		return false;
 	}
 
-	CUtlBuffer decompressTransform;
-	if (pEntry->m_eCompressionType != IZip::eCompressionType_None)
+	if (m_Directory.m_CompressionTypes[id] != IZip::eCompressionType_None)
 	{
-		if (pEntry->m_eCompressionType == IZip::eCompressionType_LZMA)
-		{
-			decompressTransform.EnsureCapacity(pEntry->m_nUncompressedSize);
-
-			CLZMAStream decompressStream;
-			decompressStream.InitZIPHeader(pEntry->m_nCompressedSize, pEntry->m_nUncompressedSize);
-
-			unsigned int nCompressedBytesRead = 0;
-			unsigned int nOutputBytesWritten = 0;
-			bool bSuccess = decompressStream.Read((unsigned char*)pData, pEntry->m_nCompressedSize,
-				(unsigned char*)decompressTransform.Base(), decompressTransform.Size(),
-				nCompressedBytesRead, nOutputBytesWritten);
-			if (!bSuccess ||
-				(int)nCompressedBytesRead != pEntry->m_nCompressedSize ||
-				(int)nOutputBytesWritten != pEntry->m_nUncompressedSize)
-			{
-				Error("Zip: Failed decompressing LZMA data\n");
-				return 0;
-			}
-
-			pData = decompressTransform.Base();
-		}
-		else
-		{
-			Error("Unsupported compression type in Zip file: %u\n", pEntry->m_eCompressionType);
-			return 0;
-		}
+		// needs decoding
+		return false;
 	}
 
-	if (bTextMode)
+	int nCompressedSize = m_Directory.m_CompressedSizes[id];
+	uint64 nDataOffset = m_Directory.m_DataOffsets[id];
+	if (m_Entries[id].m_pData)
 	{
-		buf.SetBufferType(true, false);
-		ReadTextData((const char*)pData, pEntry->m_nUncompressedSize, buf);
+		pView = m_Entries[id].m_pData;
 	}
-	else
+	else if (nCompressedSize > 0 && m_Directory.m_PreloadLengths[id] == (unsigned int)nCompressedSize)
+	{
+		pView = m_PreloadData.Base() + m_Directory.m_PreloadOffsets[id];
+	}
+	else if (m_pArchiveView &&
+		(unsigned int)nCompressedSize <= m_nArchiveViewSize &&
+		nDataOffset <= m_nArchiveViewSize - nCompressedSize)
 	{
-		buf.SetBufferType(false, false);
-		buf.Put(pData, pEntry->m_nUncompressedSize);
+		pView = m_pArchiveView + (size_t)nDataOffset;
+	}
+	else if (nCompressedSize != 0)
+	{
+		// data is only on disk
+		return false;
 	}
 
-	return pEntry->m_nUncompressedSize;
+	nSize = m_Directory.m_UncompressedSizes[id];
+	return true;
 }
 
 //-----------------------------------------------------------------------------
@@ -826,18 +2224,26 @@ int CXZipFile::ReadFile(HANDLE hZipFile, const char* pRelativeName, bool bTextMo
 //-----------------------------------------------------------------------------
 bool CXZipFile::FileExists(const char* pRelativeName)
 {
-	// Lower case only
-	char pName[512];
-	Q_strncpy(pName, pRelativeName, 512);
-	Q_strlower(pName);
+	// If it is in the index, then it exists in the pack!
+	return FindEntry(pRelativeName) >= 0;
+}
 
-	// See if entry is in list already
-	CZipEntry e;
-	e.m_Name = pName;
-	int nIndex = m_Files.Find(e);
+//-----------------------------------------------------------------------------
+// Purpose: Directory lookup on the read side, counted in the metrics
+//-----------------------------------------------------------------------------
+int CXZipFile::FindEntry(const char* pRelativeName)
+{
+	int id = m_Directory.Find(pRelativeName);
+	if (m_Metrics.IsEnabled())
+	{
+		m_Metrics.Add(XZIP_COUNTER_LOOKUPS);
+		if (id < 0)
+		{
+			m_Metrics.Add(XZIP_COUNTER_LOOKUP_MISSES);
+		}
+	}
 
-	// If it is, then it exists in the pack!
-	return nIndex != m_Files.InvalidIndex();
+	return id;
 }
 
 //-----------------------------------------------------------------------------
@@ -870,14 +2276,10 @@ void CXZipFile::AddFile(const char* relativename, const char* fullpath, IZip::eC
 //-----------------------------------------------------------------------------
 void CXZipFile::RemoveFile(const char* relativename)
 {
-	CZipEntry e;
-	e.m_Name = relativename;
-	int index = m_Files.Find(e);
-
-	if (index != m_Files.InvalidIndex())
+	int id = m_Directory.Find(relativename);
+	if (id >= 0)
 	{
-		CZipEntry update = m_Files[index];
-		m_Files.Remove(update);
+		RemoveEntry(id);
 	}
 }
 
@@ -886,7 +2288,7 @@ void CXZipFile::RemoveFile(const char* relativename)
 //  to push the start of the file data to the next aligned boundary
 //  Output: Required padding size
 //---------------------------------------------------------------
-unsigned short CXZipFile::CalculatePadding(unsigned int filenameLen, unsigned int pos)
+unsigned short CXZipFile::CalculatePadding(unsigned int filenameLen, uint64 pos)
 {
 	if (m_AlignmentSize == 0)
 	{
@@ -906,7 +2308,15 @@ int CXZipFile::MakeXZipCommentString(char* pCommentString)
 	char tempString[XZIP_COMMENT_LENGTH];
 
 	memset(tempString, 0, sizeof(tempString));
-	V_snprintf(tempString, sizeof(tempString), "XZP%c %d", m_bCompatibleFormat ? '1' : '2', m_AlignmentSize);
+	if (m_nPreloadSectionSize)
+	{
+		// readers that only know about the alignment stop after it
+		V_snprintf(tempString, sizeof(tempString), "XZP%c %d %u", m_bCompatibleFormat ? '1' : '2', m_AlignmentSize, m_nPreloadSectionSize);
+	}
+	else
+	{
+		V_snprintf(tempString, sizeof(tempString), "XZP%c %d", m_bCompatibleFormat ? '1' : '2', m_AlignmentSize);
+	}
 	if (pCommentString)
 	{
 		memcpy(pCommentString, tempString, sizeof(tempString));
@@ -918,8 +2328,9 @@ int CXZipFile::MakeXZipCommentString(char* pCommentString)
 
 //-----------------------------------------------------------------------------
 // Purpose: An XZIP has its configuration in the ascii comment
+// Output : True if the comment is an XZIP one
 //-----------------------------------------------------------------------------
-void CXZipFile::ParseXZipCommentString(const char* pCommentString)
+bool CXZipFile::ParseXZipCommentString(const char* pCommentString)
 {
 	if (!V_strnicmp(pCommentString, "XZP", 3))
 	{
@@ -929,58 +2340,113 @@ void CXZipFile::ParseXZipCommentString(const char* pCommentString)
 			m_bCompatibleFormat = false;
 		}
 
-		// parse out the alignement configuration
+		// parse out the alignement configuration and the preload section size
+		int alignmentSize = 0;
+		m_nPreloadSectionSize = 0;
+		sscanf(pCommentString + 4, "%d %u", &alignmentSize, &m_nPreloadSectionSize);
 		if (!m_bForceAlignment)
 		{
-			m_AlignmentSize = 0;
-			sscanf(pCommentString + 4, "%d", &m_AlignmentSize);
+			m_AlignmentSize = alignmentSize;
 			if (!IsPowerOfTwo(m_AlignmentSize))
 			{
 				m_AlignmentSize = 0;
 			}
 		}
+		return true;
 	}
+
+	return false;
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: Calculate the exact size of zip file, with headers and padding
 // Output : int
 //-----------------------------------------------------------------------------
-unsigned int CXZipFile::CalculateSize(void)
+uint64 CXZipFile::CalculateSize(void)
 {
-	unsigned int size = 0;
-	unsigned int dirHeaders = 0;
-	for (int i = m_Files.FirstInorder(); i != m_Files.InvalidIndex(); i = m_Files.NextInorder(i))
-	{
-		CZipEntry* e = &m_Files[i];
+	CUtlVector<int> localHeaderOwners;
+	CUtlVector<int> payloadOwners;
+	ResolveSharedPayloads(localHeaderOwners, payloadOwners);
 
-		if (e->m_nCompressedSize == 0)
+	// mirrors SaveDirectory, entries without a payload are left out
+	auto hasPayload = [&](int id) -> bool
+	{
+		const CZipEntry& holder = m_Entries[payloadOwners[id]];
+		return m_Directory.m_CompressedSizes[id] > 0 && (holder.m_pData != NULL || holder.m_bSpilled);
+	};
+
+	// local headers and payloads, in the order they are written
+	CUtlVector<uint64> zipOffsets;
+	zipOffsets.SetCount(m_Directory.Count());
+	uint64 size = 0;
+	unsigned int preloadDataSize = 0;
+	int i;
+	for (i = m_Directory.FirstInOrder(); i != -1; i = m_Directory.NextInOrder(i))
+	{
+		zipOffsets[i] = size;
+		if (localHeaderOwners[i] != i || !hasPayload(i))
+		{
 			continue;
+		}
 
-		// local file header
-		size += sizeof(ZIP_LocalFileHeader);
-		size += strlen(e->m_Name.String());
+		unsigned short nameLength = m_Directory.GetNameLength(i);
+		size += sizeof(ZIP_LocalFileHeader) + nameLength + CalculatePadding(nameLength, size);
+		size += m_Directory.m_CompressedSizes[i];
+		preloadDataSize += GetPreloadLength(i);
+	}
 
-		// every file has a directory header that duplicates the filename
-		dirHeaders += sizeof(ZIP_FileHeader) + strlen(e->m_Name.String());
+	uint64 centralDirStart = m_AlignmentSize ? AlignOffset(size, m_AlignmentSize) : size;
+	size = centralDirStart;
 
-		// calculate padding
-		if (m_AlignmentSize != 0)
+	// every file has a directory header that duplicates the filename, and the
+	// padding (or the name length difference to the owner) in the extra field
+	unsigned int numFiles = 0;
+	for (i = m_Directory.FirstInOrder(); i != -1; i = m_Directory.NextInOrder(i))
+	{
+		if (!hasPayload(i))
 		{
-			// round up to next boundary
-			unsigned int nextBoundary = (size + m_AlignmentSize) & ~(m_AlignmentSize - 1);
+			continue;
+		}
+
+		numFiles++;
 
-			// the directory header also duplicates the padding
-			dirHeaders += nextBoundary - size;
+		int owner = localHeaderOwners[i];
+		uint64 ownerOffset = zipOffsets[owner];
+		unsigned short nameLength = m_Directory.GetNameLength(i);
+		unsigned short extraFieldLength = CalculatePadding(nameLength, ownerOffset);
+		if (owner != i)
+		{
+			unsigned short ownerNameLength = m_Directory.GetNameLength(owner);
+			extraFieldLength = ownerNameLength + CalculatePadding(ownerNameLength, ownerOffset) - nameLength;
+		}
 
-			size = nextBoundary;
+		size += sizeof(ZIP_FileHeader) + nameLength;
+		if (ownerOffset >= 0xFFFFFFFF)
+		{
+			// local headers past 4 GB are pointed at through a ZIP64 field
+			size += sizeof(ZIP64_ExtraFieldOffset);
+		}
+		if (m_bCompatibleFormat)
+		{
+			size += extraFieldLength;
 		}
+	}
+
+	// the preload section rides along at the end of the central directory
+	if (preloadDataSize)
+	{
+		size += sizeof(ZIP_PreloadHeader) + numFiles * sizeof(ZIP_PreloadDirectoryEntry) + preloadDataSize;
+	}
 
-		// data size
-		size += e->m_nCompressedSize;
+	if (m_AlignmentSize)
+	{
+		size = AlignOffset(size, m_AlignmentSize);
 	}
 
-	size += dirHeaders;
+	if (numFiles >= 0xFFFF || centralDirStart >= 0xFFFFFFFF || size - centralDirStart >= 0xFFFFFFFF)
+	{
+		size += sizeof(ZIP64_EndOfCentralDirRecord) + sizeof(ZIP64_EndOfCentralDirLocator);
+	}
 
 	// All processed zip files will have a comment string
 	size += sizeof(ZIP_EndOfCentralDirRecord) + MakeXZipCommentString(NULL);
@@ -993,54 +2459,62 @@ unsigned int CXZipFile::CalculateSize(void)
 //-----------------------------------------------------------------------------
 void CXZipFile::SpewDirectory(void)
 {
-	for (int i = m_Files.FirstInorder(); i != m_Files.InvalidIndex(); i = m_Files.NextInorder(i))
+	for (int i = m_Directory.FirstInOrder(); i != -1; i = m_Directory.NextInOrder(i))
 	{
-		CZipEntry* e = &m_Files[i];
-
-		printf("%s\n", e->m_Name.String());
+		printf("%s\n", m_Directory.GetName(i));
 	}
 }
 
 //-----------------------------------------------------------------------------
 // Purpose: Iterate through directory
 //-----------------------------------------------------------------------------
-int CXZipFile::GetNextEntry(int id, CUtlSymbol& fileEntry, int& fileSize)
+int CXZipFile::GetNextEntry(int id, const char*& pFileName, int& fileSize)
 {
 	if (id == -1)
 	{
-		id = m_Files.FirstInorder();
+		id = m_Directory.FirstInOrder();
 	}
 	else
 	{
-		id = m_Files.NextInorder(id);
+		id = m_Directory.NextInOrder(id);
 	}
 
-	if (id == m_Files.InvalidIndex())
+	if (id == -1)
 	{
 		// list is empty
 		return -1;
 	}
 
-	CZipEntry* e = &m_Files[id];
-	fileEntry = e->m_Name;
-	fileSize = e->m_nUncompressedSize;
+	pFileName = m_Directory.GetName(id);
+	fileSize = m_Directory.m_UncompressedSizes[id];
 
 	return id;
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: Store data out to disk
+// Purpose: Store data out to disk. SaveDirectory does several small puts per
+//			entry, they are gathered into large writes.
 //-----------------------------------------------------------------------------
 void CXZipFile::SaveToDisk(FILE* fout)
 {
-	CFileStream stream(fout);
+	CBufferedFileStream stream(fout);
 	SaveDirectory(stream);
+	stream.Flush();
+	if (!stream.IsValid())
+	{
+		Warning("Zip: Failed writing the pak\n");
+	}
 }
 
 void CXZipFile::SaveToDisk(HANDLE hOutFile)
 {
-	CFileStream stream(hOutFile);
+	CBufferedFileStream stream(hOutFile);
 	SaveDirectory(stream);
+	stream.Flush();
+	if (!stream.IsValid())
+	{
+		Warning("Zip: Failed writing the pak\n");
+	}
 }
 
 //-----------------------------------------------------------------------------
@@ -1057,94 +2531,101 @@ void CXZipFile::SaveToBuffer(CUtlBuffer& buf)
 //-----------------------------------------------------------------------------
 void CXZipFile::SaveDirectory(IWriteStream& stream)
 {
+	// entries sharing content are written once, see ResolveSharedPayloads
+	CUtlVector<int> localHeaderOwners;
+	CUtlVector<int> payloadOwners;
+	ResolveSharedPayloads(localHeaderOwners, payloadOwners);
+
+	// shared records may need up to a whole name of extra field on top
+	int nPaddingBufferSize = m_AlignmentSize + (m_bDeduplicate ? 0xFFFF : 0);
 	void* pPaddingBuffer = NULL;
-	if (m_AlignmentSize)
+	if (nPaddingBufferSize)
 	{
 		// get a temp buffer for all padding work
-		pPaddingBuffer = malloc(m_AlignmentSize);
-		memset(pPaddingBuffer, 0x00, m_AlignmentSize);
-	}
-
-	if (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE)
-	{
-		FlushFileBuffers(m_hDiskCacheWriteFile);
+		pPaddingBuffer = malloc(nPaddingBufferSize);
+		memset(pPaddingBuffer, 0x00, nPaddingBufferSize);
 	}
 
 	// Might be writing a zip into a larger stream
-	unsigned int zipOffsetInStream = stream.Tell();
+	uint64 zipOffsetInStream = stream.Tell();
+
+	// preload data is gathered while the payloads are at hand, per entry id
+	CUtlVector<unsigned char> preloadData;
+	CUtlVector<unsigned int> preloadOffsets;
+	CUtlVector<unsigned int> preloadLengths;
+	preloadOffsets.SetCount(m_Directory.Count());
+	preloadLengths.SetCount(m_Directory.Count());
 
 	int i;
-	for (i = m_Files.FirstInorder(); i != m_Files.InvalidIndex(); i = m_Files.NextInorder(i))
+	for (i = m_Directory.FirstInOrder(); i != -1; i = m_Directory.NextInOrder(i))
 	{
-		CZipEntry* e = &m_Files[i];
-		Assert(e);
+		CZipEntry* e = &m_Entries[i];
+		int nCompressedSize = m_Directory.m_CompressedSizes[i];
+		IZip::eCompressionType compressionType = (IZip::eCompressionType)m_Directory.m_CompressionTypes[i];
 
 		// Fix up the offset
 		e->m_ZipOffset = stream.Tell() - zipOffsetInStream;
 
-		if (e->m_nCompressedSize > 0 && (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE))
+		if (localHeaderOwners[i] != i)
 		{
-			// get the data back from the write cache
-			e->m_pData = malloc(e->m_nCompressedSize);
-			if (e->m_pData)
+			// the payload goes out with the local header of another entry
+			continue;
+		}
+
+		// the group leader writes the payload of whichever member holds it
+		CZipEntry* pHolder = &m_Entries[payloadOwners[i]];
+		const void* pPayload = pHolder->m_pData;
+		if (nCompressedSize > 0 && pHolder->m_bSpilled)
+		{
+			// straight out of the spill arena
+			pPayload = m_SpillArena.View(pHolder->m_DiskCacheOffset, nCompressedSize);
+			if (!pPayload)
 			{
-				CWin32File::FileSeek(m_hDiskCacheWriteFile, e->m_DiskCacheOffset, FILE_BEGIN);
-				CWin32File::FileRead(m_hDiskCacheWriteFile, e->m_pData, e->m_nCompressedSize);
+				Warning("Zip: Failed reading back %s from the spill file\n", m_Directory.GetName(i));
+				pHolder->m_bSpilled = false;
 			}
 		}
 
-		if (e->m_nCompressedSize > 0 && e->m_pData != NULL)
+		if (nCompressedSize > 0 && pPayload != NULL)
 		{
 			ZIP_LocalFileHeader hdr = { 0 };
 			hdr.signature = PKID(3, 4);
-			hdr.versionNeededToExtract = 10;  // No special features or even compression here, set to 1.0
-#ifdef ZIP_SUPPORT_LZMA_ENCODE
-			if (e->m_eCompressionType == IZip::eCompressionType_LZMA)
-			{
-				// Per ZIP spec 5.8.8
-				hdr.versionNeededToExtract = 63;
-			}
-#endif
+			hdr.versionNeededToExtract = CXZipCodec::GetVersionNeeded(compressionType);
 			hdr.flags = 0;
-			hdr.compressionMethod = e->m_eCompressionType;
+			hdr.compressionMethod = compressionType;
 			hdr.lastModifiedTime = 0;
 			hdr.lastModifiedDate = 0;
-			hdr.crc32 = e->m_ZipCRC;
+			hdr.crc32 = m_Directory.m_CRCs[i];
 
-			const char* pFilename = e->m_Name.String();
-			hdr.compressedSize = e->m_nCompressedSize;
-			hdr.uncompressedSize = e->m_nUncompressedSize;
-			hdr.fileNameLength = strlen(pFilename);
+			const char* pFilename = m_Directory.GetName(i);
+			hdr.compressedSize = nCompressedSize;
+			hdr.uncompressedSize = m_Directory.m_UncompressedSizes[i];
+			hdr.fileNameLength = m_Directory.GetNameLength(i);
 			hdr.extraFieldLength = CalculatePadding(hdr.fileNameLength, e->m_ZipOffset);
 			int extraFieldLength = hdr.extraFieldLength;
 
 			// Swap header in place
 			m_Swap.SwapFieldsToTargetEndian(&hdr);
 			stream.Put(&hdr, sizeof(hdr));
-			stream.Put(pFilename, strlen(pFilename));
+			stream.Put(pFilename, m_Directory.GetNameLength(i));
 			stream.Put(pPaddingBuffer, extraFieldLength);
-			stream.Put(e->m_pData, e->m_nCompressedSize);
+			stream.Put(pPayload, nCompressedSize);
 
-			if (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE)
+			unsigned int preloadLength = GetPreloadLength(i);
+			preloadOffsets[i] = preloadData.Count();
+			preloadLengths[i] = preloadLength;
+			if (preloadLength)
 			{
-				free(e->m_pData);
-
-				// temp hackery for the logic below to succeed
-				e->m_pData = (void*)0xFFFFFFFF;
+				preloadData.AddMultipleToTail(preloadLength, (const unsigned char*)pPayload);
 			}
 		}
 	}
 
-	if (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE)
-	{
-		CWin32File::FileSeek(m_hDiskCacheWriteFile, 0, FILE_END);
-	}
-
-	unsigned int centralDirStart = stream.Tell() - zipOffsetInStream;
+	uint64 centralDirStart = stream.Tell() - zipOffsetInStream;
 	if (m_AlignmentSize)
 	{
 		// align the central directory starting position
-		unsigned int newDirStart = AlignValue(centralDirStart, m_AlignmentSize);
+		uint64 newDirStart = AlignOffset(centralDirStart, m_AlignmentSize);
 		int padLength = newDirStart - centralDirStart;
 		if (padLength)
 		{
@@ -1154,45 +2635,71 @@ void CXZipFile::SaveDirectory(IWriteStream& stream)
 	}
 
 	int realNumFiles = 0;
-	for (i = m_Files.FirstInorder(); i != m_Files.InvalidIndex(); i = m_Files.NextInorder(i))
+	int numPreloadFiles = 0;
+	CUtlVector<ZIP_PreloadDirectoryEntry> preloadDirectory;
+	for (i = m_Directory.FirstInOrder(); i != -1; i = m_Directory.NextInOrder(i))
 	{
-		CZipEntry* e = &m_Files[i];
-		Assert(e);
+		int owner = localHeaderOwners[i];
+		CZipEntry* e = &m_Entries[owner];
+		const CZipEntry* pHolder = &m_Entries[payloadOwners[i]];
+		int nCompressedSize = m_Directory.m_CompressedSizes[i];
+		IZip::eCompressionType compressionType = (IZip::eCompressionType)m_Directory.m_CompressionTypes[i];
 
-		if (e->m_nCompressedSize > 0 && e->m_pData != NULL)
+		if (nCompressedSize > 0 && (pHolder->m_pData != NULL || pHolder->m_bSpilled))
 		{
 			ZIP_FileHeader hdr = { 0 };
 			hdr.signature = PKID(1, 2);
 			hdr.versionMadeBy = 20;				// This is the version that the winzip that I have writes.
-			hdr.versionNeededToExtract = 10;  // No special features or even compression here, set to 1.0
-#ifdef ZIP_SUPPORT_LZMA_ENCODE
-			if (e->m_eCompressionType == IZip::eCompressionType_LZMA)
-			{
-				// Per ZIP spec 5.8.8
-				hdr.versionNeededToExtract = 63;
-			}
-#endif
+			hdr.versionNeededToExtract = CXZipCodec::GetVersionNeeded(compressionType);
 			hdr.flags = 0;
-			hdr.compressionMethod = e->m_eCompressionType;
+			hdr.compressionMethod = compressionType;
 			hdr.lastModifiedTime = 0;
 			hdr.lastModifiedDate = 0;
-			hdr.crc32 = e->m_ZipCRC;
+			hdr.crc32 = m_Directory.m_CRCs[i];
 
-			hdr.compressedSize = e->m_nCompressedSize;
-			hdr.uncompressedSize = e->m_nUncompressedSize;
-			hdr.fileNameLength = strlen(e->m_Name.String());
+			hdr.compressedSize = nCompressedSize;
+			hdr.uncompressedSize = m_Directory.m_UncompressedSizes[i];
+			hdr.fileNameLength = m_Directory.GetNameLength(i);
 			hdr.extraFieldLength = CalculatePadding(hdr.fileNameLength, e->m_ZipOffset);
+			if (owner != i)
+			{
+				// shared data, the extra field makes up for the name length
+				// difference so readers land on the owner's payload
+				unsigned short ownerNameLength = m_Directory.GetNameLength(owner);
+				hdr.extraFieldLength = ownerNameLength + CalculatePadding(ownerNameLength, e->m_ZipOffset) - hdr.fileNameLength;
+			}
 			hdr.fileCommentLength = 0;
 			hdr.diskNumberStart = 0;
 			hdr.internalFileAttribs = 0;
 			hdr.externalFileAttribs = 0; // This is usually something, but zero is OK as if the input came from stdin
-			hdr.relativeOffsetOfLocalHeader = e->m_ZipOffset;
+			hdr.relativeOffsetOfLocalHeader = (unsigned int)e->m_ZipOffset;
 			int extraFieldLength = hdr.extraFieldLength;
 
+			// local headers past 4 GB are pointed at through a ZIP64 field,
+			// which goes ahead of the padding
+			ZIP64_ExtraFieldOffset zip64Extra;
+			bool bZip64Extra = (e->m_ZipOffset >= 0xFFFFFFFF);
+			if (bZip64Extra)
+			{
+				zip64Extra.headerID = ZIP64_EXTRA_FIELD_ID;
+				zip64Extra.dataSize = sizeof(zip64Extra.relativeOffsetOfLocalHeader);
+				zip64Extra.relativeOffsetOfLocalHeader = e->m_ZipOffset;
+				SwapZip64Fields(m_Swap, zip64Extra);
+
+				hdr.versionMadeBy = ZIP64_VERSION_NEEDED;
+				hdr.versionNeededToExtract = Max(hdr.versionNeededToExtract, (unsigned short)ZIP64_VERSION_NEEDED);
+				hdr.extraFieldLength += sizeof(zip64Extra);
+				hdr.relativeOffsetOfLocalHeader = 0xFFFFFFFF;
+			}
+
 			// Swap the header in place
 			m_Swap.SwapFieldsToTargetEndian(&hdr);
 			stream.Put(&hdr, sizeof(hdr));
-			stream.Put(e->m_Name.String(), strlen(e->m_Name.String()));
+			stream.Put(m_Directory.GetName(i), m_Directory.GetNameLength(i));
+			if (bZip64Extra)
+			{
+				stream.Put(&zip64Extra, sizeof(zip64Extra));
+			}
 			if (m_bCompatibleFormat)
 			{
 				stream.Put(pPaddingBuffer, extraFieldLength);
@@ -1200,19 +2707,40 @@ void CXZipFile::SaveDirectory(IWriteStream& stream)
 
 			realNumFiles++;
 
-			if (m_hDiskCacheWriteFile != INVALID_HANDLE_VALUE)
-			{
-				// clear out temp hackery
-				e->m_pData = NULL;
-			}
+			// preload table follows central directory order
+			ZIP_PreloadDirectoryEntry& preloadEntry = preloadDirectory[preloadDirectory.AddToTail()];
+			preloadEntry.Length = preloadLengths[owner];
+			preloadEntry.DataOffset = preloadLengths[owner] ? preloadOffsets[owner] : 0;
+			numPreloadFiles += (preloadLengths[owner] != 0);
+		}
+	}
+
+	m_nPreloadSectionSize = 0;
+	if (preloadData.Count())
+	{
+		ZIP_PreloadHeader preloadHdr;
+		preloadHdr.Version = XZIP_PRELOAD_VERSION;
+		preloadHdr.DirectoryEntries = realNumFiles;
+		preloadHdr.PreloadDirectoryEntries = numPreloadFiles;
+		preloadHdr.Alignment = m_AlignmentSize;
+
+		m_Swap.SwapFieldsToTargetEndian(&preloadHdr);
+		stream.Put(&preloadHdr, sizeof(preloadHdr));
+		for (int j = 0; j < preloadDirectory.Count(); j++)
+		{
+			m_Swap.SwapFieldsToTargetEndian(&preloadDirectory[j]);
 		}
+		stream.Put(preloadDirectory.Base(), preloadDirectory.Count() * sizeof(ZIP_PreloadDirectoryEntry));
+		stream.Put(preloadData.Base(), preloadData.Count());
+
+		m_nPreloadSectionSize = sizeof(ZIP_PreloadHeader) + realNumFiles * sizeof(ZIP_PreloadDirectoryEntry) + preloadData.Count();
 	}
 
-	unsigned int centralDirEnd = stream.Tell() - zipOffsetInStream;
+	uint64 centralDirEnd = stream.Tell() - zipOffsetInStream;
 	if (m_AlignmentSize)
 	{
 		// align the central directory starting position
-		unsigned int newDirEnd = AlignValue(centralDirEnd, m_AlignmentSize);
+		uint64 newDirEnd = AlignOffset(centralDirEnd, m_AlignmentSize);
 		int padLength = newDirEnd - centralDirEnd;
 		if (padLength)
 		{
@@ -1221,14 +2749,40 @@ void CXZipFile::SaveDirectory(IWriteStream& stream)
 		}
 	}
 
+	uint64 centralDirSize = centralDirEnd - centralDirStart;
+	if (realNumFiles >= 0xFFFF || centralDirStart >= 0xFFFFFFFF || centralDirSize >= 0xFFFFFFFF)
+	{
+		// too big for the classic record, write the ZIP64 record and its
+		// locator ahead of it and saturate the fields that don't fit
+		ZIP64_EndOfCentralDirRecord rec64 = { 0 };
+		rec64.signature = PKID(6, 6);
+		rec64.sizeOfRecord = sizeof(rec64) - sizeof(rec64.signature) - sizeof(rec64.sizeOfRecord);
+		rec64.versionMadeBy = ZIP64_VERSION_NEEDED;
+		rec64.versionNeededToExtract = ZIP64_VERSION_NEEDED;
+		rec64.nCentralDirectoryEntries_ThisDisk = realNumFiles;
+		rec64.nCentralDirectoryEntries_Total = realNumFiles;
+		rec64.centralDirectorySize = centralDirSize;
+		rec64.startOfCentralDirOffset = centralDirStart;
+
+		ZIP64_EndOfCentralDirLocator locator = { 0 };
+		locator.signature = PKID(6, 7);
+		locator.zip64RecordOffset = stream.Tell() - zipOffsetInStream;
+		locator.totalNumberOfDisks = 1;
+
+		SwapZip64Fields(m_Swap, rec64);
+		SwapZip64Fields(m_Swap, locator);
+		stream.Put(&rec64, sizeof(rec64));
+		stream.Put(&locator, sizeof(locator));
+	}
+
 	ZIP_EndOfCentralDirRecord rec = { 0 };
 	rec.signature = PKID(5, 6);
 	rec.numberOfThisDisk = 0;
 	rec.numberOfTheDiskWithStartOfCentralDirectory = 0;
-	rec.nCentralDirectoryEntries_ThisDisk = realNumFiles;
-	rec.nCentralDirectoryEntries_Total = realNumFiles;
-	rec.centralDirectorySize = centralDirEnd - centralDirStart;
-	rec.startOfCentralDirOffset = centralDirStart;
+	rec.nCentralDirectoryEntries_ThisDisk = (unsigned short)Min(realNumFiles, 0xFFFF);
+	rec.nCentralDirectoryEntries_Total = (unsigned short)Min(realNumFiles, 0xFFFF);
+	rec.centralDirectorySize = (unsigned int)Min(centralDirSize, (uint64)0xFFFFFFFF);
+	rec.startOfCentralDirOffset = (unsigned int)Min(centralDirStart, (uint64)0xFFFFFFFF);
 
 	char commentString[128];
 	int commentLength = MakeXZipCommentString(commentString);
@@ -16,16 +16,50 @@
 #include "byteswap.h"
 #include "checksum_crc.h"
 #include "lzmaDecoder.h"
+#include "refcount.h"
 #include "utlbuffer.h"
 #include "utllinkedlist.h"
 
 #include "zip_utils.h"
 #include "zip_uncompressed.h"
 
+#include "xzip_cache.h"
+#include "xzip_codec.h"
+#include "xzip_dedup.h"
+#include "xzip_metrics.h"
+#include "xzip_policy.h"
+#include "xzip_spill.h"
+#include "xzip_directory.h"
+
  /**
-  * Max files allowed in a zip file (per SDK).
+  * Extra field header id of the ZIP64 extended information field.
   */
-#define MAX_FILES_IN_ZIP 32768
+#define ZIP64_EXTRA_FIELD_ID 0x0001
+
+/**
+ * Default window size for streamed entry reads (see StreamEntry).
+ */
+#define XZIP_STREAM_WINDOW_SIZE (1024 * 1024)
+
+/**
+ * Version of the preload section written at the end of the central directory
+ * (see SetPreloadSize).
+ */
+#define XZIP_PRELOAD_VERSION 1
+
+/**
+ * Receives the contents of a streamed entry one window at a time.
+ */
+abstract_class IXZipEntrySink
+{
+public:
+	/**
+	 * \param pData	Next part of the entry, only valid during the call
+	 * \param nSize	Size of the part
+	 * \return False to abort the read
+	 */
+	virtual bool Write(const void* pData, int nSize) = 0;
+};
 
   /**
    * XZip Package.
@@ -65,6 +99,79 @@ public:
 	 * \param compressionType	Compression method to use (if any)
 	 */
 	void			AddBuffer(const char* relativename, void* data, int length, bool bTextMode, IZip::eCompressionType compressionType);
+
+	/**
+	 * Describes one lump for AddBuffers.
+	 */
+	struct AddBufferInfo_t
+	{
+		const char*				m_pRelativeName;
+		void*					m_pData;
+		int						m_nLength;
+		bool					m_bTextMode;
+		IZip::eCompressionType	m_eCompressionType;
+	};
+
+	/**
+	 * Adds many buffers at once, compressing them across several threads.
+	 * The resulting directory (and saved pak) is identical to calling
+	 * AddBuffer for each entry in order, whatever the thread count.
+	 *
+	 * \param pBuffers		Entries to add, data must stay valid for the call
+	 * \param nBuffers		Number of entries
+	 * \param nThreads		Worker threads, <= 0 for one per core
+	 */
+	void			AddBuffers(const AddBufferInfo_t* pBuffers, int nBuffers, int nThreads);
+
+	/**
+	 * Output of PrepareBuffer, the thread safe half of AddBuffer.
+	 */
+	struct PreparedBuffer_t
+	{
+		CUtlBuffer				m_TextTransform;
+		CUtlBuffer				m_CompressionTransform;
+
+		// Final payload, points at the source data or one of the transforms
+		void*					m_pData;
+		int						m_nLength;
+		int						m_nUncompressedLength;
+		CRC32_t					m_CRC;
+		IZip::eCompressionType	m_eCompressionType;
+		bool					m_bValid;
+
+		// Set with SetDeduplicate. A shared payload is left uncompressed in
+		// m_pData, CommitBuffer encodes it if its holder never shows up
+		XZipContentKey_t		m_ContentKey;
+		bool					m_bHasContentKey;
+		bool					m_bSharedPayload;
+	};
+
+	/**
+	 * Text transform, CRC and compression of a lump, may run on any thread.
+	 * Of the member state it only claims keys in the content table (own
+	 * lock), bumps the metrics (atomic) and reads the settings. The source
+	 * data must outlive the result.
+	 *
+	 * \param data				Buffer containing file contents
+	 * \param length			Length of buffer
+	 * \param bTextMode			True to read as text, false to read raw
+	 * \param compressionType	Compression method to use (if any)
+	 * \param prepared			Receives the payload
+	 * \return True on success
+	 */
+	bool			PrepareBuffer(void* data, int length, bool bTextMode, IZip::eCompressionType compressionType, PreparedBuffer_t& prepared);
+	/**
+	 * Adds a prepared lump to the zip (single threaded). A payload held in
+	 * one of the transforms, or in pSource, is handed to the entry rather
+	 * than copied, that buffer is left empty.
+	 *
+	 * \param relativename		Relative name (path + name) to use in the zip package
+	 * \param prepared			Output of PrepareBuffer
+	 * \param pSource			Optional buffer holding the source data passed
+	 *							to PrepareBuffer, may be taken over as well
+	 */
+	void			CommitBuffer(const char* relativename, PreparedBuffer_t& prepared, CUtlBuffer* pSource = NULL);
+
 	/**
 	 * Removes all file entries from the zip.
 	 *
@@ -81,9 +188,121 @@ public:
 
 	bool			ReadFile(const char* relativename, bool bTextMode, CUtlBuffer& buf);
 	int				ReadFile(HANDLE hZipFile, const char* relativename, bool bTextMode, CUtlBuffer& buf);
+	bool			ReadFile(HANDLE hZipFile, const char* relativename, bool bTextMode, void* pBuffer, int nBufferSize, int& nBytesWritten);
+	/**
+	 * Reads an entry by directory id (see GetNextEntry). Does not touch the
+	 * file pointer, so it may be called from several threads at once as long
+	 * as the directory is not modified.
+	 *
+	 * \param hZipFile		Zip file handle if loaded via OpenFromDisk
+	 * \param id			Directory id
+	 * \param bTextMode		True to read as text, false to read raw
+	 * \param buf			Receives the file contents
+	 * \return Uncompressed size, 0 on error
+	 */
+	int				ReadEntry(HANDLE hZipFile, int id, bool bTextMode, CUtlBuffer& buf);
+	/**
+	 * Reads an entry into a caller-owned buffer without any intermediate
+	 * buffers. Stored data is read straight into it and compressed data is
+	 * decoded straight into it. Text mode collapses CRLF in place and null terminates.
+	 *
+	 * \param hZipFile		Zip file handle if loaded via OpenFromDisk
+	 * \param id			Directory id
+	 * \param bTextMode		True to read as text, false to read raw
+	 * \param pBuffer		Destination, may be NULL to query the size
+	 * \param nBufferSize	Capacity of pBuffer, needs the uncompressed size (+ 1 in text mode)
+	 * \param nBytesWritten	Bytes written (without the terminator), or the
+	 *						required capacity if the buffer is too small
+	 * \return True on success
+	 */
+	bool			ReadEntry(HANDLE hZipFile, int id, bool bTextMode, void* pBuffer, int nBufferSize, int& nBytesWritten);
+	/**
+	 * Gets the decoded payload of an entry without a copy. Compressed
+	 * entries are served from the entry cache (see SetCacheBudget) and
+	 * cached on a miss. The data is raw, text mode is up to the caller.
+	 * Safe to call concurrently.
+	 *
+	 * \param hZipFile		Zip file handle if loaded via OpenFromDisk
+	 * \param id			Directory id
+	 * \param data			Receives the payload, valid for as long as it is held
+	 * \return True on success
+	 */
+	bool			GetCachedEntry(HANDLE hZipFile, int id, XZipCacheHandle_t& data);
+	/**
+	 * Reads the leading bytes of an entry (raw, no text transform, no CRC
+	 * check). Served from the preload section without any I/O when it
+	 * covers the request.
+	 *
+	 * \param hZipFile		Zip file handle if loaded via OpenFromDisk
+	 * \param id			Directory id
+	 * \param pBuffer		Destination
+	 * \param nBufferSize	Number of bytes wanted
+	 * \param nBytesWritten	Bytes written, less than asked for short entries
+	 * \return True on success
+	 */
+	bool			ReadEntryPrefix(HANDLE hZipFile, int id, void* pBuffer, int nBufferSize, int& nBytesWritten);
+	bool			ReadFilePrefix(HANDLE hZipFile, const char* relativename, void* pBuffer, int nBufferSize, int& nBytesWritten);
+	/**
+	 * Reads an entry in fixed size windows and hands each one to a sink, so
+	 * peak memory depends on the window size and not on the entry size.
+	 * Safe to call concurrently, like ReadEntry.
+	 *
+	 * \param hZipFile		Zip file handle if loaded via OpenFromDisk
+	 * \param id			Directory id
+	 * \param bTextMode		True to read as text (no null terminator), false to read raw
+	 * \param sink			Receives the entry contents in order
+	 * \param nWindowSize	Size of the decode window
+	 * \return True on success
+	 */
+	bool			StreamEntry(HANDLE hZipFile, int id, bool bTextMode, IXZipEntrySink& sink, int nWindowSize = XZIP_STREAM_WINDOW_SIZE);
 
+	/**
+	 * Returns a zero-copy view of a stored (uncompressed) entry. Only valid for
+	 * entries held in memory or in a mapped archive, the view lives until the
+	 * archive is cleared or reopened.
+	 *
+	 * \param relativename	Relative name (path + name) in the zip package
+	 * \param pView			Receives the entry payload
+	 * \param nSize			Receives the entry size
+	 * \return True if a view could be provided
+	 */
+	bool			GetFileView(const char* relativename, const void*& pView, int& nSize);
+	bool			GetEntryView(int id, const void*& pView, int& nSize);
+
+	/**
+	 * Loads a pak from memory. The payloads are copied, the buffer may be
+	 * freed afterwards.
+	 *
+	 * \param buffer		Whole pak
+	 * \param bufferlength	Size of the pak
+	 */
 	void			OpenFromBuffer(void* buffer, int bufferlength);
-	HANDLE			OpenFromDisk(const char* pFilename);
+	/**
+	 * Loads a pak from memory the caller keeps, for paks that are resident
+	 * anyway (a cache, shared memory). Only the directory is read, entries
+	 * are read and viewed straight from the buffer like from a mapped
+	 * archive, so opening costs O(directory). The pak is read only: entries
+	 * that are not replaced do not go into a save.
+	 *
+	 * \param pBuffer	Whole pak, must stay valid until the pak is cleared,
+	 *					reopened or destroyed
+	 * \param nLength	Size of the pak
+	 * \param pOwner	Optional owner of the buffer, held with AddRef for as
+	 *					long as the buffer is referenced
+	 * \return False if the buffer holds no valid pak
+	 */
+	bool			OpenFromBorrowedBuffer(const void* pBuffer, int nLength, IRefCounted* pOwner = NULL);
+	/**
+	 * Mounts a pak file from disk.
+	 *
+	 * \param pFilename	Path to the pak file
+	 * \param bMapArchive	Map the whole pak into memory and read entries from the
+	 *						mapping. Falls back to handle reads if mapping fails.
+	 * \return Handle to the pak file with its file pointer at the start, NULL
+	 *			on error. Entry reads on it move the file pointer, seek before
+	 *			writing to it.
+	 */
+	HANDLE			OpenFromDisk(const char* pFilename, bool bMapArchive = false);
 
 	void			SpewDirectory(void);
 
@@ -91,35 +310,124 @@ public:
 	void			SaveToDisk(FILE* fout);
 	void			SaveToDisk(HANDLE hOutFile);
 
-	unsigned int	CalculateSize(void);
+	uint64			CalculateSize(void);
 	void			ForceAlignment(bool aligned, bool bCompatibleFormat, unsigned int alignmentSize);
 	unsigned int	GetAlignment();
 	void			SetBigEndian(bool bigEndian);
 	void			ActivateByteSwapping(bool bActivate);
+	/**
+	 * Checks the CRC of every entry read through ReadEntry / StreamEntry
+	 * (and the ReadFile wrappers), a mismatch fails the read.
+	 *
+	 * \param bVerify	True to verify, off by default
+	 */
+	void			SetVerifyCRC(bool bVerify) { m_bVerifyCRC = bVerify; }
+	/**
+	 * Keeps decoded compressed entries in memory so ReadEntry (and the
+	 * ReadFile wrappers) decode hot entries once. Least recently used
+	 * entries go first once the budget is reached. Changing the directory
+	 * drops the cache.
+	 *
+	 * \param nBytes	Most decoded bytes to hold, 0 (the default) for no cache
+	 */
+	void			SetCacheBudget(size_t nBytes) { m_EntryCache.SetBudget(nBytes); }
+	/**
+	 * \param nHits		Receives the number of reads served from the cache
+	 * \param nMisses	Receives the number of reads that had to decode
+	 * \param nBytes	Receives the number of decoded bytes held
+	 */
+	void			GetCacheStats(uint64& nHits, uint64& nMisses, size_t& nBytes) { m_EntryCache.GetStats(nHits, nMisses, nBytes); }
+	/**
+	 * Turns on the runtime metrics: lookups, cache hits, bytes read and
+	 * decoded, decode and compression time per codec and a ReadEntry /
+	 * StreamEntry latency histogram. Off by default, and next to free then.
+	 *
+	 * \param bEnabled	True to collect
+	 */
+	void			SetMetricsEnabled(bool bEnabled) { m_Metrics.SetEnabled(bEnabled); }
+	/**
+	 * \param snapshot	Receives the metrics collected so far
+	 */
+	void			GetMetrics(XZipMetricsSnapshot_t& snapshot) const { m_Metrics.Snapshot(snapshot); }
+	void			ResetMetrics(void) { m_Metrics.Reset(); }
+	/**
+	 * Makes SaveDirectory write a preload section: the first nBytes of every
+	 * stored entry, and the whole payload of compressed entries no larger
+	 * than nBytes, packed together at the end of the central directory.
+	 * OpenFromDisk picks it up with the directory read.
+	 *
+	 * \param nBytes	Bytes to preload per entry, 0 (the default) for none
+	 */
+	void			SetPreloadSize(unsigned int nBytes) { m_nPreloadSize = nBytes; }
+	/**
+	 * Stores identical payloads once. PrepareBuffer skips the compression of
+	 * a payload that was already claimed, and SaveDirectory points every
+	 * central directory record of the content at the same local data.
+	 *
+	 * \param bDeduplicate	True to deduplicate, off by default
+	 */
+	void			SetDeduplicate(bool bDeduplicate) { m_bDeduplicate = bDeduplicate; }
+	/**
+	 * Minimum saving for a compressed entry. PrepareBuffer stores an entry
+	 * uncompressed when a sample looks incompressible or the compressed
+	 * payload falls short, see CXZipCompressionPolicy.
+	 *
+	 * \param flMinGain	Fraction of the size, XZIP_DEFAULT_MIN_GAIN by default
+	 */
+	void			SetMinCompressionGain(float flMinGain) { m_CompressionPolicy.SetMinGain(flMinGain); }
+	/**
+	 * Level for codecs that have one (zstd, LZ4), see CXZipCodec::Compress.
+	 *
+	 * \param nLevel	Codec level, 0 (the default) for the codec default
+	 */
+	void			SetCompressionLevel(int nLevel) { m_nCompressionLevel = nLevel; }
 
 private:
-	typedef struct
-	{
-		CUtlSymbol             m_Name;
-		unsigned int           filepos;
-		int                    filelen;
-		int                    uncompressedLen;
-		CRC32_t                crc32;
-		IZip::eCompressionType compressionType;
-	} TmpFileInfo_t;
-
 	CByteswap		m_Swap;
 	unsigned int	m_AlignmentSize;
 	bool			m_bForceAlignment;
 	bool			m_bCompatibleFormat;
+	bool			m_bVerifyCRC;
+	bool			m_bDeduplicate;
+	unsigned int	m_nPreloadSize;
+	int				m_nCompressionLevel;
 
-	unsigned short	CalculatePadding(unsigned int filenameLen, unsigned int pos);
+	/**
+	 * Central directory location, from the end of central dir record or,
+	 * when that has saturated fields, from the ZIP64 record it points to.
+	 */
+	struct CentralDirInfo_t
+	{
+		uint64	m_nEntries;
+		uint64	m_nSize;
+		uint64	m_nOffset;
+	};
+
+	unsigned short	CalculatePadding(unsigned int filenameLen, uint64 pos);
 	void			SaveDirectory(IWriteStream& stream);
 	int				MakeXZipCommentString(char* pComment);
-	void			ParseXZipCommentString(const char* pComment);
+	bool			ParseXZipCommentString(const char* pComment);
+	void			CloseArchiveView(void);
+	bool			ReadDirectoryFromBuffer(const unsigned char* pArchive, int nLength);
+	bool			CheckEntryCRC(int id, CRC32_t crc);
+	bool			GetEntrySource(HANDLE hZipFile, int id, const unsigned char*& pData);
+	bool			ReadEntryData(HANDLE hZipFile, int id, void* pBuffer, int nBytes);
+	bool			DecodeEntryData(HANDLE hZipFile, int id, void* pBuffer, int nBytes);
+	int				FindEntry(const char* pRelativeName);
+	unsigned int	GetPreloadLength(int id);
+	void			LoadPreloadSection(CUtlBuffer& buf, int firstID, int numEntries);
+	bool			EncodeBuffer(void* data, int length, IZip::eCompressionType compressionType, PreparedBuffer_t& prepared);
+	void			DropPayload(int id);
+	int				ResolveSharedPayloads(CUtlVector<int>& localHeaderOwners, CUtlVector<int>& payloadOwners) const;
+	bool			ReadCentralDirInfo(const ZIP_EndOfCentralDirRecord& rec, const unsigned char* pArchive, HANDLE hFile, uint64 nRecordOffset, CentralDirInfo_t& dir);
+	int				ReadZip64ExtraField(CUtlBuffer& buf, const ZIP_FileHeader& hdr, uint64& nCompressedSize, uint64& nUncompressedSize, uint64& nLocalHeaderOffset, int& nZip64Length);
+	uint64			GetEntryDataOffset(const unsigned char* pArchive, HANDLE hFile, uint64 nArchiveSize, const ZIP_FileHeader& hdr, uint64 nLocalHeaderOffset, int nZip64Length, bool bXZip);
+
+	int				AddEntry(const char* pRelativeName);
+	void			RemoveEntry(int id);
 
 	/**
-	 * Internal entry for faster searching, etc.
+	 * Payload state of an entry, kept in m_Entries parallel to the directory.
 	 */
 	class CZipEntry
 	{
@@ -127,44 +435,70 @@ private:
 		CZipEntry(void);
 		~CZipEntry(void);
 
-		CZipEntry(const CZipEntry& src);
-
-		static bool ZipFileLessFunc(CZipEntry const& src1, CZipEntry const& src2);
-		static bool ZipFileLessFunc_CaselessSort(CZipEntry const& src1, CZipEntry const& src2);
-
-		// Name of entry
-		CUtlSymbol		m_Name;
-
-		// Lenth of data element
-		int				m_nCompressedSize;
-
-		// Original, uncompressed size
-		int				m_nUncompressedSize;
+		// Entries own their payload, they move but never copy
+		CZipEntry(CZipEntry&& src);
+		CZipEntry& operator=(CZipEntry&& src);
+		CZipEntry(const CZipEntry&) = delete;
+		CZipEntry& operator=(const CZipEntry&) = delete;
 
 		// Raw data, could be null and data may be in disk write cache
 		void* m_pData;
+		// Size of the m_pData allocation
+		int				m_nDataSize;
 
 		// Offset in Zip ( set and valid during final write )
-		unsigned int	m_ZipOffset;
-		// CRC of blob
-		CRC32_t			m_ZipCRC;
+		uint64			m_ZipOffset;
 
-		// Location of data in disk cache
-		unsigned int	m_DiskCacheOffset;
-		unsigned int	m_SourceDiskOffset;
+		// Location of data in the spill arena, valid if m_bSpilled
+		uint64			m_DiskCacheOffset;
+		bool			m_bSpilled;
 
-		IZip::eCompressionType m_eCompressionType;
+		// Dedup state, a shared entry has no payload of its own
+		XZipContentKey_t	m_ContentKey;
+		bool			m_bHasContentKey;
+		bool			m_bSharedPayload;
 	};
 
-	CUtlRBTree< CZipEntry, int > m_Files;
+	// Names, sizes, offsets, codecs and CRCs
+	CXZipDirectory			m_Directory;
+	// Payloads, indexed by directory id
+	CUtlVector<CZipEntry>	m_Entries;
+	// Decoded payloads of hot compressed entries, by directory id
+	CXZipEntryCache			m_EntryCache;
+	// Runtime counters, see SetMetricsEnabled
+	CXZipMetrics			m_Metrics;
+	// Preloaded payload bytes, see m_Directory.m_PreloadOffsets
+	CUtlVector<unsigned char>	m_PreloadData;
+	// Size of the preload section, from the XZP comment or the last save
+	unsigned int			m_nPreloadSectionSize;
+	// Holders and claims of deduplicated payloads, see SetDeduplicate
+	CXZipContentTable		m_ContentTable;
+	// Decides which entries are worth compressing
+	CXZipCompressionPolicy	m_CompressionPolicy;
 
+	// Payloads of added entries, when built with a disk cache path
 	bool				m_bUseDiskCacheForWrites;
-	HANDLE				m_hDiskCacheWriteFile;
-	CUtlString			m_DiskCacheName;
+	CXZipSpillArena		m_SpillArena;
 	CUtlString			m_DiskCacheWritePath;
 
+	// Read-only mapping of the archive opened with OpenFromDisk (if any),
+	// or the buffer lent to OpenFromBorrowedBuffer
+	HANDLE				m_hArchiveMapping;
+	const unsigned char* m_pArchiveView;
+	unsigned int		m_nArchiveViewSize;
+	bool				m_bBorrowedView;
+	IRefCounted*		m_pArchiveOwner;
+
 public: // iterators
-	int				GetNextEntry(int id, CUtlSymbol& fileEntry, int& fileSize);
+	/**
+	 * Walks the directory in name order.
+	 *
+	 * \param id			-1 to start, otherwise the previous return value
+	 * \param pFileName		Receives the entry name, valid until the directory changes
+	 * \param fileSize		Receives the uncompressed size
+	 * \return Entry id, -1 at the end
+	 */
+	int				GetNextEntry(int id, const char*& pFileName, int& fileSize);
 };
 
 /**
@@ -0,0 +1,189 @@
+/*****************************************************************//**
+ * \file   xzip_index.cpp
+ * \brief  Open addressed hash index used for O(1) name lookups in
+ *			the XZip directory.
+ *********************************************************************/
+
+#include "xzip_index.h"
+
+//-----------------------------------------------------------------------------
+// Purpose: Construction
+//-----------------------------------------------------------------------------
+CXZipHashIndex::CXZipHashIndex(void)
+{
+	m_nCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Case folded FNV-1a, matches the Q_strlower'd names in the directory
+//-----------------------------------------------------------------------------
+unsigned int CXZipHashIndex::HashName(const char* pName)
+{
+	unsigned int nHash = 2166136261u;
+	for (const unsigned char* pScan = (const unsigned char*)pName; *pScan; ++pScan)
+	{
+		unsigned char c = *pScan;
+		if (c >= 'A' && c <= 'Z')
+		{
+			c += 'a' - 'A';
+		}
+
+		nHash ^= c;
+		nHash *= 16777619u;
+	}
+
+	return nHash;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Drop everything
+//-----------------------------------------------------------------------------
+void CXZipHashIndex::Purge(void)
+{
+	m_Slots.Purge();
+	m_nCount = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Size the table up front for a bulk load
+//-----------------------------------------------------------------------------
+void CXZipHashIndex::Reserve(int nEntries)
+{
+	int nSlots = 16;
+	while (nSlots < nEntries * 2)
+	{
+		nSlots <<= 1;
+	}
+
+	if (nSlots > m_Slots.Count())
+	{
+		Rehash(nSlots);
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Add an entry, grows the table to stay at most half full
+//-----------------------------------------------------------------------------
+void CXZipHashIndex::Insert(unsigned int nHash, int id)
+{
+	Assert(id >= 0);
+
+	if ((m_nCount + 1) * 2 > m_Slots.Count())
+	{
+		Rehash(Max(16, m_Slots.Count() * 2));
+	}
+
+	unsigned int nMask = m_Slots.Count() - 1;
+	unsigned int i = nHash & nMask;
+	while (m_Slots[i].m_nID >= 0)
+	{
+		i = (i + 1) & nMask;
+	}
+
+	m_Slots[i].m_nHash = nHash;
+	m_Slots[i].m_nID = id;
+	m_nCount++;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Slot holding an id, -1 if it is not in the table
+//-----------------------------------------------------------------------------
+int CXZipHashIndex::FindSlot(unsigned int nHash, int id) const
+{
+	if (!m_nCount)
+	{
+		return -1;
+	}
+
+	unsigned int nMask = m_Slots.Count() - 1;
+	for (unsigned int i = nHash & nMask; m_Slots[i].m_nID >= 0; i = (i + 1) & nMask)
+	{
+		if (m_Slots[i].m_nID == id)
+		{
+			return (int)i;
+		}
+	}
+
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Backward shift deletion, keeps every entry reachable from its
+//			home slot without leaving tombstones
+//-----------------------------------------------------------------------------
+void CXZipHashIndex::Remove(unsigned int nHash, int id)
+{
+	int nSlot = FindSlot(nHash, id);
+	Assert(nSlot >= 0);
+	if (nSlot < 0)
+	{
+		return;
+	}
+
+	unsigned int nMask = m_Slots.Count() - 1;
+	unsigned int i = (unsigned int)nSlot;
+	for (unsigned int j = (i + 1) & nMask; m_Slots[j].m_nID >= 0; j = (j + 1) & nMask)
+	{
+		// an entry whose home lies in (i, j] has to stay where it is
+		unsigned int nHome = m_Slots[j].m_nHash & nMask;
+		bool bStays = (i <= j) ? (i < nHome && nHome <= j) : (i < nHome || nHome <= j);
+		if (!bStays)
+		{
+			m_Slots[i] = m_Slots[j];
+			i = j;
+		}
+	}
+
+	m_Slots[i].m_nHash = 0;
+	m_Slots[i].m_nID = -1;
+	m_nCount--;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same name and hash, so the entry keeps its slot
+//-----------------------------------------------------------------------------
+void CXZipHashIndex::ChangeID(unsigned int nHash, int id, int newID)
+{
+	Assert(newID >= 0);
+
+	int nSlot = FindSlot(nHash, id);
+	Assert(nSlot >= 0);
+	if (nSlot >= 0)
+	{
+		m_Slots[nSlot].m_nID = newID;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Move all entries into a table of the given (power of two) size
+//-----------------------------------------------------------------------------
+void CXZipHashIndex::Rehash(int nSlots)
+{
+	Assert(IsPowerOfTwo(nSlots));
+
+	CUtlVector<Slot_t> oldSlots;
+	oldSlots.Swap(m_Slots);
+
+	m_Slots.SetCount(nSlots);
+	for (int i = 0; i < nSlots; i++)
+	{
+		m_Slots[i].m_nHash = 0;
+		m_Slots[i].m_nID = -1;
+	}
+
+	unsigned int nMask = nSlots - 1;
+	for (int i = 0; i < oldSlots.Count(); i++)
+	{
+		if (oldSlots[i].m_nID < 0)
+		{
+			continue;
+		}
+
+		unsigned int j = oldSlots[i].m_nHash & nMask;
+		while (m_Slots[j].m_nID >= 0)
+		{
+			j = (j + 1) & nMask;
+		}
+		m_Slots[j] = oldSlots[i];
+	}
+}
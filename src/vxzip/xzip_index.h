@@ -0,0 +1,118 @@
+/*****************************************************************//**
+ * \file   xzip_index.h
+ * \brief  Open addressed hash index used for O(1) name lookups in
+ *			the XZip directory.
+ *********************************************************************/
+#ifndef _XZIP_INDEX_H
+#define _XZIP_INDEX_H
+
+#pragma once
+
+#include "utlvector.h"
+
+/**
+ * Maps a case folded name hash to an entry id.
+ *
+ * Only hashes and ids are stored, the caller confirms a candidate through a
+ * match callback so the index never has to own or copy names. Lookups are
+ * const and never allocate, so they are safe from any number of threads
+ * while nobody inserts.
+ */
+class CXZipHashIndex
+{
+public:
+	CXZipHashIndex(void);
+
+	/**
+	 * Case folded FNV-1a hash of a name.
+	 *
+	 * \param pName	Name to hash
+	 * \return Hash value
+	 */
+	static unsigned int HashName(const char* pName);
+
+	/**
+	 * Removes every entry and frees the table.
+	 */
+	void	Purge(void);
+	/**
+	 * Sizes the table for a number of entries so bulk inserts don't rehash.
+	 *
+	 * \param nEntries	Expected number of entries
+	 */
+	void	Reserve(int nEntries);
+	/**
+	 * Adds an entry, the caller makes sure the id is not in the index yet.
+	 *
+	 * \param nHash	Hash of the entry name (see HashName)
+	 * \param id	Entry id, must not be negative
+	 */
+	void	Insert(unsigned int nHash, int id);
+	/**
+	 * Removes an entry, later entries of its probe run shift back so no
+	 * tombstones are left behind.
+	 *
+	 * \param nHash	Hash the entry was inserted with
+	 * \param id	Entry id
+	 */
+	void	Remove(unsigned int nHash, int id);
+	/**
+	 * Gives an entry a new id, for when an entry moves to another id.
+	 *
+	 * \param nHash	Hash the entry was inserted with
+	 * \param id	Current entry id
+	 * \param newID	New entry id, must not be in the index yet
+	 */
+	void	ChangeID(unsigned int nHash, int id, int newID);
+
+	/**
+	 * Looks up an entry.
+	 *
+	 * \param nHash		Hash of the name (see HashName)
+	 * \param isMatch	Callable taking an entry id, returns true if the entry
+	 *					has the name that was looked up
+	 * \return Entry id, -1 if not found
+	 */
+	template <class MATCH>
+	int		Find(unsigned int nHash, const MATCH& isMatch) const
+	{
+		if (!m_nCount)
+		{
+			return -1;
+		}
+
+		unsigned int nMask = m_Slots.Count() - 1;
+		for (unsigned int i = nHash & nMask; ; i = (i + 1) & nMask)
+		{
+			const Slot_t& slot = m_Slots[i];
+			if (slot.m_nID < 0)
+			{
+				// hit an empty slot, not in the table
+				return -1;
+			}
+
+			if (slot.m_nHash == nHash && isMatch(slot.m_nID))
+			{
+				return slot.m_nID;
+			}
+		}
+	}
+
+	int		Count(void) const { return m_nCount; }
+
+private:
+	struct Slot_t
+	{
+		unsigned int	m_nHash;
+		int				m_nID;		// -1 when empty
+	};
+
+	void	Rehash(int nSlots);
+	int		FindSlot(unsigned int nHash, int id) const;
+
+	// Power of two sized, kept at most half full so probes stay short
+	CUtlVector<Slot_t>	m_Slots;
+	int					m_nCount;
+};
+
+#endif // _XZIP_INDEX_H
@@ -0,0 +1,258 @@
+/*****************************************************************//**
+ * \file   xzip_metrics.cpp
+ * \brief  Runtime counters and latency histograms of a pak.
+ *********************************************************************/
+
+#include <string.h>
+
+#include "xzip_metrics.h"
+#include "xzip_codec.h"
+
+static const char* s_CounterNames[XZIP_COUNTER_COUNT] =
+{
+	"lookups",
+	"lookup_misses",
+	"cache_hits",
+	"cache_misses",
+	"reads",
+	"bytes_read",
+	"bytes_decompressed",
+	"adds",
+	"add_bytes_in",
+	"add_bytes_out",
+	"add_stored",
+	"add_shared",
+};
+
+static const int s_SlotCodecs[XZIP_METRICS_CODECS] =
+{
+	IZip::eCompressionType_None,
+	IZip::eCompressionType_LZMA,
+	XZIP_COMPRESSION_ZSTD,
+	XZIP_COMPRESSION_LZ4,
+};
+
+CXZipMetrics::CXZipMetrics(void)
+{
+	m_bEnabled = false;
+	Reset();
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Threads take shards round robin on first use, so a handful of
+//			readers never share one
+//-----------------------------------------------------------------------------
+CXZipMetrics::Shard_t& CXZipMetrics::GetShard(void)
+{
+	static std::atomic<unsigned int> s_nNextShard = 0;
+	thread_local unsigned int t_nShard = s_nNextShard.fetch_add(1, std::memory_order_relaxed) % SHARD_COUNT;
+
+	return m_Shards[t_nShard];
+}
+
+void CXZipMetrics::Add(XZipCounter_t counter, uint64 nValue)
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	GetShard().m_Counters[counter].fetch_add(nValue, std::memory_order_relaxed);
+}
+
+void CXZipMetrics::AddDecode(int nCompressionType, uint64 nTime, uint64 nBytes)
+{
+	int nSlot = GetCodecSlot(nCompressionType);
+	if (!IsEnabled() || nSlot < 0)
+	{
+		return;
+	}
+
+	Shard_t& shard = GetShard();
+	shard.m_DecodeTime[nSlot].fetch_add(nTime, std::memory_order_relaxed);
+	shard.m_DecodeBytes[nSlot].fetch_add(nBytes, std::memory_order_relaxed);
+	shard.m_Counters[XZIP_COUNTER_BYTES_DECOMPRESSED].fetch_add(nBytes, std::memory_order_relaxed);
+}
+
+void CXZipMetrics::AddEncode(int nCompressionType, uint64 nTime, uint64 nBytesIn, uint64 nBytesOut)
+{
+	int nSlot = GetCodecSlot(nCompressionType);
+	if (!IsEnabled() || nSlot < 0)
+	{
+		return;
+	}
+
+	Shard_t& shard = GetShard();
+	shard.m_EncodeTime[nSlot].fetch_add(nTime, std::memory_order_relaxed);
+	shard.m_EncodeBytesIn[nSlot].fetch_add(nBytesIn, std::memory_order_relaxed);
+	shard.m_EncodeBytesOut[nSlot].fetch_add(nBytesOut, std::memory_order_relaxed);
+}
+
+void CXZipMetrics::AddRead(uint64 nTime)
+{
+	if (!IsEnabled())
+	{
+		return;
+	}
+
+	// log2 of the microseconds
+	uint64 nMicroseconds = nTime / 1000;
+	int nBucket = 0;
+	while (nMicroseconds > 1 && nBucket < XZIP_METRICS_BUCKETS - 1)
+	{
+		nMicroseconds >>= 1;
+		nBucket++;
+	}
+
+	Shard_t& shard = GetShard();
+	shard.m_Counters[XZIP_COUNTER_READS].fetch_add(1, std::memory_order_relaxed);
+	shard.m_ReadLatency[nBucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+void CXZipMetrics::Snapshot(XZipMetricsSnapshot_t& snapshot) const
+{
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	for (int s = 0; s < SHARD_COUNT; s++)
+	{
+		const Shard_t& shard = m_Shards[s];
+		for (int i = 0; i < XZIP_COUNTER_COUNT; i++)
+		{
+			snapshot.m_Counters[i] += shard.m_Counters[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < XZIP_METRICS_CODECS; i++)
+		{
+			snapshot.m_DecodeTime[i] += shard.m_DecodeTime[i].load(std::memory_order_relaxed);
+			snapshot.m_DecodeBytes[i] += shard.m_DecodeBytes[i].load(std::memory_order_relaxed);
+			snapshot.m_EncodeTime[i] += shard.m_EncodeTime[i].load(std::memory_order_relaxed);
+			snapshot.m_EncodeBytesIn[i] += shard.m_EncodeBytesIn[i].load(std::memory_order_relaxed);
+			snapshot.m_EncodeBytesOut[i] += shard.m_EncodeBytesOut[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < XZIP_METRICS_BUCKETS; i++)
+		{
+			snapshot.m_ReadLatency[i] += shard.m_ReadLatency[i].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Not atomic as a whole, adds racing the reset may survive it
+//-----------------------------------------------------------------------------
+void CXZipMetrics::Reset(void)
+{
+	for (int s = 0; s < SHARD_COUNT; s++)
+	{
+		Shard_t& shard = m_Shards[s];
+		for (int i = 0; i < XZIP_COUNTER_COUNT; i++)
+		{
+			shard.m_Counters[i].store(0, std::memory_order_relaxed);
+		}
+		for (int i = 0; i < XZIP_METRICS_CODECS; i++)
+		{
+			shard.m_DecodeTime[i].store(0, std::memory_order_relaxed);
+			shard.m_DecodeBytes[i].store(0, std::memory_order_relaxed);
+			shard.m_EncodeTime[i].store(0, std::memory_order_relaxed);
+			shard.m_EncodeBytesIn[i].store(0, std::memory_order_relaxed);
+			shard.m_EncodeBytesOut[i].store(0, std::memory_order_relaxed);
+		}
+		for (int i = 0; i < XZIP_METRICS_BUCKETS; i++)
+		{
+			shard.m_ReadLatency[i].store(0, std::memory_order_relaxed);
+		}
+	}
+}
+
+uint64 CXZipMetrics::Now(void)
+{
+	static LARGE_INTEGER s_Frequency = { 0 };
+	if (!s_Frequency.QuadPart)
+	{
+		QueryPerformanceFrequency(&s_Frequency);
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	// split to keep the multiply from overflowing
+	uint64 nSeconds = counter.QuadPart / s_Frequency.QuadPart;
+	uint64 nRemainder = counter.QuadPart % s_Frequency.QuadPart;
+	return nSeconds * 1000000000ull + nRemainder * 1000000000ull / s_Frequency.QuadPart;
+}
+
+int CXZipMetrics::GetCodecSlot(int nCompressionType)
+{
+	for (int i = 0; i < XZIP_METRICS_CODECS; i++)
+	{
+		if (s_SlotCodecs[i] == nCompressionType)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+int CXZipMetrics::GetSlotCodec(int nSlot)
+{
+	return s_SlotCodecs[nSlot];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Times go out in milliseconds, latency percentiles are the upper
+//			bound of the bucket holding them
+//-----------------------------------------------------------------------------
+void XZipMetricsSnapshot_t::WriteJSON(CUtlBuffer& buf) const
+{
+	buf.Printf("{\n  \"counters\": {");
+	for (int i = 0; i < XZIP_COUNTER_COUNT; i++)
+	{
+		buf.Printf("%s\n    \"%s\": %llu", i ? "," : "", s_CounterNames[i], (unsigned long long)m_Counters[i]);
+	}
+	buf.Printf("\n  },\n");
+
+	uint64 nAddBytesIn = m_Counters[XZIP_COUNTER_ADD_BYTES_IN];
+	buf.Printf("  \"add_ratio\": %.4f,\n", nAddBytesIn ? (double)m_Counters[XZIP_COUNTER_ADD_BYTES_OUT] / nAddBytesIn : 1.0);
+
+	buf.Printf("  \"codecs\": {");
+	for (int i = 0; i < XZIP_METRICS_CODECS; i++)
+	{
+		buf.Printf("%s\n    \"%s\": { \"decode_ms\": %.3f, \"decode_bytes\": %llu, "
+			"\"encode_ms\": %.3f, \"encode_bytes_in\": %llu, \"encode_bytes_out\": %llu, \"encode_ratio\": %.4f }",
+			i ? "," : "", CXZipCodec::GetName(CXZipMetrics::GetSlotCodec(i)),
+			m_DecodeTime[i] / 1e6, (unsigned long long)m_DecodeBytes[i],
+			m_EncodeTime[i] / 1e6, (unsigned long long)m_EncodeBytesIn[i], (unsigned long long)m_EncodeBytesOut[i],
+			m_EncodeBytesIn[i] ? (double)m_EncodeBytesOut[i] / m_EncodeBytesIn[i] : 1.0);
+	}
+	buf.Printf("\n  },\n");
+
+	uint64 nReads = 0;
+	for (int i = 0; i < XZIP_METRICS_BUCKETS; i++)
+	{
+		nReads += m_ReadLatency[i];
+	}
+
+	const double percentiles[] = { 0.50, 0.90, 0.99 };
+	const char* percentileNames[] = { "p50", "p90", "p99" };
+
+	buf.Printf("  \"read_latency_us\": {\n    \"count\": %llu", (unsigned long long)nReads);
+	for (int p = 0; p < ARRAYSIZE(percentiles); p++)
+	{
+		uint64 nRank = (uint64)(percentiles[p] * nReads + 0.999999);
+		uint64 nSeen = 0;
+		int nBucket = 0;
+		while (nBucket < XZIP_METRICS_BUCKETS - 1 && nSeen + m_ReadLatency[nBucket] < nRank)
+		{
+			nSeen += m_ReadLatency[nBucket];
+			nBucket++;
+		}
+		buf.Printf(",\n    \"%s\": %llu", percentileNames[p], nReads ? (2ull << nBucket) : 0ull);
+	}
+
+	// keyed by the upper bound of each bucket
+	buf.Printf(",\n    \"histogram\": {");
+	for (int i = 0; i < XZIP_METRICS_BUCKETS; i++)
+	{
+		buf.Printf("%s \"%llu\": %llu", i ? "," : "", 2ull << i, (unsigned long long)m_ReadLatency[i]);
+	}
+	buf.Printf(" }\n  }\n}\n");
+}
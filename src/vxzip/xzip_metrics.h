@@ -0,0 +1,168 @@
+/*****************************************************************//**
+ * \file   xzip_metrics.h
+ * \brief  Runtime counters and latency histograms of a pak.
+ *********************************************************************/
+#ifndef _XZIP_METRICS_H
+#define _XZIP_METRICS_H
+
+#pragma once
+
+#include <atomic>
+
+#include "source_sdk.h"
+
+/**
+ * Counters kept by CXZipMetrics.
+ */
+enum XZipCounter_t
+{
+	XZIP_COUNTER_LOOKUPS,			// name lookups on the read side
+	XZIP_COUNTER_LOOKUP_MISSES,		// ... that found nothing
+	XZIP_COUNTER_CACHE_HITS,		// entry cache, see CXZipFile::SetCacheBudget
+	XZIP_COUNTER_CACHE_MISSES,
+	XZIP_COUNTER_READS,				// ReadEntry and StreamEntry calls
+	XZIP_COUNTER_BYTES_READ,		// payload bytes consumed, compressed or stored
+	XZIP_COUNTER_BYTES_DECOMPRESSED,	// bytes produced by a decoder
+	XZIP_COUNTER_ADDS,				// PrepareBuffer calls
+	XZIP_COUNTER_ADD_BYTES_IN,		// uncompressed bytes added
+	XZIP_COUNTER_ADD_BYTES_OUT,		// bytes stored for them
+	XZIP_COUNTER_ADD_STORED,		// compression asked for but not worth it
+	XZIP_COUNTER_ADD_SHARED,		// payloads found by deduplication
+
+	XZIP_COUNTER_COUNT
+};
+
+/**
+ * Codecs with their own timing: none, LZMA, zstd and LZ4.
+ */
+#define XZIP_METRICS_CODECS 4
+
+/**
+ * Latency histogram buckets, bucket b counts [2^b, 2^(b+1)) microseconds
+ * and the first one everything below 2 us.
+ */
+#define XZIP_METRICS_BUCKETS 24
+
+/**
+ * Point in time copy of the metrics, plain numbers. Times are in nanoseconds.
+ */
+struct XZipMetricsSnapshot_t
+{
+	uint64	m_Counters[XZIP_COUNTER_COUNT];
+
+	// per codec slot, see CXZipMetrics::GetCodecSlot
+	uint64	m_DecodeTime[XZIP_METRICS_CODECS];
+	uint64	m_DecodeBytes[XZIP_METRICS_CODECS];
+	uint64	m_EncodeTime[XZIP_METRICS_CODECS];
+	uint64	m_EncodeBytesIn[XZIP_METRICS_CODECS];
+	uint64	m_EncodeBytesOut[XZIP_METRICS_CODECS];
+
+	uint64	m_ReadLatency[XZIP_METRICS_BUCKETS];
+
+	/**
+	 * Appends the snapshot as a JSON object.
+	 *
+	 * \param buf	Text buffer
+	 */
+	void	WriteJSON(CUtlBuffer& buf) const;
+};
+
+/**
+ * Metrics of a pak. Off by default; when off, every call is a relaxed load
+ * and a branch, no clock is read.
+ *
+ * Threads add to their own cache line aligned shard with relaxed atomics, so
+ * readers on several threads do not fight over the counters. A snapshot sums
+ * the shards, it is consistent per value but not across values.
+ */
+class CXZipMetrics
+{
+public:
+	CXZipMetrics(void);
+
+	void			SetEnabled(bool bEnabled) { m_bEnabled.store(bEnabled, std::memory_order_relaxed); }
+	bool			IsEnabled(void) const { return m_bEnabled.load(std::memory_order_relaxed); }
+
+	void			Add(XZipCounter_t counter, uint64 nValue = 1);
+	/**
+	 * \param nCompressionType	Codec
+	 * \param nTime				Time spent decoding
+	 * \param nBytes			Bytes decoded
+	 */
+	void			AddDecode(int nCompressionType, uint64 nTime, uint64 nBytes);
+	/**
+	 * \param nCompressionType	Codec
+	 * \param nTime				Time spent compressing
+	 * \param nBytesIn			Uncompressed bytes
+	 * \param nBytesOut			Compressed bytes
+	 */
+	void			AddEncode(int nCompressionType, uint64 nTime, uint64 nBytesIn, uint64 nBytesOut);
+	/**
+	 * Counts a read and puts its latency in the histogram.
+	 */
+	void			AddRead(uint64 nTime);
+
+	void			Snapshot(XZipMetricsSnapshot_t& snapshot) const;
+	void			Reset(void);
+
+	/**
+	 * \return Monotonic time in nanoseconds
+	 */
+	static uint64	Now(void);
+	/**
+	 * \return Slot of a codec in the per codec arrays, -1 if it has none
+	 */
+	static int		GetCodecSlot(int nCompressionType);
+	/**
+	 * \return Codec of a slot
+	 */
+	static int		GetSlotCodec(int nSlot);
+
+private:
+	CXZipMetrics(const CXZipMetrics&) = delete;
+	CXZipMetrics& operator=(const CXZipMetrics&) = delete;
+
+	struct alignas(64) Shard_t
+	{
+		std::atomic<uint64>	m_Counters[XZIP_COUNTER_COUNT];
+		std::atomic<uint64>	m_DecodeTime[XZIP_METRICS_CODECS];
+		std::atomic<uint64>	m_DecodeBytes[XZIP_METRICS_CODECS];
+		std::atomic<uint64>	m_EncodeTime[XZIP_METRICS_CODECS];
+		std::atomic<uint64>	m_EncodeBytesIn[XZIP_METRICS_CODECS];
+		std::atomic<uint64>	m_EncodeBytesOut[XZIP_METRICS_CODECS];
+		std::atomic<uint64>	m_ReadLatency[XZIP_METRICS_BUCKETS];
+	};
+
+	enum { SHARD_COUNT = 16 };
+
+	Shard_t&		GetShard(void);
+
+	std::atomic<bool>	m_bEnabled;
+	Shard_t				m_Shards[SHARD_COUNT];
+};
+
+/**
+ * Times a read for CXZipMetrics::AddRead, from construction to destruction.
+ */
+class CXZipReadTimer
+{
+public:
+	CXZipReadTimer(CXZipMetrics& metrics) : m_Metrics(metrics)
+	{
+		m_nStart = metrics.IsEnabled() ? CXZipMetrics::Now() : 0;
+	}
+
+	~CXZipReadTimer(void)
+	{
+		if (m_nStart)
+		{
+			m_Metrics.AddRead(CXZipMetrics::Now() - m_nStart);
+		}
+	}
+
+private:
+	CXZipMetrics&	m_Metrics;
+	uint64			m_nStart;
+};
+
+#endif // _XZIP_METRICS_H
@@ -0,0 +1,123 @@
+/*****************************************************************//**
+ * \file   xzip_policy.cpp
+ * \brief  Decides whether an entry is worth compressing.
+ *********************************************************************/
+
+#include <math.h>
+#include <string.h>
+
+#include "xzip_policy.h"
+
+// bytes looked at per sample, and how many samples are spread over the data
+#define POLICY_SAMPLE_SIZE	(16 * 1024)
+#define POLICY_SAMPLE_COUNT	4
+
+// below this the estimate is noise, leave it to the check after compressing
+#define POLICY_MIN_ESTIMATE_SIZE 4096
+
+CXZipCompressionPolicy::CXZipCompressionPolicy(void) : m_flMinGain(XZIP_DEFAULT_MIN_GAIN)
+{
+}
+
+void CXZipCompressionPolicy::SetMinGain(float flMinGain)
+{
+	if (flMinGain < 0.0f)
+	{
+		flMinGain = 0.0f;
+	}
+	else if (flMinGain > 1.0f)
+	{
+		flMinGain = 1.0f;
+	}
+
+	m_flMinGain = flMinGain;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Histograms the samples, four tables so neighbouring bytes do not
+//			stall on the same counter
+//-----------------------------------------------------------------------------
+float CXZipCompressionPolicy::EstimateEntropy(const void* pData, int nSize)
+{
+	if (nSize <= 0)
+	{
+		return 0.0f;
+	}
+
+	const unsigned char* pBytes = (const unsigned char*)pData;
+
+	unsigned int counts[4][256];
+	memset(counts, 0, sizeof(counts));
+
+	int nSampleSize = POLICY_SAMPLE_SIZE;
+	int nSamples = POLICY_SAMPLE_COUNT;
+	if (nSize <= nSampleSize * nSamples)
+	{
+		nSampleSize = nSize;
+		nSamples = 1;
+	}
+
+	int nTotal = 0;
+	for (int iSample = 0; iSample < nSamples; iSample++)
+	{
+		// first sample at the start, last one at the end
+		int nStart = nSamples > 1 ? (int)(((long long)(nSize - nSampleSize) * iSample) / (nSamples - 1)) : 0;
+		const unsigned char* p = pBytes + nStart;
+
+		int i = 0;
+		for (; i + 4 <= nSampleSize; i += 4)
+		{
+			counts[0][p[i + 0]]++;
+			counts[1][p[i + 1]]++;
+			counts[2][p[i + 2]]++;
+			counts[3][p[i + 3]]++;
+		}
+		for (; i < nSampleSize; i++)
+		{
+			counts[0][p[i]]++;
+		}
+
+		nTotal += nSampleSize;
+	}
+
+	float flEntropy = 0.0f;
+	float flInvTotal = 1.0f / (float)nTotal;
+	for (int c = 0; c < 256; c++)
+	{
+		unsigned int nCount = counts[0][c] + counts[1][c] + counts[2][c] + counts[3][c];
+		if (nCount)
+		{
+			float p = (float)nCount * flInvTotal;
+			flEntropy -= p * log2f(p);
+		}
+	}
+
+	return flEntropy;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Order-0 entropy ignores repeated strings, so it underestimates
+//			what the codecs get out of most data. That is fine here: only data
+//			that is close to random on a byte level gets rejected.
+//-----------------------------------------------------------------------------
+bool CXZipCompressionPolicy::ShouldCompress(const void* pData, int nSize) const
+{
+	if (nSize < POLICY_MIN_ESTIMATE_SIZE)
+	{
+		return true;
+	}
+
+	float flEstimatedGain = 1.0f - EstimateEntropy(pData, nSize) / 8.0f;
+	return flEstimatedGain >= m_flMinGain;
+}
+
+bool CXZipCompressionPolicy::IsWorthwhile(int nUncompressedSize, int nCompressedSize) const
+{
+	if (nCompressedSize >= nUncompressedSize)
+	{
+		return false;
+	}
+
+	float flGain = (float)(nUncompressedSize - nCompressedSize) / (float)nUncompressedSize;
+	return flGain >= m_flMinGain;
+}
@@ -0,0 +1,66 @@
+/*****************************************************************//**
+ * \file   xzip_policy.h
+ * \brief  Decides whether an entry is worth compressing.
+ *********************************************************************/
+#ifndef _XZIP_POLICY_H
+#define _XZIP_POLICY_H
+
+#pragma once
+
+/**
+ * Default minimum saving for a compressed entry, as a fraction of its size.
+ */
+#define XZIP_DEFAULT_MIN_GAIN 0.02f
+
+/**
+ * Compression policy for compressed entries.
+ *
+ * Already compressed content (DXT textures, mp3, ogg, ...) comes out of the
+ * codec the same size or larger and just costs build time and a decode on every
+ * read. Before compressing, the byte entropy of a few samples gives a cheap
+ * estimate of the gain. After compressing, the real gain is checked. Either
+ * one falling short of the minimum gain stores the entry as is.
+ */
+class CXZipCompressionPolicy
+{
+public:
+	CXZipCompressionPolicy(void);
+
+	/**
+	 * \param flMinGain	Minimum saving as a fraction of the size (0.02 is 2%),
+	 *					0 only refuses compression that does not shrink anything
+	 */
+	void	SetMinGain(float flMinGain);
+	float	GetMinGain(void) const { return m_flMinGain; }
+
+	/**
+	 * Order-0 entropy of samples spread over the data.
+	 *
+	 * \param pData		Data to estimate
+	 * \param nSize		Size of the data
+	 * \return Estimated bits per byte, 0..8
+	 */
+	static float EstimateEntropy(const void* pData, int nSize);
+
+	/**
+	 * Check before compressing.
+	 *
+	 * \param pData		Uncompressed data
+	 * \param nSize		Size of the data
+	 * \return False if the data looks incompressible
+	 */
+	bool	ShouldCompress(const void* pData, int nSize) const;
+	/**
+	 * Check after compressing.
+	 *
+	 * \param nUncompressedSize	Size of the data
+	 * \param nCompressedSize	Size of the compressed payload
+	 * \return True if the compressed payload should be kept
+	 */
+	bool	IsWorthwhile(int nUncompressedSize, int nCompressedSize) const;
+
+private:
+	float	m_flMinGain;
+};
+
+#endif // _XZIP_POLICY_H
@@ -0,0 +1,164 @@
+/*****************************************************************//**
+ * \file   xzip_spill.cpp
+ * \brief  Append-only temp file holding payloads of a pak being built.
+ *********************************************************************/
+
+#include "xzip_spill.h"
+
+CXZipSpillArena::CXZipSpillArena(void)
+{
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_pWriter = NULL;
+	m_bWriteFailed = false;
+	m_hMapping = INVALID_HANDLE_VALUE;
+	m_nMappingSize = 0;
+	m_pView = NULL;
+	m_nViewOffset = 0;
+	m_nViewSize = 0;
+}
+
+CXZipSpillArena::~CXZipSpillArena(void)
+{
+	Close();
+}
+
+bool CXZipSpillArena::Open(CUtlString& writePath)
+{
+	Close();
+
+	m_hFile = CWin32File::CreateTempFile(writePath, m_FileName);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	m_pWriter = new CBufferedFileStream(m_hFile);
+	m_bWriteFailed = false;
+	return true;
+}
+
+void CXZipSpillArena::Close(void)
+{
+	CloseView();
+	if (m_hMapping != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hMapping);
+		m_hMapping = INVALID_HANDLE_VALUE;
+	}
+	m_nMappingSize = 0;
+
+	delete m_pWriter;
+	m_pWriter = NULL;
+
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		DeleteFile(m_FileName.String());
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+void CXZipSpillArena::CloseView(void)
+{
+	if (m_pView)
+	{
+		UnmapViewOfFile(m_pView);
+		m_pView = NULL;
+	}
+	m_nViewOffset = 0;
+	m_nViewSize = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The stream batches small payloads into large writes
+//-----------------------------------------------------------------------------
+uint64 CXZipSpillArena::Append(const void* pData, int nSize)
+{
+	if (!m_pWriter)
+	{
+		return (uint64)-1;
+	}
+
+	uint64 nOffset = m_pWriter->Tell();
+	m_pWriter->Put(pData, nSize);
+	if (!m_pWriter->IsValid())
+	{
+		if (!m_bWriteFailed)
+		{
+			Warning("Zip: Failed writing to the spill file %s\n", m_FileName.String());
+			m_bWriteFailed = true;
+		}
+		return (uint64)-1;
+	}
+
+	return nOffset;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Payloads are mostly read back in the order they went in, the
+//			window only moves every XZIP_SPILL_VIEW_SIZE bytes
+//-----------------------------------------------------------------------------
+const void* CXZipSpillArena::View(uint64 nOffset, int nSize)
+{
+	if (!m_pWriter || nSize <= 0)
+	{
+		return NULL;
+	}
+
+	uint64 nEnd = nOffset + (uint64)nSize;
+	if (m_pView && nOffset >= m_nViewOffset && nEnd <= m_nViewOffset + m_nViewSize)
+	{
+		return m_pView + (nOffset - m_nViewOffset);
+	}
+
+	// everything appended so far has to be in the file
+	m_pWriter->Flush();
+	uint64 nFileSize = m_pWriter->Tell();
+	if (!m_pWriter->IsValid() || nEnd > nFileSize)
+	{
+		return NULL;
+	}
+
+	CloseView();
+
+	if (nFileSize > m_nMappingSize)
+	{
+		if (m_hMapping != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(m_hMapping);
+		}
+
+		m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (!m_hMapping)
+		{
+			m_hMapping = INVALID_HANDLE_VALUE;
+			m_nMappingSize = 0;
+			return NULL;
+		}
+
+		m_nMappingSize = nFileSize;
+	}
+
+	static unsigned int s_nGranularity = 0;
+	if (!s_nGranularity)
+	{
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		s_nGranularity = info.dwAllocationGranularity;
+	}
+
+	// views start on the allocation granularity
+	uint64 nViewOffset = nOffset - (nOffset % s_nGranularity);
+	uint64 nViewEnd = Min(Max(nEnd, nViewOffset + XZIP_SPILL_VIEW_SIZE), m_nMappingSize);
+
+	m_pView = (const unsigned char*)MapViewOfFile(m_hMapping, FILE_MAP_READ,
+		(DWORD)(nViewOffset >> 32), (DWORD)nViewOffset, (SIZE_T)(nViewEnd - nViewOffset));
+	if (!m_pView)
+	{
+		return NULL;
+	}
+
+	m_nViewOffset = nViewOffset;
+	m_nViewSize = nViewEnd - nViewOffset;
+	return m_pView + (nOffset - m_nViewOffset);
+}
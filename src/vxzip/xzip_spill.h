@@ -0,0 +1,83 @@
+/*****************************************************************//**
+ * \file   xzip_spill.h
+ * \brief  Append-only temp file holding payloads of a pak being built.
+ *********************************************************************/
+#ifndef _XZIP_SPILL_H
+#define _XZIP_SPILL_H
+
+#pragma once
+
+#include "source_sdk.h"
+
+/**
+ * Size of the window mapped by CXZipSpillArena::View.
+ */
+#define XZIP_SPILL_VIEW_SIZE (64 * 1024 * 1024)
+
+/**
+ * Spill arena for payloads that should not stay in memory.
+ *
+ * Payloads are appended through a buffered stream and keep their offset for
+ * the life of the arena. They are read back through a mapped window that
+ * slides along the file, so saving needs no allocation or seek per entry and
+ * a 32 bit process can spill more than it could map at once.
+ */
+class CXZipSpillArena
+{
+public:
+	CXZipSpillArena(void);
+	~CXZipSpillArena(void);
+
+	/**
+	 * Creates the temp file.
+	 *
+	 * \param writePath	Folder for the temp file, empty for the working directory
+	 * \return False on failure
+	 */
+	bool			Open(CUtlString& writePath);
+	/**
+	 * Unmaps, closes and deletes the temp file.
+	 */
+	void			Close(void);
+	bool			IsOpen(void) const { return m_hFile != INVALID_HANDLE_VALUE; }
+
+	/**
+	 * Appends a payload. Not thread safe.
+	 *
+	 * \param pData		Payload
+	 * \param nSize		Size of the payload
+	 * \return Offset of the payload, (uint64)-1 on failure
+	 */
+	uint64			Append(const void* pData, int nSize);
+
+	/**
+	 * Maps a payload. Not thread safe.
+	 *
+	 * \param nOffset	Offset returned by Append
+	 * \param nSize		Size of the payload
+	 * \return The payload, valid until the next View or Close. NULL on failure.
+	 */
+	const void*		View(uint64 nOffset, int nSize);
+
+private:
+	CXZipSpillArena(const CXZipSpillArena&) = delete;
+	CXZipSpillArena& operator=(const CXZipSpillArena&) = delete;
+
+	void			CloseView(void);
+
+	HANDLE					m_hFile;
+	CUtlString				m_FileName;
+	CBufferedFileStream*	m_pWriter;
+	bool					m_bWriteFailed;
+
+	// mapping of the file, recreated when the file grew past it
+	HANDLE					m_hMapping;
+	uint64					m_nMappingSize;
+
+	// current window
+	const unsigned char*	m_pView;
+	uint64					m_nViewOffset;
+	uint64					m_nViewSize;
+};
+
+#endif // _XZIP_SPILL_H
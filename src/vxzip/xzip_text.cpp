@@ -0,0 +1,369 @@
+/*****************************************************************//**
+ * \file   xzip_text.cpp
+ * \brief  Line ending transforms for text mode entries.
+ *********************************************************************/
+
+#include <string.h>
+
+#include "xzip_text.h"
+#include "tier0/dbg.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <immintrin.h>
+#define XZIP_SSE2
+#ifdef _MSC_VER
+#include <intrin.h>
+#define XZIP_TARGET_AVX2
+#else
+#define XZIP_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+//-----------------------------------------------------------------------------
+// Scalar versions, also used for the tails of the SIMD versions
+//-----------------------------------------------------------------------------
+static int CountLineFeeds_Scalar(const char* pSrc, int nSrcSize)
+{
+	int numLineFeeds = 0;
+	for (int i = 0; i < nSrcSize; i++)
+	{
+		numLineFeeds += (pSrc[i] == '\n');
+	}
+	return numLineFeeds;
+}
+
+static char* Expand_Scalar(char* pDst, const char* pSrc, int nSrcSize)
+{
+	const char* pSrcEnd = pSrc + nSrcSize;
+	for (; pSrc < pSrcEnd; pSrc++)
+	{
+		if (*pSrc == '\n')
+		{
+			*pDst++ = '\r';
+		}
+		*pDst++ = *pSrc;
+	}
+	return pDst;
+}
+
+/**
+ * Collapses [pSrc, pSrcEnd) into pDst. pSrcLimit is the real end of the data,
+ * so a CR at the end of the range can still see the LF after it.
+ */
+static char* Collapse_Scalar(char* pDst, const char* pSrc, const char* pSrcEnd, const char* pSrcLimit)
+{
+	for (; pSrc < pSrcEnd; pSrc++)
+	{
+		if (*pSrc == '\r' && pSrc + 1 < pSrcLimit && pSrc[1] == '\n')
+		{
+			continue;
+		}
+		*pDst++ = *pSrc;
+	}
+	return pDst;
+}
+
+#ifndef XZIP_SSE2
+static int GetExpandedLength_Scalar(const char* pSrc, int nSrcSize)
+{
+	return nSrcSize + CountLineFeeds_Scalar(pSrc, nSrcSize);
+}
+
+static int Collapse_ScalarAll(char* pData, int nSize)
+{
+	return (int)(Collapse_Scalar(pData, pData, pData + nSize, pData + nSize) - pData);
+}
+#else
+/**
+ * Index of the lowest set bit, mask must not be zero.
+ */
+static inline int LowestBitIndex(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// SSE2, 16 bytes at a time
+//-----------------------------------------------------------------------------
+static int GetExpandedLength_SSE2(const char* pSrc, int nSrcSize)
+{
+	const __m128i lineFeed = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+	int numLineFeeds = 0;
+	while (i + 16 <= nSrcSize)
+	{
+		// count per byte lane (compare yields -1), flush before a lane can wrap
+		__m128i counts = _mm_setzero_si128();
+		for (int nBlocks = 0; nBlocks < 255 && i + 16 <= nSrcSize; nBlocks++, i += 16)
+		{
+			__m128i block = _mm_loadu_si128((const __m128i*)(pSrc + i));
+			counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(block, lineFeed));
+		}
+
+		__m128i sums = _mm_sad_epu8(counts, zero);
+		numLineFeeds += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+	}
+
+	return nSrcSize + numLineFeeds + CountLineFeeds_Scalar(pSrc + i, nSrcSize - i);
+}
+
+static char* ExpandRange_SSE2(char* pDst, const char* pSrc, int nSrcSize)
+{
+	const __m128i lineFeed = _mm_set1_epi8('\n');
+
+	int i = 0;
+	for (; i + 16 <= nSrcSize; i += 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(pSrc + i));
+		unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, lineFeed));
+		if (!mask)
+		{
+			_mm_storeu_si128((__m128i*)pDst, block);
+			pDst += 16;
+			continue;
+		}
+
+		// copy the runs between line feeds, inserting a CR before each
+		int start = 0;
+		while (mask)
+		{
+			int index = LowestBitIndex(mask);
+			memcpy(pDst, pSrc + i + start, index - start);
+			pDst += index - start;
+			*pDst++ = '\r';
+			*pDst++ = '\n';
+			start = index + 1;
+			mask &= mask - 1;
+		}
+		memcpy(pDst, pSrc + i + start, 16 - start);
+		pDst += 16 - start;
+	}
+
+	return Expand_Scalar(pDst, pSrc + i, nSrcSize - i);
+}
+
+static int Collapse_SSE2(char* pData, int nSize)
+{
+	const __m128i carriageReturn = _mm_set1_epi8('\r');
+	const __m128i lineFeed = _mm_set1_epi8('\n');
+
+	// the write position never passes the read position, so in place is safe
+	char* pDst = pData;
+	int i = 0;
+	for (; i + 17 <= nSize; i += 16)
+	{
+		__m128i block = _mm_loadu_si128((const __m128i*)(pData + i));
+		__m128i next = _mm_loadu_si128((const __m128i*)(pData + i + 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(block, carriageReturn), _mm_cmpeq_epi8(next, lineFeed)));
+		if (!mask)
+		{
+			_mm_storeu_si128((__m128i*)pDst, block);
+			pDst += 16;
+			continue;
+		}
+
+		// copy the runs between the CRs that get dropped
+		int start = 0;
+		while (mask)
+		{
+			int index = LowestBitIndex(mask);
+			memmove(pDst, pData + i + start, index - start);
+			pDst += index - start;
+			start = index + 1;
+			mask &= mask - 1;
+		}
+		memmove(pDst, pData + i + start, 16 - start);
+		pDst += 16 - start;
+	}
+
+	return (int)(Collapse_Scalar(pDst, pData + i, pData + nSize, pData + nSize) - pData);
+}
+
+//-----------------------------------------------------------------------------
+// AVX2, 32 bytes at a time
+//-----------------------------------------------------------------------------
+XZIP_TARGET_AVX2 static int GetExpandedLength_AVX2(const char* pSrc, int nSrcSize)
+{
+	const __m256i lineFeed = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+
+	int i = 0;
+	int numLineFeeds = 0;
+	while (i + 32 <= nSrcSize)
+	{
+		__m256i counts = _mm256_setzero_si256();
+		for (int nBlocks = 0; nBlocks < 255 && i + 32 <= nSrcSize; nBlocks++, i += 32)
+		{
+			__m256i block = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+			counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(block, lineFeed));
+		}
+
+		__m256i sums = _mm256_sad_epu8(counts, zero);
+		__m128i sums128 = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+		numLineFeeds += _mm_cvtsi128_si32(sums128) + _mm_cvtsi128_si32(_mm_srli_si128(sums128, 8));
+	}
+
+	return nSrcSize + numLineFeeds + CountLineFeeds_Scalar(pSrc + i, nSrcSize - i);
+}
+
+XZIP_TARGET_AVX2 static char* ExpandRange_AVX2(char* pDst, const char* pSrc, int nSrcSize)
+{
+	const __m256i lineFeed = _mm256_set1_epi8('\n');
+
+	int i = 0;
+	for (; i + 32 <= nSrcSize; i += 32)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(pSrc + i));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lineFeed));
+		if (!mask)
+		{
+			_mm256_storeu_si256((__m256i*)pDst, block);
+			pDst += 32;
+			continue;
+		}
+
+		int start = 0;
+		while (mask)
+		{
+			int index = LowestBitIndex(mask);
+			memcpy(pDst, pSrc + i + start, index - start);
+			pDst += index - start;
+			*pDst++ = '\r';
+			*pDst++ = '\n';
+			start = index + 1;
+			mask &= mask - 1;
+		}
+		memcpy(pDst, pSrc + i + start, 32 - start);
+		pDst += 32 - start;
+	}
+
+	return Expand_Scalar(pDst, pSrc + i, nSrcSize - i);
+}
+
+XZIP_TARGET_AVX2 static int Collapse_AVX2(char* pData, int nSize)
+{
+	const __m256i carriageReturn = _mm256_set1_epi8('\r');
+	const __m256i lineFeed = _mm256_set1_epi8('\n');
+
+	char* pDst = pData;
+	int i = 0;
+	for (; i + 33 <= nSize; i += 32)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(pData + i));
+		__m256i next = _mm256_loadu_si256((const __m256i*)(pData + i + 1));
+		unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(block, carriageReturn), _mm256_cmpeq_epi8(next, lineFeed)));
+		if (!mask)
+		{
+			_mm256_storeu_si256((__m256i*)pDst, block);
+			pDst += 32;
+			continue;
+		}
+
+		int start = 0;
+		while (mask)
+		{
+			int index = LowestBitIndex(mask);
+			memmove(pDst, pData + i + start, index - start);
+			pDst += index - start;
+			start = index + 1;
+			mask &= mask - 1;
+		}
+		memmove(pDst, pData + i + start, 32 - start);
+		pDst += 32 - start;
+	}
+
+	return (int)(Collapse_Scalar(pDst, pData + i, pData + nSize, pData + nSize) - pData);
+}
+
+/**
+ * True if the CPU and the OS support AVX2.
+ */
+static bool CPUHasAVX2(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// AVX and OSXSAVE, then make sure the OS saves the YMM registers
+	__cpuid(info, 1);
+	if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+		return false;
+
+	if ((_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // XZIP_SSE2
+
+//-----------------------------------------------------------------------------
+// Dispatch
+//-----------------------------------------------------------------------------
+struct TextKernels_t
+{
+	int		(*m_pfnGetExpandedLength)(const char* pSrc, int nSrcSize);
+	char*	(*m_pfnExpand)(char* pDst, const char* pSrc, int nSrcSize);
+	int		(*m_pfnCollapse)(char* pData, int nSize);
+};
+
+static TextKernels_t SelectTextKernels(void)
+{
+#ifdef XZIP_SSE2
+	if (CPUHasAVX2())
+	{
+		return { GetExpandedLength_AVX2, ExpandRange_AVX2, Collapse_AVX2 };
+	}
+
+	return { GetExpandedLength_SSE2, ExpandRange_SSE2, Collapse_SSE2 };
+#else
+	return { GetExpandedLength_Scalar, Expand_Scalar, Collapse_ScalarAll };
+#endif
+}
+
+static const TextKernels_t& GetTextKernels(void)
+{
+	static const TextKernels_t s_Kernels = SelectTextKernels();
+	return s_Kernels;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Size of the data with LF expanded to CRLF
+//-----------------------------------------------------------------------------
+int CXZipText::GetExpandedLength(const char* pSrc, int nSrcSize)
+{
+	return GetTextKernels().m_pfnGetExpandedLength(pSrc, nSrcSize);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: LF to CRLF
+//-----------------------------------------------------------------------------
+void CXZipText::Expand(char* pDst, const char* pSrc, int nDstSize, int nSrcSize)
+{
+	char* pDstEnd = GetTextKernels().m_pfnExpand(pDst, pSrc, nSrcSize);
+	Assert(pDstEnd - pDst == nDstSize);
+	(void)pDstEnd;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: CRLF to LF, in place
+//-----------------------------------------------------------------------------
+int CXZipText::Collapse(char* pData, int nSize)
+{
+	return GetTextKernels().m_pfnCollapse(pData, nSize);
+}
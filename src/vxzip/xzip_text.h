@@ -0,0 +1,47 @@
+/*****************************************************************//**
+ * \file   xzip_text.h
+ * \brief  Line ending transforms for text mode entries.
+ *********************************************************************/
+#ifndef _XZIP_TEXT_H
+#define _XZIP_TEXT_H
+
+#pragma once
+
+/**
+ * Text entries are stored with CRLF line endings and read back with LF.
+ *
+ * Every transform has a scalar, an SSE2 and an AVX2 version, the best one
+ * the CPU supports is picked on first use. All versions produce the same
+ * output byte for byte.
+ */
+class CXZipText
+{
+public:
+	/**
+	 * Size of the data once every LF is expanded to CRLF.
+	 *
+	 * \param pSrc		Source data
+	 * \param nSrcSize	Size of the source data
+	 * \return Expanded size
+	 */
+	static int	GetExpandedLength(const char* pSrc, int nSrcSize);
+	/**
+	 * Expands every LF to CRLF.
+	 *
+	 * \param pDst		Destination, must not overlap the source
+	 * \param pSrc		Source data
+	 * \param nDstSize	Size of the destination, see GetExpandedLength
+	 * \param nSrcSize	Size of the source data
+	 */
+	static void	Expand(char* pDst, const char* pSrc, int nDstSize, int nSrcSize);
+	/**
+	 * Collapses every CRLF pair to LF, in place.
+	 *
+	 * \param pData		Data to collapse
+	 * \param nSize		Size of the data
+	 * \return New size of the data
+	 */
+	static int	Collapse(char* pData, int nSize);
+};
+
+#endif // _XZIP_TEXT_H
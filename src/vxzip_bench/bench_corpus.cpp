@@ -0,0 +1,206 @@
+/*****************************************************************//**
+ * \file   bench_corpus.cpp
+ * \brief  Reproducible synthetic corpus with a Source asset mix.
+ *********************************************************************/
+
+#include <math.h>
+
+#include "bench_corpus.h"
+
+/**
+ * The mix of a typical game pak: lots of small materials and scripts, a
+ * fair share of models and few but large textures and sounds.
+ */
+static const BenchAssetClass_t s_AssetClasses[] =
+{
+	{ "materials",	".vmt",	BENCH_CONTENT_TEXT,		450,	200,		2 * 1024 },
+	{ "scripts",	".txt",	BENCH_CONTENT_TEXT,		150,	512,		8 * 1024 },
+	{ "models",		".mdl",	BENCH_CONTENT_MESH,		120,	32 * 1024,	512 * 1024 },
+	{ "models",		".vtx",	BENCH_CONTENT_MESH,		120,	16 * 1024,	256 * 1024 },
+	{ "materials",	".vtf",	BENCH_CONTENT_TEXTURE,	120,	16 * 1024,	2 * 1024 * 1024 },
+	{ "sound",		".wav",	BENCH_CONTENT_AUDIO,	40,		64 * 1024,	4 * 1024 * 1024 },
+};
+
+static const char* s_TextKeys[] =
+{
+	"\"$basetexture\"", "\"$bumpmap\"", "\"$surfaceprop\"", "\"$envmap\"", "\"$detail\"",
+	"\"$selfillum\"", "\"$translucent\"", "\"$alphatest\"", "\"$nocull\"", "\"$model\"",
+	"\"damage\"", "\"range\"", "\"clip_size\"", "\"printname\"", "\"viewmodel\"",
+};
+
+static const char* s_TextValues[] =
+{
+	"\"concrete\"", "\"metal\"", "\"wood\"", "\"env_cubemap\"", "\"1\"", "\"0\"",
+	"\"dev/dev_measuregeneric01\"", "\"brick/brickwall031b\"", "\"models/weapons/v_pistol\"",
+	"\"nature/blendgrassdirt\"", "\"[1 1 1]\"", "\"0.5\"",
+};
+
+//-----------------------------------------------------------------------------
+// Purpose: Entry names are grouped in folders like a real pak, so directory
+//			order and name lengths look familiar to the directory code
+//-----------------------------------------------------------------------------
+void CBenchCorpus::Generate(int nEntries, uint64 nSeed)
+{
+	m_Entries.Purge();
+	m_Entries.EnsureCapacity(nEntries);
+
+	int nTotalWeight = 0;
+	for (int c = 0; c < ARRAYSIZE(s_AssetClasses); c++)
+	{
+		nTotalWeight += s_AssetClasses[c].m_nWeight;
+	}
+
+	CBenchRandom random(nSeed);
+	for (int i = 0; i < nEntries; i++)
+	{
+		int nPick = random.Range(0, nTotalWeight - 1);
+		int nClass = 0;
+		while (nPick >= s_AssetClasses[nClass].m_nWeight)
+		{
+			nPick -= s_AssetClasses[nClass].m_nWeight;
+			nClass++;
+		}
+
+		const BenchAssetClass_t& assetClass = s_AssetClasses[nClass];
+		double flLogMin = log((double)assetClass.m_nMinSize);
+		double flLogMax = log((double)assetClass.m_nMaxSize);
+
+		Entry_t& entry = m_Entries[m_Entries.AddToTail()];
+		entry.m_nClass = nClass;
+		entry.m_nSize = (int)exp(flLogMin + (flLogMax - flLogMin) * random.Float());
+		entry.m_nSeed = random.Next();
+		entry.m_Name.Format("%s/bench/%02d/%s_%06d%s", assetClass.m_pszFolder, i % 64,
+			assetClass.m_pszExtension + 1, i, assetClass.m_pszExtension);
+	}
+}
+
+bool CBenchCorpus::IsText(int i) const
+{
+	return s_AssetClasses[m_Entries[i].m_nClass].m_eContent == BENCH_CONTENT_TEXT;
+}
+
+uint64 CBenchCorpus::GetTotalSize(void) const
+{
+	uint64 nTotal = 0;
+	for (int i = 0; i < m_Entries.Count(); i++)
+	{
+		nTotal += m_Entries[i].m_nSize;
+	}
+	return nTotal;
+}
+
+void CBenchCorpus::GetData(int i, CUtlBuffer& buf) const
+{
+	const Entry_t& entry = m_Entries[i];
+
+	buf.Clear();
+	buf.EnsureCapacity(entry.m_nSize);
+	unsigned char* pData = (unsigned char*)buf.Base();
+
+	CBenchRandom random(entry.m_nSeed);
+	switch (s_AssetClasses[entry.m_nClass].m_eContent)
+	{
+	case BENCH_CONTENT_TEXT:	FillText(random, pData, entry.m_nSize); break;
+	case BENCH_CONTENT_MESH:	FillMesh(random, pData, entry.m_nSize); break;
+	case BENCH_CONTENT_TEXTURE:	FillTexture(random, pData, entry.m_nSize); break;
+	case BENCH_CONTENT_AUDIO:	FillAudio(random, pData, entry.m_nSize); break;
+	}
+
+	buf.SeekPut(CUtlBuffer::SEEK_HEAD, entry.m_nSize);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Keyvalues from a small vocabulary, LF line ends
+//-----------------------------------------------------------------------------
+void CBenchCorpus::FillText(CBenchRandom& random, unsigned char* pData, int nSize)
+{
+	int nPos = 0;
+	char line[256];
+	while (nPos < nSize)
+	{
+		int nLength = V_snprintf(line, sizeof(line), "\t%s %s\n",
+			s_TextKeys[random.Range(0, ARRAYSIZE(s_TextKeys) - 1)],
+			s_TextValues[random.Range(0, ARRAYSIZE(s_TextValues) - 1)]);
+		nLength = Min(nLength, nSize - nPos);
+		memcpy(pData + nPos, line, nLength);
+		nPos += nLength;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 32 byte vertex records, positions drift slowly and indices count
+//			up, so the data is structured but not trivially repetitive
+//-----------------------------------------------------------------------------
+void CBenchCorpus::FillMesh(CBenchRandom& random, unsigned char* pData, int nSize)
+{
+	float position[3] = { 0.0f, 0.0f, 0.0f };
+	int nRecord = 0;
+	int nPos = 0;
+	while (nPos < nSize)
+	{
+		unsigned char record[32] = { 0 };
+		for (int k = 0; k < 3; k++)
+		{
+			position[k] += (float)(random.Float() - 0.5);
+		}
+		memcpy(record, position, sizeof(position));
+		short normal[3] = { (short)random.Range(-32767, 32767), (short)random.Range(-32767, 32767), 0 };
+		memcpy(record + 12, normal, sizeof(normal));
+		memcpy(record + 20, &nRecord, sizeof(nRecord));
+		record[24] = (unsigned char)random.Range(0, 3);
+
+		int nLength = Min((int)sizeof(record), nSize - nPos);
+		memcpy(pData + nPos, record, nLength);
+		nPos += nLength;
+		nRecord++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: DXT1 like 8 byte blocks, endpoints follow a gradient and the
+//			selector bits are noise, which compresses about as badly as the
+//			real thing
+//-----------------------------------------------------------------------------
+void CBenchCorpus::FillTexture(CBenchRandom& random, unsigned char* pData, int nSize)
+{
+	int nBlock = 0;
+	int nPos = 0;
+	unsigned short nBase = (unsigned short)random.Next();
+	while (nPos < nSize)
+	{
+		unsigned char block[8];
+		unsigned short color0 = (unsigned short)(nBase + nBlock / 16);
+		unsigned short color1 = (unsigned short)(color0 + random.Range(0, 64));
+		unsigned int selectors = (unsigned int)random.Next();
+		memcpy(block, &color0, 2);
+		memcpy(block + 2, &color1, 2);
+		memcpy(block + 4, &selectors, 4);
+
+		int nLength = Min((int)sizeof(block), nSize - nPos);
+		memcpy(pData + nPos, block, nLength);
+		nPos += nLength;
+		nBlock++;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: A couple of tones plus noise, 16 bit mono
+//-----------------------------------------------------------------------------
+void CBenchCorpus::FillAudio(CBenchRandom& random, unsigned char* pData, int nSize)
+{
+	double flFreq0 = 0.01 + random.Float() * 0.05;
+	double flFreq1 = 0.001 + random.Float() * 0.01;
+	int nSample = 0;
+	int nPos = 0;
+	while (nPos < nSize)
+	{
+		double flValue = 9000.0 * sin(nSample * flFreq0) + 5000.0 * sin(nSample * flFreq1) +
+			(random.Float() - 0.5) * 2000.0;
+		short sample = (short)flValue;
+
+		int nLength = Min((int)sizeof(sample), nSize - nPos);
+		memcpy(pData + nPos, &sample, nLength);
+		nPos += nLength;
+		nSample++;
+	}
+}
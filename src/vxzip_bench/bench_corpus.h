@@ -0,0 +1,128 @@
+/*****************************************************************//**
+ * \file   bench_corpus.h
+ * \brief  Reproducible synthetic corpus with a Source asset mix.
+ *********************************************************************/
+#ifndef _BENCH_CORPUS_H_
+#define _BENCH_CORPUS_H_
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "source_sdk.h"
+#include "utlvector.h"
+
+/**
+ * Small seeded generator (xorshift64*), the same seed always gives the same
+ * sequence on every machine.
+ */
+class CBenchRandom
+{
+public:
+	CBenchRandom(uint64 nSeed) { m_nState = nSeed ? nSeed : 0x9E3779B97F4A7C15ull; }
+
+	uint64 Next(void)
+	{
+		m_nState ^= m_nState >> 12;
+		m_nState ^= m_nState << 25;
+		m_nState ^= m_nState >> 27;
+		return m_nState * 0x2545F4914F6CDD1Dull;
+	}
+
+	/**
+	 * \return Value in [nMin, nMax]
+	 */
+	int Range(int nMin, int nMax)
+	{
+		return nMin + (int)(Next() % (uint64)(nMax - nMin + 1));
+	}
+
+	/**
+	 * \return Value in [0, 1)
+	 */
+	double Float(void)
+	{
+		return (Next() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+private:
+	uint64 m_nState;
+};
+
+/**
+ * Kind of content generated for an asset class.
+ */
+enum BenchContent_t
+{
+	BENCH_CONTENT_TEXT,		// keyvalues, vmt and txt
+	BENCH_CONTENT_MESH,		// fixed size records, mdl and vtx
+	BENCH_CONTENT_TEXTURE,	// block compressed pixels, vtf
+	BENCH_CONTENT_AUDIO,	// 16 bit pcm, wav
+};
+
+/**
+ * Asset class of the corpus mix.
+ */
+struct BenchAssetClass_t
+{
+	const char*		m_pszFolder;
+	const char*		m_pszExtension;
+	BenchContent_t	m_eContent;
+	// entries per thousand
+	int				m_nWeight;
+	// sizes are log uniform in [min, max]
+	int				m_nMinSize;
+	int				m_nMaxSize;
+};
+
+/**
+ * Corpus of synthetic entries. Only names and sizes are kept, the contents
+ * are generated on demand from the seed, so a corpus of any size costs
+ * almost no memory and every run sees the same bytes.
+ */
+class CBenchCorpus
+{
+public:
+	/**
+	 * Builds the entry list.
+	 *
+	 * \param nEntries	Number of entries
+	 * \param nSeed		Seed, equal seeds give equal corpora
+	 */
+	void			Generate(int nEntries, uint64 nSeed);
+
+	int				Count(void) const { return m_Entries.Count(); }
+	const char*		GetName(int i) const { return m_Entries[i].m_Name.String(); }
+	int				GetSize(int i) const { return m_Entries[i].m_nSize; }
+	bool			IsText(int i) const;
+	/**
+	 * \return Sum of the entry sizes
+	 */
+	uint64			GetTotalSize(void) const;
+
+	/**
+	 * Generates the contents of an entry.
+	 *
+	 * \param i		Entry
+	 * \param buf	Receives the contents, replacing what it held
+	 */
+	void			GetData(int i, CUtlBuffer& buf) const;
+
+private:
+	struct Entry_t
+	{
+		CUtlString	m_Name;
+		int			m_nClass;
+		int			m_nSize;
+		uint64		m_nSeed;
+	};
+
+	static void		FillText(CBenchRandom& random, unsigned char* pData, int nSize);
+	static void		FillMesh(CBenchRandom& random, unsigned char* pData, int nSize);
+	static void		FillTexture(CBenchRandom& random, unsigned char* pData, int nSize);
+	static void		FillAudio(CBenchRandom& random, unsigned char* pData, int nSize);
+
+	CUtlVector<Entry_t>	m_Entries;
+};
+
+#endif // _BENCH_CORPUS_H_
@@ -0,0 +1,88 @@
+/*****************************************************************//**
+ * \file   bench_report.cpp
+ * \brief  Benchmark results and their JSON output.
+ *********************************************************************/
+
+#include <math.h>
+
+#include "bench_report.h"
+
+static int __cdecl LatencySortFunc(const double* pLeft, const double* pRight)
+{
+	return (*pLeft < *pRight) ? -1 : (*pLeft > *pRight) ? 1 : 0;
+}
+
+void CBenchReport::Add(BenchResult_t& result)
+{
+	result.m_Latencies.Sort(LatencySortFunc);
+
+	Summary_t& summary = m_Results[m_Results.AddToTail()];
+	summary.m_Name = result.m_Name;
+	summary.m_nEntries = result.m_nEntries;
+	summary.m_nAlignment = result.m_nAlignment;
+	summary.m_nOps = result.m_nOps;
+	summary.m_nBytes = result.m_nBytes;
+	summary.m_flSeconds = result.m_flSeconds;
+
+	double flSeconds = Max(result.m_flSeconds, 1e-9);
+	summary.m_flOpsPerSec = result.m_nOps / flSeconds;
+	summary.m_flMBPerSec = result.m_nBytes / (1024.0 * 1024.0) / flSeconds;
+
+	summary.m_flP50 = Percentile(result.m_Latencies, 0.50) * 1e6;
+	summary.m_flP90 = Percentile(result.m_Latencies, 0.90) * 1e6;
+	summary.m_flP99 = Percentile(result.m_Latencies, 0.99) * 1e6;
+	summary.m_flMax = Percentile(result.m_Latencies, 1.00) * 1e6;
+}
+
+void CBenchReport::Print(void) const
+{
+	Msg("%-26s %8s %6s %8s %12s %10s %10s %10s %10s %10s\n",
+		"benchmark", "entries", "align", "ops", "ops/s", "MB/s", "p50 us", "p90 us", "p99 us", "max us");
+
+	for (int i = 0; i < m_Results.Count(); i++)
+	{
+		const Summary_t& r = m_Results[i];
+		Msg("%-26s %8d %6u %8d %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			r.m_Name.String(), r.m_nEntries, r.m_nAlignment, r.m_nOps, r.m_flOpsPerSec, r.m_flMBPerSec,
+			r.m_flP50, r.m_flP90, r.m_flP99, r.m_flMax);
+	}
+}
+
+bool CBenchReport::WriteJSON(const char* pszPath) const
+{
+	FILE* fp = fopen(pszPath, "w");
+	if (!fp)
+	{
+		return false;
+	}
+
+	fprintf(fp, "[\n");
+	for (int i = 0; i < m_Results.Count(); i++)
+	{
+		const Summary_t& r = m_Results[i];
+		fprintf(fp, "  { \"benchmark\": \"%s\", \"entries\": %d, \"alignment\": %u, "
+			"\"ops\": %d, \"bytes\": %llu, \"seconds\": %.6f, \"ops_per_sec\": %.3f, \"mb_per_sec\": %.3f, "
+			"\"latency_us\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f } }%s\n",
+			r.m_Name.String(), r.m_nEntries, r.m_nAlignment,
+			r.m_nOps, (unsigned long long)r.m_nBytes, r.m_flSeconds, r.m_flOpsPerSec, r.m_flMBPerSec,
+			r.m_flP50, r.m_flP90, r.m_flP99, r.m_flMax,
+			(i + 1 < m_Results.Count()) ? "," : "");
+	}
+	fprintf(fp, "]\n");
+
+	return (fclose(fp) == 0);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Nearest rank on sorted samples, 0 without samples
+//-----------------------------------------------------------------------------
+double CBenchReport::Percentile(const CUtlVector<double>& sorted, double flFraction)
+{
+	if (!sorted.Count())
+	{
+		return 0.0;
+	}
+
+	int nRank = (int)ceil(flFraction * sorted.Count());
+	return sorted[clamp(nRank - 1, 0, sorted.Count() - 1)];
+}
@@ -0,0 +1,75 @@
+/*****************************************************************//**
+ * \file   bench_report.h
+ * \brief  Benchmark results and their JSON output.
+ *********************************************************************/
+#ifndef _BENCH_REPORT_H_
+#define _BENCH_REPORT_H_
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "source_sdk.h"
+#include "utlvector.h"
+
+/**
+ * Result of one benchmark case.
+ */
+struct BenchResult_t
+{
+	CUtlString			m_Name;
+	int					m_nEntries;
+	unsigned int		m_nAlignment;
+	// operations timed and the bytes they moved
+	int					m_nOps;
+	uint64				m_nBytes;
+	double				m_flSeconds;
+	// one sample per operation, in seconds
+	CUtlVector<double>	m_Latencies;
+};
+
+/**
+ * Collects results, prints a summary and writes them as a JSON array.
+ *
+ * Every result becomes an object with the case name and parameters, the
+ * ops, bytes and seconds, the derived ops_per_sec and mb_per_sec and the
+ * p50, p90, p99 and max latencies in microseconds.
+ */
+class CBenchReport
+{
+public:
+	/**
+	 * Takes a result over, its latency samples get sorted.
+	 */
+	void			Add(BenchResult_t& result);
+	void			Print(void) const;
+	/**
+	 * \param pszPath	Output file
+	 * \return False if the file could not be written
+	 */
+	bool			WriteJSON(const char* pszPath) const;
+
+private:
+	struct Summary_t
+	{
+		CUtlString		m_Name;
+		int				m_nEntries;
+		unsigned int	m_nAlignment;
+		int				m_nOps;
+		uint64			m_nBytes;
+		double			m_flSeconds;
+		double			m_flOpsPerSec;
+		double			m_flMBPerSec;
+		// microseconds
+		double			m_flP50;
+		double			m_flP90;
+		double			m_flP99;
+		double			m_flMax;
+	};
+
+	static double	Percentile(const CUtlVector<double>& sorted, double flFraction);
+
+	CUtlVector<Summary_t>	m_Results;
+};
+
+#endif // _BENCH_REPORT_H_
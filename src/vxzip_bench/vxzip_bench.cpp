@@ -0,0 +1,539 @@
+/*****************************************************************//**
+ * \file   vxzip_bench.cpp
+ * \brief  Benchmark entry point
+ *********************************************************************/
+#include "vxzip_bench.h"
+
+// Same writer setup as the extract action
+static const int BENCH_WRITE_THREADS = 4;
+static const size_t BENCH_WRITE_BUDGET = 64 * 1024 * 1024;
+
+static SpewRetval_t OutputFunc(SpewType_t spewType, char const* pMsg)
+{
+	// write to standard output
+	printf(pMsg);
+
+	switch (spewType)
+	{
+	case SPEW_ERROR: return SPEW_ABORT;
+	case SPEW_ASSERT:return SPEW_DEBUGGER;
+	default: return SPEW_CONTINUE;
+	}
+}
+
+bool CVXZipBenchApp::Create()
+{
+	// Redirect spew output
+	SpewOutputFunc(OutputFunc);
+
+	AppSystemInfo_t appSystems[] =
+	{
+		{ "", "" }	// Required to terminate the list
+	};
+	return AddSystems(appSystems);
+}
+
+bool CVXZipBenchApp::PreInit()
+{
+	CreateInterfaceFn factory = GetFactory();
+
+	ConnectTier1Libraries(&factory, 1);
+	ConnectTier2Libraries(&factory, 1);
+
+	return true;
+}
+
+int CVXZipBenchApp::Main()
+{
+	if (CommandLine()->FindParm("-help") || CommandLine()->FindParm("-?"))
+	{
+		PrintHelp();
+		return 0;
+	}
+
+	CUtlVector<int> entryCounts;
+	CUtlVector<int> alignments;
+	ParseList(CommandLine()->ParmValue(this->m_szEntriesToken, "256,1024,4096"), entryCounts);
+	ParseList(CommandLine()->ParmValue(this->m_szAlignToken, "0,2048"), alignments);
+
+	this->m_nSeed = CommandLine()->ParmValue(this->m_szSeedToken, this->m_nSeed);
+	this->m_nRepeat = Max(1, CommandLine()->ParmValue(this->m_szRepeatToken, this->m_nRepeat));
+	this->m_nJobs = CommandLine()->ParmValue(this->m_szJobsToken, this->m_nJobs);
+
+	const char* pszCodec = CommandLine()->ParmValue(this->m_szCodecToken, (const char*)NULL);
+	if (pszCodec)
+	{
+		this->m_eCompressionType = CXZipCodec::FromName(pszCodec);
+		if (!CXZipCodec::CanEncode(this->m_eCompressionType))
+		{
+			Warning("Codec %s is not available in this build\n", pszCodec);
+			return 1;
+		}
+	}
+
+	const char* pszOutput = CommandLine()->ParmValue(this->m_szOutputToken, "vxzip_bench.json");
+	const char* pszTemp = CommandLine()->ParmValue(this->m_szTempToken, (const char*)NULL);
+	fs::path basePath = pszTemp ? fs::path(pszTemp) : fs::temp_directory_path();
+
+	// scratch goes in a fresh folder of our own, the cleanup below removes
+	// that one and never the folder we were given
+	std::error_code ec;
+	fs::create_directories(basePath, ec);
+	bool bCreated = false;
+	for (int n = 0; n < 100 && !bCreated; n++)
+	{
+		char szFolder[64];
+		V_snprintf(szFolder, sizeof(szFolder), "vxzip_bench_%lu_%d", GetCurrentProcessId(), n);
+		this->m_TempPath = basePath / szFolder;
+		bCreated = fs::create_directory(this->m_TempPath, ec);
+	}
+
+	if (!bCreated)
+	{
+		Warning("Failed to create a scratch folder in %s\n", basePath.string().c_str());
+		return 1;
+	}
+	this->m_PakPath = this->m_TempPath / "bench.zip";
+
+	Msg("Codec %s, seed %d, %d repeats\n", CXZipCodec::GetName(this->m_eCompressionType), this->m_nSeed, this->m_nRepeat);
+
+	for (int i = 0; i < entryCounts.Count(); i++)
+	{
+		CBenchCorpus corpus;
+		corpus.Generate(Max(1, entryCounts[i]), (uint64)this->m_nSeed);
+		Msg("Corpus of %d entries, %.1f MB\n", corpus.Count(), corpus.GetTotalSize() / (1024.0 * 1024.0));
+
+		for (int j = 0; j < alignments.Count(); j++)
+		{
+			RunCases(corpus, (unsigned int)Max(0, alignments[j]));
+		}
+	}
+
+	fs::remove_all(this->m_TempPath, ec);
+
+	Msg("\n");
+	this->m_Report.Print();
+	if (!this->m_Report.WriteJSON(pszOutput))
+	{
+		Warning("Failed to write %s\n", pszOutput);
+		return 1;
+	}
+
+	Msg("Results written to %s\n", pszOutput);
+	return 0;
+}
+
+void CVXZipBenchApp::PostShutdown()
+{
+	// always disconnect these last and in this order
+	DisconnectTier2Libraries();
+	DisconnectTier1Libraries();
+	return;
+}
+
+void CVXZipBenchApp::PrintHelp()
+{
+	Msg("vxzip_bench - vxzip benchmarks on a synthetic Source asset corpus\n");
+	Msg("by Intrinsic <intrinsic.dev@outlook.com>\n(build: %s %s)\n", __DATE__, __TIME__);
+	Msg("\n");
+
+	Msg("Usage:\n");
+	Msg("\tvxzip_bench.exe [options]\n");
+
+	Msg("\n");
+	Msg("Options:\n");
+	Msg("\t%s [n,n,...]       Corpus entry counts (default 256,1024,4096)\n", this->m_szEntriesToken);
+	Msg("\t%s [n,n,...]         Pak alignments, 0 for none (default 0,2048)\n", this->m_szAlignToken);
+	Msg("\t%s [seed]             Corpus seed, equal seeds give equal corpora (default 1)\n", this->m_szSeedToken);
+	Msg("\t%s [count]          Repeats of the open cases (default 20)\n", this->m_szRepeatToken);
+	Msg("\t%s [threads]             Extract threads, 0 for one per core (default 0)\n", this->m_szJobsToken);
+	Msg("\t%s [none|lzma|zstd|lz4] Codec of the built paks (default lzma when available)\n", this->m_szCodecToken);
+	Msg("\t%s [file]                JSON results (default vxzip_bench.json)\n", this->m_szOutputToken);
+	Msg("\t%s [folder]            Where the scratch folder goes (default the system temp folder)\n", this->m_szTempToken);
+	Msg("\n");
+}
+
+void CVXZipBenchApp::ParseList(const char* pszList, CUtlVector<int>& values)
+{
+	const char* p = pszList;
+	while (*p)
+	{
+		char* pEnd;
+		long nValue = strtol(p, &pEnd, 10);
+		if (pEnd == p)
+			break;
+
+		values.AddToTail((int)nValue);
+		p = pEnd;
+		while (*p == ',' || *p == ' ')
+			p++;
+	}
+}
+
+BenchResult_t& CVXZipBenchApp::StartResult(BenchResult_t& result, const char* pszName, const CBenchCorpus& corpus, unsigned int nAlignment)
+{
+	result.m_Name = pszName;
+	result.m_nEntries = corpus.Count();
+	result.m_nAlignment = nAlignment;
+	result.m_nOps = 0;
+	result.m_nBytes = 0;
+	result.m_flSeconds = 0.0;
+	result.m_Latencies.Purge();
+	return result;
+}
+
+void CVXZipBenchApp::RunCases(const CBenchCorpus& corpus, unsigned int nAlignment)
+{
+	Msg("Running %d entries, alignment %u\n", corpus.Count(), nAlignment);
+
+	BenchBuild(corpus, nAlignment);
+	BenchOpenFromDisk(corpus, nAlignment);
+	BenchOpenFromBuffer(corpus, nAlignment);
+	BenchRead(corpus, nAlignment, false);
+	BenchRead(corpus, nAlignment, true);
+	BenchExtract(corpus, nAlignment);
+}
+
+void CVXZipBenchApp::BenchBuild(const CBenchCorpus& corpus, unsigned int nAlignment)
+{
+	// spill like the build action does, so memory stays flat at any corpus size
+	CXZipFile* pZip = new CXZipFile(this->m_TempPath.string().c_str(), true);
+	if (nAlignment)
+		pZip->ForceAlignment(true, true, nAlignment);
+
+	BenchResult_t add;
+	StartResult(add, "add_buffer", corpus, nAlignment);
+
+	CUtlBuffer data;
+	for (int i = 0; i < corpus.Count(); i++)
+	{
+		// generating the data is not part of the measurement
+		corpus.GetData(i, data);
+
+		double flStart = Plat_FloatTime();
+		pZip->AddBuffer(corpus.GetName(i), data.Base(), data.TellPut(), corpus.IsText(i), this->m_eCompressionType);
+		double flElapsed = Plat_FloatTime() - flStart;
+
+		add.m_Latencies.AddToTail(flElapsed);
+		add.m_flSeconds += flElapsed;
+		add.m_nBytes += data.TellPut();
+		add.m_nOps++;
+	}
+	this->m_Report.Add(add);
+
+	BenchResult_t save;
+	StartResult(save, "save_directory", corpus, nAlignment);
+
+	HANDLE hFile = CreateFile(this->m_PakPath.string().c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		Warning("Failed to create - %s\n", this->m_PakPath.string().c_str());
+		delete pZip;
+		return;
+	}
+
+	double flStart = Plat_FloatTime();
+	pZip->SaveToDisk(hFile);
+	save.m_nBytes = CWin32File::FileTell(hFile);
+	CloseHandle(hFile);
+	save.m_flSeconds = Plat_FloatTime() - flStart;
+	save.m_Latencies.AddToTail(save.m_flSeconds);
+	save.m_nOps = 1;
+	this->m_Report.Add(save);
+
+	delete pZip;
+}
+
+void CVXZipBenchApp::BenchOpenFromDisk(const CBenchCorpus& corpus, unsigned int nAlignment)
+{
+	BenchResult_t result;
+	StartResult(result, "open_from_disk", corpus, nAlignment);
+
+	for (int r = 0; r < this->m_nRepeat; r++)
+	{
+		CXZipFile zip(NULL, true);
+
+		double flStart = Plat_FloatTime();
+		HANDLE hZip = zip.OpenFromDisk(this->m_PakPath.string().c_str(), true);
+		double flElapsed = Plat_FloatTime() - flStart;
+
+		if (!hZip)
+		{
+			Warning("Failed to open - %s\n", this->m_PakPath.string().c_str());
+			return;
+		}
+		CloseHandle(hZip);
+
+		result.m_Latencies.AddToTail(flElapsed);
+		result.m_flSeconds += flElapsed;
+		result.m_nOps++;
+	}
+
+	this->m_Report.Add(result);
+}
+
+void CVXZipBenchApp::BenchOpenFromBuffer(const CBenchCorpus& corpus, unsigned int nAlignment)
+{
+	CUtlBuffer pak;
+	FILE* fp = fopen(this->m_PakPath.string().c_str(), "rb");
+	if (!fp)
+	{
+		Warning("Failed to open - %s\n", this->m_PakPath.string().c_str());
+		return;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	int nPakSize = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	pak.EnsureCapacity(nPakSize);
+	bool bRead = (nPakSize > 0) && (fread(pak.Base(), nPakSize, 1, fp) == 1);
+	fclose(fp);
+
+	if (!bRead)
+	{
+		Warning("Failed to read - %s\n", this->m_PakPath.string().c_str());
+		return;
+	}
+
+	BenchResult_t copied;
+	StartResult(copied, "open_from_buffer", corpus, nAlignment);
+	BenchResult_t borrowed;
+	StartResult(borrowed, "open_from_borrowed_buffer", corpus, nAlignment);
+
+	for (int r = 0; r < this->m_nRepeat; r++)
+	{
+		{
+			CXZipFile zip(NULL, true);
+			double flStart = Plat_FloatTime();
+			zip.OpenFromBuffer(pak.Base(), nPakSize);
+			double flElapsed = Plat_FloatTime() - flStart;
+
+			copied.m_Latencies.AddToTail(flElapsed);
+			copied.m_flSeconds += flElapsed;
+			copied.m_nBytes += nPakSize;
+			copied.m_nOps++;
+		}
+
+		{
+			CXZipFile zip(NULL, true);
+			double flStart = Plat_FloatTime();
+			zip.OpenFromBorrowedBuffer(pak.Base(), nPakSize);
+			double flElapsed = Plat_FloatTime() - flStart;
+
+			borrowed.m_Latencies.AddToTail(flElapsed);
+			borrowed.m_flSeconds += flElapsed;
+			borrowed.m_nBytes += nPakSize;
+			borrowed.m_nOps++;
+		}
+	}
+
+	this->m_Report.Add(copied);
+	this->m_Report.Add(borrowed);
+}
+
+/**
+ * Entry of an opened bench pak.
+ */
+struct BenchEntry_t
+{
+	int			m_iEntryID;
+	int			m_iFileSize;
+	bool		m_bText;
+	CUtlString	m_RelPath;
+};
+
+static int __cdecl BenchEntrySortFunc(const BenchEntry_t* pLeft, const BenchEntry_t* pRight)
+{
+	// largest first, like the extract action
+	if (pLeft->m_iFileSize != pRight->m_iFileSize)
+		return (pLeft->m_iFileSize > pRight->m_iFileSize) ? -1 : 1;
+
+	return pLeft->m_iEntryID - pRight->m_iEntryID;
+}
+
+/**
+ * Lists the entries of a pak in directory order.
+ */
+static void GetBenchEntries(CXZipFile& zip, CUtlVector<BenchEntry_t>& entries)
+{
+	const char* pszEntryName = NULL;
+	int iFileSize = 0;
+	int iEntryID = zip.GetNextEntry(-1, pszEntryName, iFileSize);
+	while (iEntryID > -1)
+	{
+		const char* pszExtension = V_GetFileExtension(pszEntryName);
+
+		auto& entry = entries[entries.AddToTail()];
+		entry.m_iEntryID = iEntryID;
+		entry.m_iFileSize = iFileSize;
+		entry.m_bText = pszExtension && (!V_stricmp(pszExtension, "vmt") || !V_stricmp(pszExtension, "txt"));
+		entry.m_RelPath = pszEntryName;
+
+		iEntryID = zip.GetNextEntry(iEntryID, pszEntryName, iFileSize);
+	}
+}
+
+void CVXZipBenchApp::BenchRead(const CBenchCorpus& corpus, unsigned int nAlignment, bool bRandom)
+{
+	CXZipFile zip(NULL, true);
+	HANDLE hZip = zip.OpenFromDisk(this->m_PakPath.string().c_str(), true);
+	if (!hZip)
+	{
+		Warning("Failed to open - %s\n", this->m_PakPath.string().c_str());
+		return;
+	}
+
+	CUtlVector<BenchEntry_t> entries;
+	GetBenchEntries(zip, entries);
+
+	if (bRandom)
+	{
+		// seeded shuffle, every run reads in the same order
+		CBenchRandom random((uint64)this->m_nSeed);
+		for (int i = entries.Count() - 1; i > 0; i--)
+		{
+			V_swap(entries[i], entries[random.Range(0, i)]);
+		}
+	}
+
+	int nMaxSize = 0;
+	for (int i = 0; i < entries.Count(); i++)
+	{
+		nMaxSize = Max(nMaxSize, entries[i].m_iFileSize);
+	}
+
+	// text reads need room for the terminator
+	CUtlBuffer out;
+	out.EnsureCapacity(nMaxSize + 1);
+
+	BenchResult_t result;
+	StartResult(result, bRandom ? "read_random" : "read_sequential", corpus, nAlignment);
+
+	for (int i = 0; i < entries.Count(); i++)
+	{
+		const BenchEntry_t& entry = entries[i];
+
+		int nBytesWritten = 0;
+		double flStart = Plat_FloatTime();
+		bool bSuccess = zip.ReadEntry(hZip, entry.m_iEntryID, entry.m_bText, out.Base(), out.Size(), nBytesWritten);
+		double flElapsed = Plat_FloatTime() - flStart;
+
+		if (!bSuccess)
+		{
+			Warning("Failed to read - %s\n", entry.m_RelPath.String());
+			continue;
+		}
+
+		result.m_Latencies.AddToTail(flElapsed);
+		result.m_flSeconds += flElapsed;
+		result.m_nBytes += entry.m_iFileSize;
+		result.m_nOps++;
+	}
+
+	CloseHandle(hZip);
+	this->m_Report.Add(result);
+}
+
+void CVXZipBenchApp::BenchExtract(const CBenchCorpus& corpus, unsigned int nAlignment)
+{
+	fs::path outputPath = this->m_TempPath / "extract";
+	std::error_code ec;
+	fs::remove_all(outputPath, ec);
+
+	CXZipFile zip(NULL, true);
+	HANDLE hZip = zip.OpenFromDisk(this->m_PakPath.string().c_str(), true);
+	if (!hZip)
+	{
+		Warning("Failed to open - %s\n", this->m_PakPath.string().c_str());
+		return;
+	}
+
+	CUtlVector<BenchEntry_t> entries;
+	GetBenchEntries(zip, entries);
+
+	BenchResult_t result;
+	StartResult(result, "extract_all_files", corpus, nAlignment);
+	result.m_Latencies.SetCount(entries.Count());
+
+	std::atomic<int> nFailed = 0;
+	double flStart = Plat_FloatTime();
+
+	// the folders are made up front, like the extract action
+	fs::path lastParentPath;
+	for (int i = 0; i < entries.Count(); i++)
+	{
+		auto parentPath = (fs::path{ outputPath } /= entries[i].m_RelPath.String()).parent_path();
+		if (parentPath != lastParentPath)
+		{
+			if (!fs::create_directories(parentPath, ec) && ec)
+			{
+				// the entries in there fail to write as well
+				Warning("Failed to create %s - %s\n", parentPath.string().c_str(), ec.message().c_str());
+				nFailed++;
+			}
+			lastParentPath = parentPath;
+		}
+	}
+
+	entries.Sort(BenchEntrySortFunc);
+
+	{
+		CAsyncFileWriter writer(BENCH_WRITE_THREADS, BENCH_WRITE_BUDGET, [&](int i, bool bSuccess)
+		{
+			if (!bSuccess)
+				nFailed++;
+		});
+
+		CJobPool pool(this->m_nJobs);
+		pool.Run(entries.Count(), [&](int i)
+		{
+			const BenchEntry_t& entry = entries[i];
+			double flJobStart = Plat_FloatTime();
+
+			auto finalPath = (fs::path{ outputPath } /= entry.m_RelPath.String());
+
+			// stored binary entries go straight from the mapping
+			const void* pView = NULL;
+			int nSize = 0;
+			if (!entry.m_bText && zip.GetEntryView(entry.m_iEntryID, pView, nSize))
+			{
+				writer.Write(finalPath.string().c_str(), pView, nSize, false, i);
+			}
+			else
+			{
+				int nBufferSize = entry.m_iFileSize + (entry.m_bText ? 1 : 0);
+				void* pBuffer = malloc(Max(nBufferSize, 1));
+				if (pBuffer && zip.ReadEntry(hZip, entry.m_iEntryID, entry.m_bText, pBuffer, nBufferSize, nSize))
+				{
+					writer.Write(finalPath.string().c_str(), pBuffer, nSize, true, i);
+				}
+				else
+				{
+					free(pBuffer);
+					nFailed++;
+				}
+			}
+
+			result.m_Latencies[i] = Plat_FloatTime() - flJobStart;
+		});
+
+		// the mapping has to outlive the writes straight out of it
+		writer.Finish();
+	}
+
+	result.m_flSeconds = Plat_FloatTime() - flStart;
+	result.m_nOps = entries.Count();
+	for (int i = 0; i < entries.Count(); i++)
+	{
+		result.m_nBytes += entries[i].m_iFileSize;
+	}
+
+	if (nFailed)
+	{
+		Warning("%d entries failed to extract\n", nFailed.load());
+	}
+
+	CloseHandle(hZip);
+	fs::remove_all(outputPath, ec);
+	this->m_Report.Add(result);
+}
@@ -0,0 +1,107 @@
+/*****************************************************************//**
+ * \file   vxzip_bench.h
+ * \brief  Source Engine Application object for the vxzip benchmarks
+ *********************************************************************/
+
+#pragma once
+#include <atomic>
+#include <filesystem>
+
+#include <appframework/appframework.h>
+#include <tier0/icommandline.h>
+#include <tier1/tier1.h>
+#include <tier2/tier2.h>
+#include "async_writer.h"
+#include "bench_corpus.h"
+#include "bench_report.h"
+#include "job_pool.h"
+#include "xzip_file.h"
+
+namespace fs = std::filesystem;
+
+/**
+ * Benchmarks building, opening, reading and extracting paks made from a
+ * synthetic corpus, for every combination of entry count and alignment.
+ * Results go to the console and to a JSON file.
+ */
+class CVXZipBenchApp : public CDefaultAppSystemGroup< CAppSystemGroup >
+{
+public:
+	virtual bool Create();
+	virtual bool PreInit();
+	virtual int Main();
+	virtual void PostShutdown();
+
+	/**
+	 * Spews app help and usage.
+	 *
+	 */
+	void PrintHelp();
+
+private:
+	// parameter tokens
+	const char* m_szEntriesToken = "-entries";
+	const char* m_szAlignToken = "-align";
+	const char* m_szSeedToken = "-seed";
+	const char* m_szRepeatToken = "-repeat";
+	const char* m_szJobsToken = "-j";
+	const char* m_szCodecToken = "-codec";
+	const char* m_szOutputToken = "-o";
+	const char* m_szTempToken = "-tmp";
+
+	/**
+	 * Runs every case on one corpus and alignment.
+	 *
+	 * \param corpus		Corpus to pack
+	 * \param nAlignment	Pak alignment, 0 for none
+	 */
+	void RunCases(const CBenchCorpus& corpus, unsigned int nAlignment);
+
+	/**
+	 * AddBuffer of every entry then SaveToDisk, the pak is left at m_PakPath.
+	 */
+	void BenchBuild(const CBenchCorpus& corpus, unsigned int nAlignment);
+	void BenchOpenFromDisk(const CBenchCorpus& corpus, unsigned int nAlignment);
+	/**
+	 * OpenFromBuffer (payloads copied) and OpenFromBorrowedBuffer.
+	 */
+	void BenchOpenFromBuffer(const CBenchCorpus& corpus, unsigned int nAlignment);
+	/**
+	 * ReadEntry of every entry in directory order, or in a seeded shuffle.
+	 */
+	void BenchRead(const CBenchCorpus& corpus, unsigned int nAlignment, bool bRandom);
+	/**
+	 * Same work as the extract action: parallel decode and background writes.
+	 */
+	void BenchExtract(const CBenchCorpus& corpus, unsigned int nAlignment);
+
+	BenchResult_t& StartResult(BenchResult_t& result, const char* pszName, const CBenchCorpus& corpus, unsigned int nAlignment);
+
+	/**
+	 * Parses a comma separated list of numbers.
+	 */
+	static void ParseList(const char* pszList, CUtlVector<int>& values);
+
+	int m_nSeed = 1;
+	int m_nRepeat = 20;
+	int m_nJobs = 0;
+#ifdef ZIP_SUPPORT_LZMA_ENCODE
+	IZip::eCompressionType m_eCompressionType = IZip::eCompressionType_LZMA;
+#else
+	IZip::eCompressionType m_eCompressionType = IZip::eCompressionType_None;
+#endif
+
+	/**
+	 * Scratch folder for the pak, the spill file and extracted files, created
+	 * for the run inside the -tmp folder.
+	 */
+	fs::path m_TempPath;
+	fs::path m_PakPath;
+
+	CBenchReport m_Report;
+};
+
+/**
+ * Register the application.
+ */
+DEFINE_CONSOLE_APPLICATION_OBJECT(CVXZipBenchApp);